@@ -35,6 +35,7 @@
 //#include "utils.h"
 #include "AlphiErrorCodes.h"
 #include "AlphiBoard.h"
+#include "UioBackend.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -59,17 +60,20 @@ Internal definitions
  * @param vendorId PCI vendor identification. Alphi is 0x13c5.
  * @param deviceId PCI device identification. The PCIe-Mini all use 0x0508.
  */
-AlphiBoard::AlphiBoard(uint16_t vendorId, uint16_t deviceId)
+AlphiBoard::AlphiBoard(uint16_t vendorId, uint16_t deviceId) :
+	bar0(bars[0]), bar2(bars[2]), bar3(bars[3])
 {
 	dwVendorId = vendorId;
 	dwDeviceId = deviceId; 
 	/* Initialize the minipcie_arinc429 library */
 	verbose = false;
 
-	bar0.Address = NULL;
-	bar0.Length = 0;
-	bar2.Address = NULL;
-	bar2.Length = 0;
+	for (int i = 0; i < BoardBackend::nbrOfBars; i++) {
+		bars[i].Address = NULL;
+		bars[i].Length = 0;
+		bars[i].WriteCombined = false;
+	}
+	wcBarMask = 0;
 
 	brdNumber = 0;
 	brd_valid = false;
@@ -77,12 +81,27 @@ AlphiBoard::AlphiBoard(uint16_t vendorId, uint16_t deviceId)
 	sysid = NULL;
 	intHandlerUserData = NULL;
 	funcDiagIntHandler = NULL;
+	intHandlerMask = 0;
+	memset(irqSources, 0, sizeof(irqSources));
 	irqThread = 0;
-
-	resfd2 = -1;
-	resfd0 = -1;
-	configfd = -1;
-	uiofd = -1;
+	irqThreadRunning = false;
+	irqThreadStop = false;
+	irqWakeFd = -1;
+	irqLatencyEnabled = true;
+	memset(&irqThreadConfig, 0, sizeof(irqThreadConfig));
+	irqThreadConfig.schedPolicy = SCHED_OTHER;
+	wakeProbeTime = 0;
+	irqRearmRequest = IRQ_REARM_AUTO;
+	memset(hybridSources, 0, sizeof(hybridSources));
+	hybridEnabled = 0;
+	hybridRateWindowUs = 10000;
+	hybridPollIntervalUs = 0;
+	hybridWindowStart = 0;
+
+	backend = NULL;
+	ownBackend = false;
+	dmaProvider = NULL;
+	ownDmaProvider = false;
 }
 
 //! Destructor
@@ -92,171 +111,94 @@ AlphiBoard::AlphiBoard(uint16_t vendorId, uint16_t deviceId)
 AlphiBoard::~AlphiBoard(void)
 {
 	Close();
+	if (ownBackend)
+		delete backend;
+	if (ownDmaProvider)
+		delete dmaProvider;
 }
 
-/** @brief Utility function to read an UIO config file containing a string
+/** @brief Select the backend used to access the board
  *
- * @retval return an error number or 0.
+ * Must be called before the board is opened. By default, Open() uses the UIO driver.
+ * @param newBackend Backend, owned by the caller. NULL to return to the UIO driver.
+ * @retval ERRCODE_BUSY if the board is open.
  */
-int AlphiBoard::readConfigString(char *data, int *len, const char *name)
+PCIeMini_status AlphiBoard::setBackend(BoardBackend* newBackend)
 {
-	int infoFn;
-	int l;
-	char filename[100];
-
-	sprintf(filename, "/sys/class/uio/uio%d/%s", brdNumber, name);
-	infoFn = open(filename, O_RDWR);
-	if (infoFn < 0) {
-		perror("Cannot get uio dev info:");
-		return errno;
-	}
-	l = read(infoFn, data, *len - 1);
-	data[l] = 0;
-	*len = l;
-	return close(infoFn);
+	if (brd_valid)
+		return ERRCODE_BUSY;
+
+	if (ownBackend)
+		delete backend;
+	backend = newBackend;
+	ownBackend = false;
+	return ERRCODE_NO_ERROR;
 }
 
-int AlphiBoard::readConfigHex(const char *name)
+/** @brief Select the allocator of the host DMA buffers
+ *
+ * The buffers already allocated must be released with their own provider.
+ * @param provider Provider, owned by the caller. NULL to return to the huge page provider.
+ */
+void AlphiBoard::setDmaProvider(DmaBufferProvider* provider)
 {
-	int infoFn;
-	int l;
-	char filename[100];
-	char dataString[100];
-	int data;
-
-	sprintf(filename, "/sys/class/uio/uio%d/%s", brdNumber, name);
-	infoFn = open(filename, O_RDWR);
-	if (infoFn < 0) {
-		perror("Cannot get uio dev info:");
-		return errno;
-	}
-	l = read(infoFn, dataString, sizeof(dataString) - 1);
-	dataString[l] = 0;
-	sscanf(dataString, "%x", &data);
-	close(infoFn);
-	return data;
+	if (ownDmaProvider)
+		delete dmaProvider;
+	dmaProvider = provider;
+	ownDmaProvider = false;
 }
 
-int AlphiBoard::readUioResource()
+/** @brief Return the allocator of the host DMA buffers, a HugePageDmaProvider unless one has been set */
+DmaBufferProvider* AlphiBoard::getDmaProvider(void)
 {
-	char filename[100];
-	int nbrBarsRead = 0;
-	uint64_t startAddr, endAddr, other;
-
-	sprintf(filename, "/sys/class/uio/uio%d/device/resource", brdNumber);
-	FILE *fp = fopen (filename, "r");
-	if (fp == NULL) {
-		perror("Cannot get uio dev info:");
-		return nbrBarsRead;
-	}
-
-	for (int i=0; i<nbrOfBars; i++)
-	{
-		fscanf(fp,"%lx %lx %lx\n", &startAddr, &endAddr, &other);
-		if (startAddr != 0) {
-			uioBarSizes[i] = endAddr - startAddr + 1;
-			nbrBarsRead++;
-		}
-		else
-			uioBarSizes[i] = 0;
+	if (dmaProvider == NULL) {
+		dmaProvider = new HugePageDmaProvider();
+		ownDmaProvider = true;
 	}
-	fclose(fp);
-	return nbrBarsRead;
+	return dmaProvider;
 }
 
-/** @brief Open a board using the UIO interface
+/** @brief Open a board
  *
-Establishes a connection to a board.
+Establishes a connection to a board, using the UIO interface unless another backend has been set.
 	@param brdNbr the board index to open.
 	@return ERRCODE_INVALID_BOARD_NUM if there is no board corresponding to the number
 */
 PCIeMini_status AlphiBoard::Open(int board_num)
 {
-	off_t addr;
-//	int resfd3;
-	void* bar0addr;
-	void* bar2addr;
-//	void* bar3;
-	char filename[100];
-	int i;
+	PCIeMini_status status;
 
 	brdNumber = board_num;
 
-	// Try to open the basic files
-	sprintf(filename, "/dev/uio%d", board_num);
- 	printf("\n");
-	uiofd = open(filename, O_RDWR);
-	if (uiofd < 0) {
-		perror("dev uio open:");
-		return ERRCODE_INVALID_BOARD_NUM;
-	}
-
-	sprintf(filename, "/sys/class/uio/uio%d/device/config", board_num);
-	configfd = open(filename, O_RDWR);
-	if (configfd < 0) {
-		perror("config open:");
-		return ERRCODE_INVALID_BOARD_NUM;
-	}
-
-	sprintf(filename, "/sys/class/uio/uio%d/device/resource0", board_num);
-	resfd0 = open(filename, O_RDWR);
-	if (resfd0 < 0) {
-		perror("sys resourse 0 open:");
-		return ERRCODE_INVALID_BOARD_NUM;
+	if (backend == NULL) {
+		backend = new UioBackend();
+		ownBackend = true;
 	}
 
-	sprintf(filename, "/sys/class/uio/uio%d/device/resource2", board_num);
-	resfd2 = open(filename, O_RDWR);
-	if (resfd2 < 0) {
-		perror("sys resourse 2 open:");
-		return ERRCODE_INVALID_BOARD_NUM;
+	status = backend->open(board_num, dwVendorId, dwDeviceId);
+	if (status != ERRCODE_SUCCESS)
+		return status;
+	if (verbose) {
+		printf("Manufacturer: 0x%04x, Device: 0x%04x\n", dwVendorId, dwDeviceId);
 	}
 
-	// Get board information from UIO
-	int l = sizeof(uioDev);
-	readConfigString(uioDev, &l, "dev");
-	l = sizeof(uioName);
-	readConfigString(uioName, &l, "name");
-	l = sizeof(uioVersion);
-	readConfigString(uioVersion, &l, "version");
-	l = sizeof(filename);
-
-	l = readUioResource();
-	printf("%d BARs found: Bar #0 size = 0x%lx, Bar #2 size = 0x%lx\n", l, uioBarSizes[0], uioBarSizes[2]);
-
-	i = readConfigHex("device/vendor");
-	if ((uint16_t)i != dwVendorId) {
-		fprintf(stderr, "Invalid PCI manufacturer ID: 0x%04x (should be 0x%04x)\n", i, dwVendorId);
-		return ERRCODE_INVALID_BOARD_NUM;
+	// Map all the BARs present into user space. BAR 0 (CRA) and BAR 2 (registers) are mandatory.
+	for (int i = 0; i < BoardBackend::nbrOfBars; i++) {
+		if (backend->getBarSize(i) == 0)
+			continue;
+		bars[i].Address = backend->mapBar(i, getBarWriteCombined(i), &bars[i].WriteCombined);
+		if (bars[i].Address == NULL)
+			continue;
+		bars[i].Length = backend->getBarSize(i);
+		printf("bar%d mapped %p length 0x%04lx%s\n", i, bars[i].Address, bars[i].Length,
+			bars[i].WriteCombined ? " write-combined" : "");
 	}
 
-	i = readConfigHex("device/device");
-	if ((uint16_t)i != dwDeviceId) {
-		fprintf(stderr, "Invalid PCI device ID: 0x%04x (should be 0x%04x)\n", i, dwDeviceId);
+	if (bar0.Address == NULL || bar2.Address == NULL) {
+		unmapBars();
+		backend->close();
 		return ERRCODE_INVALID_BOARD_NUM;
 	}
-	if (verbose) {
-		printf("Manufacturer: 0x%04x, Device: 0x%04x\n", dwVendorId, dwDeviceId);
-	}
-
-	// Map the board registers into user space
-	/* The parameter offset of the mmap() call has a special meaning for UIO devices: It is used to select
-	 * which mapping of your device you want to map. To map the memory of mapping N, you have to use N times
-	 * the page size as your offset:
-	 * offset = N * getpagesize();
-	 * N starts from zero, so if you’ve got only one memory range to map, set offset = 0.
-	 * */
-	addr = (0 * getpagesize()); // leave page offset right here
-
-	bar0addr = mmap(NULL, uioBarSizes[0], PROT_READ|PROT_WRITE, MAP_SHARED, resfd0, addr);
-	printf("bar0 mapped %p length 0x%04lx\n", bar0addr, uioBarSizes[0]);
-	bar0.Address = bar0addr;
-	bar0.Length = uioBarSizes[0];
-
-	bar2addr = mmap(NULL, uioBarSizes[2], PROT_READ|PROT_WRITE, MAP_SHARED, resfd2, addr);
-	printf("bar2 mapped %p length 0x%04lx\n", bar2addr, uioBarSizes[0]);
-	bar2.Address = bar2addr;
-	bar2.Length = uioBarSizes[2];
 
 	brd_valid = true;
 
@@ -311,23 +253,64 @@ PCIeMini_status AlphiBoard::Close()
 
 	brd_valid = false;
 
-	// unmap the bars
-	munmap(bar0.Address, 0x4000);
-	bar0.Address = NULL;
-	close(resfd0);
-	resfd0 = -1;
+	// the interrupt thread uses the CRA and the UIO descriptors
+	stopIntThread();
 
-	munmap(bar2.Address, 0x1000);
-	bar2.Address = NULL;
-	close(resfd2);
-	resfd2 = -1;
+	unmapBars();
+	backend->close();
 
-	close(configfd);
-	close(uiofd);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Unmap all the BARs with the length they were mapped with */
+void AlphiBoard::unmapBars(void)
+{
+	for (int i = 0; i < BoardBackend::nbrOfBars; i++) {
+		if (bars[i].Address != NULL)
+			backend->unmapBar(i, bars[i].Address, bars[i].Length);
+		bars[i].Address = NULL;
+		bars[i].Length = 0;
+		bars[i].WriteCombined = false;
+	}
+}
 
+/** @brief Request a write-combined mapping for a BAR
+ *
+ * Write combining lets the processor merge consecutive stores into PCIe bursts, which is
+ * needed to reach a usable bandwidth when filling memory regions like a dual-ported RAM or the
+ * MDDR buffers. It must only be used on BARs that contain memory and no registers, since the
+ * stores can be delayed and merged: see flushWriteCombined(). When the system cannot provide
+ * it (BAR not prefetchable) the BAR is mapped uncached; bars[n].WriteCombined tells which.
+ * @param barNbr BAR number, 0 to 7.
+ * @param enable True to map the BAR write-combined.
+ * @retval ERRCODE_BUSY if the board is open, the setting is applied by Open().
+ */
+PCIeMini_status AlphiBoard::setBarWriteCombined(int barNbr, bool enable)
+{
+	if (barNbr < 0 || barNbr >= BoardBackend::nbrOfBars)
+		return ERRCODE_INVALID_VALUE;
+	if (brd_valid)
+		return ERRCODE_BUSY;
+	if (enable)
+		wcBarMask |= 1 << barNbr;
+	else
+		wcBarMask &= ~(1 << barNbr);
 	return ERRCODE_NO_ERROR;
 }
 
+/** @brief Return a pointer to an object in a BAR
+ *
+ * @param barNbr BAR number, 0 to 7.
+ * @param offset Offset in the BAR
+ * @retval Pointer to the object, NULL if the BAR is not mapped or the offset is out of range
+ */
+volatile void* AlphiBoard::getBarAddress(int barNbr, size_t offset)
+{
+	if (barNbr < 0 || barNbr >= BoardBackend::nbrOfBars || offset >= bars[barNbr].Length) return NULL;
+
+	return (void*)((char*)bars[barNbr].Address + offset);
+}
+
 /** @brief Return a pointer to an object in BAR 0
  *
  * @param offset Offset in BAR0
@@ -44,6 +44,10 @@
 #include <errno.h>
 #include <pthread.h>
 #include <string.h>
+#include <poll.h>
+#include <sched.h>
+#include <alloca.h>
+#include <sys/eventfd.h>
 
 /* -----------------------------------------------
 Interrupts
@@ -51,7 +55,9 @@ Interrupts
 //! Setup the interrupt of the board
 /*!
 Specify and interrupt service routine and enable the interrupts.
-	@param mask board dependent interrupt mask.
+The routine is called once per interrupt when one of the CRA status bits in the mask is set
+and no dedicated handler has been hooked on that bit with hookIrqHandler() or hookMailboxHandler().
+	@param mask board dependent interrupt mask, in the CRA interrupt status register format.
 	@param uicr pointer to the interrupt service routine.
 	@param userData Value sent to the interrupt service routine as parameter.
 	@return WD_STATUS_SUCCESS when the operation succeeded
@@ -63,9 +69,13 @@ PCIeMini_status AlphiBoard::hookInterruptServiceRoutine(uint32_t mask, MINIPCIE_
 {
 
 	/* Store the diag interrupt handler routine, which will be executed by
-	MINIPCIE_IntHandler() when an interrupt is received */
-	funcDiagIntHandler = uicr;
+	the interrupt thread when an interrupt is received */
+	__atomic_store_n(&funcDiagIntHandler, (MINIPCIE_INT_HANDLER)NULL, __ATOMIC_RELEASE);
 	intHandlerUserData = userData;
+	intHandlerMask = mask;
+	__atomic_store_n(&funcDiagIntHandler, uicr, __ATOMIC_RELEASE);
+	if (uicr != NULL && cra != NULL)
+		cra->unmaskUnclaimedSources(mask);
 
 	return ERRCODE_SUCCESS;
 }
@@ -79,7 +89,7 @@ PCIeMini_status AlphiBoard::hookInterruptServiceRoutine(MINIPCIE_INT_HANDLER uic
 {
 	PCIeMini_status status;
 	status = AlphiBoard::hookInterruptServiceRoutine(
-		1, uicr, (void*)this);
+		PcieCra::avlIrqMask | PcieCra::a2pMailboxIrqMask, uicr, (void*)this);
 	return status;
 }
 
@@ -97,6 +107,83 @@ PCIeMini_status AlphiBoard::unhookInterruptServiceRoutine()
 	return hookInterruptServiceRoutine(0, NULL, NULL);
 }
 
+/** @brief Attach a handler to one bit of the CRA interrupt status register
+ *
+ * The user data is written before the handler pointer so that the interrupt thread never
+ * sees a new handler with the previous parameter.
+ * @param bitNbr Bit number in the CRA interrupt status register.
+ * @param handler Handler routine, NULL to detach.
+ * @param userData Value sent to the handler as parameter.
+ * @retval ERRCODE_INVALID_VALUE if the bit number is out of range.
+ */
+PCIeMini_status AlphiBoard::setIrqSourceHandler(int bitNbr, MINIPCIE_INT_HANDLER handler, void* userData)
+{
+	if (bitNbr < 0 || bitNbr >= PcieCra::nbrOfIrqSources)
+		return ERRCODE_INVALID_VALUE;
+
+	IrqSourceHandler* src = &irqSources[bitNbr];
+	__atomic_store_n(&src->handler, (MINIPCIE_INT_HANDLER)NULL, __ATOMIC_RELEASE);
+	src->userData = userData;
+	__atomic_store_n(&src->handler, handler, __ATOMIC_RELEASE);
+	if (handler != NULL && cra != NULL)
+		cra->unmaskUnclaimedSources(1 << bitNbr);
+
+	return ERRCODE_SUCCESS;
+}
+
+/** @brief Attach a handler to an Avalon interrupt line
+ *
+ * The handler is called from the interrupt thread each time the line is found asserted in the
+ * CRA interrupt status register. It takes precedence over the catch-all interrupt service routine.
+ * @param irqNbr Avalon interrupt line, 0 to 15 (board dependent.)
+ * @param handler Handler routine.
+ * @param userData Value sent to the handler as parameter.
+ * @retval ERRCODE_INVALID_VALUE if the line number is out of range.
+ */
+PCIeMini_status AlphiBoard::hookIrqHandler(int irqNbr, MINIPCIE_INT_HANDLER handler, void* userData)
+{
+	if (irqNbr < 0 || irqNbr >= PcieCra::a2pMailboxIrqShift)
+		return ERRCODE_INVALID_VALUE;
+
+	return setIrqSourceHandler(irqNbr, handler, userData);
+}
+
+/** @brief Detach the handler of an Avalon interrupt line
+ *
+ * @param irqNbr Avalon interrupt line, 0 to 15.
+ * @retval ERRCODE_INVALID_VALUE if the line number is out of range.
+ */
+PCIeMini_status AlphiBoard::unhookIrqHandler(int irqNbr)
+{
+	return hookIrqHandler(irqNbr, NULL, NULL);
+}
+
+/** @brief Attach a handler to an A2P mailbox interrupt
+ *
+ * The mailbox interrupt is acknowledged by the interrupt thread before the handler is called.
+ * @param mailboxNbr Mailbox number, 0 to 7.
+ * @param handler Handler routine.
+ * @param userData Value sent to the handler as parameter.
+ * @retval ERRCODE_INVALID_VALUE if the mailbox number is out of range.
+ */
+PCIeMini_status AlphiBoard::hookMailboxHandler(int mailboxNbr, MINIPCIE_INT_HANDLER handler, void* userData)
+{
+	if (mailboxNbr < 0 || mailboxNbr >= PcieCra::nbrOfIrqSources - PcieCra::a2pMailboxIrqShift)
+		return ERRCODE_INVALID_VALUE;
+
+	return setIrqSourceHandler(mailboxNbr + PcieCra::a2pMailboxIrqShift, handler, userData);
+}
+
+/** @brief Detach the handler of an A2P mailbox interrupt
+ *
+ * @param mailboxNbr Mailbox number, 0 to 7.
+ * @retval ERRCODE_INVALID_VALUE if the mailbox number is out of range.
+ */
+PCIeMini_status AlphiBoard::unhookMailboxHandler(int mailboxNbr)
+{
+	return hookMailboxHandler(mailboxNbr, NULL, NULL);
+}
+
 /** @brief Enable PCIe interrupts
  *
  * Enable the generation of PCIe interrupts by the board's PCIe interface. Enable the reception of PCIe
@@ -136,67 +223,678 @@ static void* intThreadEx(void *arg)
 	return NULL;
 }
 
-void* AlphiBoard::intThreadLoop(void)
+/** @brief Call the handlers of a set of pending sources
+ *
+ * Sources with a dedicated handler are served first, in bit order. The catch-all routine is
+ * then called once if any pending bit of its mask was not claimed. The Avalon lines that no
+ * routine serves are masked in the CRA and counted, otherwise the level interrupt would wake up
+ * the thread again at each re-arm; attaching a handler enables them again.
+ * @param pending Bit map of the sources to serve, in the CRA interrupt status register format.
+ */
+void AlphiBoard::callIrqHandlers(uint32_t pending)
+{
+	uint32_t unclaimed = 0;
+
+	// the mailbox bits are latched, acknowledge them before the handlers read the mailboxes
+	if (pending & PcieCra::a2pMailboxIrqMask)
+		cra->clearMailboxIrq(pending);
+
+	while (pending != 0) {
+		int bitNbr = __builtin_ctz(pending);
+		pending &= pending - 1;
+
+		IrqSourceHandler* src = &irqSources[bitNbr];
+		MINIPCIE_INT_HANDLER handler = __atomic_load_n(&src->handler, __ATOMIC_ACQUIRE);
+		if (handler != NULL)
+			handler(src->userData);
+		else
+			unclaimed |= 1 << bitNbr;
+	}
+
+	MINIPCIE_INT_HANDLER handler = __atomic_load_n(&funcDiagIntHandler, __ATOMIC_ACQUIRE);
+	if (handler != NULL) {
+		if ((unclaimed & intHandlerMask) != 0)
+			handler(intHandlerUserData);
+		unclaimed &= ~intHandlerMask;
+	}
+
+	// the mailboxes have been acknowledged, only the Avalon lines stay asserted
+	unclaimed &= PcieCra::avlIrqMask;
+	if (unclaimed != 0) {
+		uint32_t masked = cra->maskUnclaimedSources(unclaimed);
+		for (uint32_t m = masked; m != 0; m &= m - 1)
+			cra->countUnclaimed(__builtin_ctz(m));
+
+		// a handler attached meanwhile has not seen the mask, enable its source again
+		uint32_t claimed = 0;
+		for (uint32_t m = masked; m != 0; m &= m - 1) {
+			int bitNbr = __builtin_ctz(m);
+			if (__atomic_load_n(&irqSources[bitNbr].handler, __ATOMIC_ACQUIRE) != NULL)
+				claimed |= 1 << bitNbr;
+		}
+		if (__atomic_load_n(&funcDiagIntHandler, __ATOMIC_ACQUIRE) != NULL)
+			claimed |= masked & intHandlerMask;
+		if (claimed != 0)
+			cra->unmaskUnclaimedSources(claimed);
+	}
+}
+
+/** @brief Update the moderation state of sources that just interrupted
+ *
+ * A source is masked for its window once it reached its threshold of interrupts within a window.
+ * @param pending Bit map of the moderated sources served by the last interrupt.
+ */
+void AlphiBoard::moderateIrqSources(uint32_t pending)
+{
+	uint64_t now = LatencyHistogram::getTimeNs();
+	uint32_t toMask = 0;
+
+	while (pending != 0) {
+		int bitNbr = __builtin_ctz(pending);
+		pending &= pending - 1;
+
+		IrqModerationState* st = &irqModeration[bitNbr];
+		uint64_t window = (uint64_t)cra->getIrqModerationWindow(bitNbr) * 1000;
+		cra->countInterrupt(bitNbr);
+		if (now - st->windowStart > window) {
+			st->windowStart = now;
+			st->count = 0;
+		}
+		if (++st->count >= cra->getIrqModerationThreshold(bitNbr)) {
+			st->deadline = now + window;
+			cra->countWindow(bitNbr);
+			toMask |= 1 << bitNbr;
+		}
+	}
+	if (toMask != 0)
+		cra->maskModeratedSources(toMask);
+}
+
+/** @brief Serve the masked sources whose moderation window has ended
+ *
+ * Sources still asserted are served without interrupt and stay masked for another window,
+ * the other ones are unmasked.
+ * @retval Time until the next window ends in ns, -1 if no source is masked.
+ */
+int64_t AlphiBoard::serviceModeratedIrq(void)
+{
+	uint32_t masked = cra->getModeratedMask();
+	if (masked == 0)
+		return -1;
+
+	uint64_t now = LatencyHistogram::getTimeNs();
+	uint32_t expired = 0;
+	for (uint32_t m = masked; m != 0; m &= m - 1) {
+		int bitNbr = __builtin_ctz(m);
+		if (irqModeration[bitNbr].deadline <= now)
+			expired |= 1 << bitNbr;
+	}
+
+	if (expired != 0) {
+		uint32_t busy = cra->getIrqStatus() & expired;
+		if (busy != 0) {
+			callIrqHandlers(busy);
+			now = LatencyHistogram::getTimeNs();
+			for (uint32_t m = busy; m != 0; m &= m - 1) {
+				int bitNbr = __builtin_ctz(m);
+				cra->countCoalesced(bitNbr);
+				irqModeration[bitNbr].deadline = now + (uint64_t)cra->getIrqModerationWindow(bitNbr) * 1000;
+			}
+		}
+		if (expired & ~busy)
+			cra->unmaskModeratedSources(expired & ~busy);
+		masked = cra->getModeratedMask();
+	}
+
+	int64_t next = -1;
+	for (uint32_t m = masked; m != 0; m &= m - 1) {
+		int64_t remaining = (int64_t)(irqModeration[__builtin_ctz(m)].deadline - now);
+		if (remaining < 0)
+			remaining = 0;
+		if (next < 0 || remaining < next)
+			next = remaining;
+	}
+	return next;
+}
+
+/** @brief Count the events of the sources with hybrid polling enabled
+ * @param pending Bit map of the sources just served.
+ */
+void AlphiBoard::countHybridEvents(uint32_t pending)
+{
+	for (; pending != 0; pending &= pending - 1)
+		__atomic_add_fetch(&hybridSources[__builtin_ctz(pending)].count, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Poll the sources in poll mode and switch the sources between interrupt and poll mode
+ *
+ * The event rate of each source is evaluated at the end of each rate window. A source in interrupt
+ * mode switches to poll mode when its rate reaches enterRate; a polled source returns to interrupt
+ * mode when its rate falls to exitRate or below.
+ * @retval Time until the next poll in ns, -1 if no source is polled.
+ */
+int64_t AlphiBoard::serviceHybridPolling(void)
+{
+	uint32_t enabled = __atomic_load_n(&hybridEnabled, __ATOMIC_ACQUIRE);
+	uint32_t polled = cra->getPolledMask();
+	if (enabled == 0 && polled == 0)
+		return -1;
+
+	if (polled != 0) {
+		uint32_t craPolled = 0;
+		uint32_t pending = 0;
+		for (uint32_t m = polled; m != 0; m &= m - 1) {
+			int bitNbr = __builtin_ctz(m);
+			HybridSource* src = &hybridSources[bitNbr];
+			ParallelInput* pio = __atomic_load_n(&src->pio, __ATOMIC_ACQUIRE);
+			if (pio == NULL)
+				craPolled |= 1 << bitNbr;
+			else if (pio->getIrqStatus() & src->pioMask)
+				pending |= 1 << bitNbr;
+		}
+		if (craPolled != 0)
+			pending |= cra->getIrqStatus() & craPolled;
+		if (pending != 0) {
+			callIrqHandlers(pending);
+			countHybridEvents(pending);
+		}
+	}
+
+	uint64_t now = LatencyHistogram::getTimeNs();
+	if (hybridWindowStart == 0)
+		hybridWindowStart = now;
+	uint64_t elapsed = now - hybridWindowStart;
+	if (elapsed >= (uint64_t)hybridRateWindowUs * 1000) {
+		uint32_t enter = 0;
+		// a source disabled while this thread switched it to polling is given back to the interrupts
+		uint32_t exit = polled & ~enabled;
+		for (uint32_t m = enabled; m != 0; m &= m - 1) {
+			int bitNbr = __builtin_ctz(m);
+			HybridSource* src = &hybridSources[bitNbr];
+			uint32_t count = __atomic_exchange_n(&src->count, 0, __ATOMIC_RELAXED);
+			uint64_t rate = (uint64_t)count * 1000000000ull / elapsed;
+			if ((polled & (1 << bitNbr)) == 0 && rate >= __atomic_load_n(&src->enterRate, __ATOMIC_RELAXED))
+				enter |= 1 << bitNbr;
+			else if ((polled & (1 << bitNbr)) != 0 && rate <= __atomic_load_n(&src->exitRate, __ATOMIC_RELAXED))
+				exit |= 1 << bitNbr;
+		}
+		for (uint32_t m = enter | exit; m != 0; m &= m - 1)
+			__atomic_add_fetch(&hybridSources[__builtin_ctz(m)].switches, 1, __ATOMIC_RELAXED);
+		if (enter != 0)
+			cra->addPolledSources(enter);
+		if (exit != 0)
+			cra->removePolledSources(exit);
+		if (verbose && (enter | exit) != 0)
+			printf("Hybrid polling: polled sources 0x%06x\n", cra->getPolledMask());
+		hybridWindowStart = now;
+		polled = cra->getPolledMask();
+	}
+
+	if (polled == 0)
+		return -1;
+	return (int64_t)hybridPollIntervalUs * 1000;
+}
+
+/** @brief Enable the adaptive switching between interrupts and polling for a source
+ *
+ * The rates must satisfy exitRate < enterRate, the gap is the hysteresis. The source is left out of
+ * the rate evaluation while its parameters change, so it can be configured with the interrupt thread running.
+ * @param bitNbr Bit number of the source in the CRA interrupt status register.
+ * @param enterRate Events per second at which the source is served by polling, 0 to disable hybrid polling.
+ * @param exitRate Events per second at which the source is served by interrupts again.
+ * @retval ERRCODE_INVALID_VALUE if the bit number is out of range or the rates are inconsistent.
+ */
+PCIeMini_status AlphiBoard::setHybridPolling(int bitNbr, uint32_t enterRate, uint32_t exitRate)
+{
+	if (bitNbr < 0 || bitNbr >= PcieCra::nbrOfIrqSources)
+		return ERRCODE_INVALID_VALUE;
+	if (enterRate != 0 && exitRate >= enterRate)
+		return ERRCODE_INVALID_VALUE;
+
+	HybridSource* src = &hybridSources[bitNbr];
+	__atomic_and_fetch(&hybridEnabled, ~(1u << bitNbr), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&src->enterRate, enterRate, __ATOMIC_RELAXED);
+	__atomic_store_n(&src->exitRate, exitRate, __ATOMIC_RELAXED);
+	__atomic_store_n(&src->count, 0, __ATOMIC_RELAXED);
+	if (enterRate != 0)
+		__atomic_or_fetch(&hybridEnabled, 1u << bitNbr, __ATOMIC_RELEASE);
+	else if (cra != NULL)
+		cra->removePolledSources(1 << bitNbr);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Poll a parallel input status register instead of the CRA status for a source
+ *
+ * Useful when the interrupt line of the CRA is shared by several events of a parallel input.
+ * @param bitNbr Bit number of the source in the CRA interrupt status register.
+ * @param pio Parallel input whose interrupt status is polled, NULL to poll the CRA status.
+ * @param pioMask Bits of the parallel input interrupt status belonging to the source.
+ * @retval ERRCODE_INVALID_VALUE if the bit number is out of range.
+ */
+PCIeMini_status AlphiBoard::setHybridPollStatus(int bitNbr, ParallelInput* pio, uint32_t pioMask)
+{
+	if (bitNbr < 0 || bitNbr >= PcieCra::nbrOfIrqSources)
+		return ERRCODE_INVALID_VALUE;
+
+	// the interrupt thread reads the mask after the register, publish the register last
+	__atomic_store_n(&hybridSources[bitNbr].pio, (ParallelInput*)NULL, __ATOMIC_RELEASE);
+	hybridSources[bitNbr].pioMask = pioMask;
+	__atomic_store_n(&hybridSources[bitNbr].pio, pio, __ATOMIC_RELEASE);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Set the timing of the hybrid polling engine
+ * @param rateWindowUs Period over which the event rates are evaluated, in microseconds (default 10 ms.)
+ * @param pollIntervalUs Delay between two polls in poll mode, 0 to busy-poll (default.)
+ */
+void AlphiBoard::setHybridPollParameters(uint32_t rateWindowUs, uint32_t pollIntervalUs)
+{
+	hybridRateWindowUs = rateWindowUs ? rateWindowUs : 1;
+	hybridPollIntervalUs = pollIntervalUs;
+}
+
+/** @brief Return how a source is currently served
+ * @param bitNbr Bit number of the source in the CRA interrupt status register.
+ */
+AlphiBoard::IrqSourceMode AlphiBoard::getIrqSourceMode(int bitNbr)
+{
+	if (bitNbr < 0 || bitNbr >= PcieCra::nbrOfIrqSources || cra == NULL)
+		return IRQ_MODE_INTERRUPT;
+	return (cra->getPolledMask() & (1 << bitNbr)) ? IRQ_MODE_POLL : IRQ_MODE_INTERRUPT;
+}
+
+/** @brief Return the number of times a source changed between interrupt and poll mode
+ * @param bitNbr Bit number of the source in the CRA interrupt status register.
+ */
+uint64_t AlphiBoard::getIrqModeSwitches(int bitNbr)
+{
+	if (bitNbr < 0 || bitNbr >= PcieCra::nbrOfIrqSources)
+		return 0;
+	return __atomic_load_n(&hybridSources[bitNbr].switches, __ATOMIC_RELAXED);
+}
+
+/** @brief Read the CRA interrupt status once and call the handlers of the pending sources
+ *
+ * @param wakeTime Time stamp taken when the UIO read() returned, 0 when the latency is not measured.
+ */
+void AlphiBoard::dispatchInterrupt(uint64_t wakeTime)
 {
+	uint32_t status = cra->getIrqStatus();
+	// sources masked by the moderation are served at the end of their window
+	uint32_t pending = status & cra->getActiveIrqMask() & (PcieCra::avlIrqMask | PcieCra::a2pMailboxIrqMask);
+	uint64_t dispatchTime = 0;
 
-	int i;
+	if (wakeTime != 0)
+		dispatchTime = LatencyHistogram::getTimeNs();
+
+	callIrqHandlers(pending);
+
+	uint32_t moderated = pending & cra->getModerationEnabledMask();
+	if (moderated != 0)
+		moderateIrqSources(moderated);
+	uint32_t hybrid = pending & __atomic_load_n(&hybridEnabled, __ATOMIC_ACQUIRE);
+	if (hybrid != 0)
+		countHybridEvents(hybrid);
+
+	if (wakeTime != 0) {
+		uint64_t exitTime = LatencyHistogram::getTimeNs();
+		irqLatency.wakeToDispatch.record(dispatchTime - wakeTime);
+		irqLatency.handlerTime.record(exitTime - dispatchTime);
+		irqLatency.wakeToExit.record(exitTime - wakeTime);
+	}
+}
+
+/** @brief Copy the interrupt latency statistics
+ *
+ * The copy can be taken while the interrupt thread is running.
+ * @param dest Destination of the copy.
+ */
+void AlphiBoard::getIrqLatencySnapshot(IrqLatencyStats* dest)
+{
+	irqLatency.wakeToDispatch.snapshot(&dest->wakeToDispatch);
+	irqLatency.handlerTime.snapshot(&dest->handlerTime);
+	irqLatency.wakeToExit.snapshot(&dest->wakeToExit);
+	irqLatency.threadWake.snapshot(&dest->threadWake);
+}
+
+/** @brief Clear the interrupt latency statistics */
+void AlphiBoard::resetIrqLatency()
+{
+	irqLatency.wakeToDispatch.reset();
+	irqLatency.handlerTime.reset();
+	irqLatency.wakeToExit.reset();
+	irqLatency.threadWake.reset();
+}
+
+/** @brief Print a summary of the interrupt latency statistics on the console */
+void AlphiBoard::printIrqLatency()
+{
+	IrqLatencyStats* snap = new IrqLatencyStats;
+
+	getIrqLatencySnapshot(snap);
+	printf("Interrupt re-arm mode: %s\n", getIrqRearmModeName());
+	snap->wakeToDispatch.print("wake to dispatch");
+	snap->handlerTime.print("handler time");
+	snap->wakeToExit.print("wake to exit");
+	if (snap->threadWake.getCount() != 0)
+		snap->threadWake.print("thread wake");
+	delete snap;
+}
+
+void* AlphiBoard::intThreadLoop(void)
+{
 	int err;
-	unsigned icount;
-	unsigned char command_high;
+	uint32_t icount;
+	uint64_t wakeCount;
+	uint64_t wakeTime;
+	struct pollfd fds[2];
 
+	prefaultIrqThreadStack();
 
-	/* Read and cache command value */
-	err = pread(configfd, &command_high, 1, 5);
-	if (err != 1) {
-		perror("command config read:");
+	/* Choose how to re-enable the interrupts, this also enables them. */
+	if (backend->startIrq(irqRearmRequest) != ERRCODE_NO_ERROR)
 		return NULL;
-	}
-	command_high &= ~0x4;
+	if (verbose)
+		printf("Interrupt re-arm mode: %s\n", getIrqRearmModeName());
 
-	for(i = 0;; ++i) {
+	fds[0].fd = backend->getIrqFd();
+	fds[0].events = POLLIN;
+	fds[1].fd = irqWakeFd;
+	fds[1].events = POLLIN;
 
-		/****************************************/
-		/* Here we got an interrupt from the
-		   device. Do something about it. */
-		/****************************************/
+	memset(irqModeration, 0, sizeof(irqModeration));
+	hybridWindowStart = 0;
 
-		/* Re-enable interrupts. */
-		err = pwrite(configfd, &command_high, 1, 5);
-		if (err != 1) {
-			perror("config write:");
+	while (!irqThreadStop) {
+		/* Sleep until the device interrupts, a moderation window ends or the thread is asked to stop. */
+		int64_t nextWindow = serviceModeratedIrq();
+		int64_t nextPoll = serviceHybridPolling();
+		if (nextPoll >= 0 && (nextWindow < 0 || nextPoll < nextWindow))
+			nextWindow = nextPoll;
+		struct timespec timeout;
+		timeout.tv_sec = nextWindow / 1000000000;
+		timeout.tv_nsec = nextWindow % 1000000000;
+		err = ppoll(fds, 2, (nextWindow < 0) ? NULL : &timeout, NULL);
+		if (err < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("uio poll:");
 			break;
 		}
 
-		while (funcDiagIntHandler == NULL) Sleep(10);
-		/* Wait for next interrupt. */
-		err = read(uiofd, &icount, 4);
-		if (err != 4) {
-			perror("uio read:");
-			err = read(uiofd, &icount, 4);
+		if (fds[1].revents & POLLIN) {
+			uint64_t probeTime = __atomic_load_n(&wakeProbeTime, __ATOMIC_ACQUIRE);
+			if (probeTime != 0) {
+				irqLatency.threadWake.record(LatencyHistogram::getTimeNs() - probeTime);
+				__atomic_store_n(&wakeProbeTime, 0, __ATOMIC_RELEASE);
+			}
+			err = read(irqWakeFd, &wakeCount, sizeof(wakeCount));
+			continue;
+		}
+
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			fprintf(stderr, "uio poll: device error\n");
 			break;
 		}
 
-		//clear_ints(p_uio_board->bar2); //
-		funcDiagIntHandler(intHandlerUserData);
+		if ((fds[0].revents & POLLIN) == 0)
+			continue;
 
+		if (backend->readIrqCount(&icount) != ERRCODE_NO_ERROR)
+			break;
+		wakeTime = irqLatencyEnabled ? LatencyHistogram::getTimeNs() : 0;
+
+		/****************************************/
+		/* Here we got an interrupt from the
+		   device. Do something about it. */
+		/****************************************/
+		dispatchInterrupt(wakeTime);
+
+		/* Re-enable interrupts. */
+		if (backend->rearmIrq() != ERRCODE_NO_ERROR)
+			break;
 	}
 	return 0;
 }
 
+/** @brief Select the interrupt re-arm method
+ *
+ * The request is used the next time the interrupt thread starts, when the board is opened.
+ * If the method is not supported by the driver, the next one in the automatic order is used.
+ * @param mode IRQ_REARM_AUTO (default), IRQ_REARM_MSI, IRQ_REARM_UIO or IRQ_REARM_CONFIG.
+ */
+void AlphiBoard::setIrqRearmMode(IrqRearmMode mode)
+{
+	irqRearmRequest = mode;
+}
+
+/** @brief Return the name of the active interrupt re-arm method */
+const char* AlphiBoard::getIrqRearmModeName(void)
+{
+	switch (getIrqRearmMode()) {
+	case IRQ_REARM_MSI:
+		return "MSI";
+	case IRQ_REARM_UIO:
+		return "UIO irqcontrol";
+	case IRQ_REARM_CONFIG:
+		return "PCI config INTx";
+	case IRQ_REARM_SIMULATED:
+		return "simulated";
+	default:
+		return "not active";
+	}
+}
+
 int AlphiBoard::startIntThread()
 {
-	int err;
+	int err = -1;
 
 	if (brd_valid) {
 
-		err = pthread_create(&irqThread, NULL, &intThreadEx, (void*)this);
-		if (err != 0)
+		irqWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (irqWakeFd < 0) {
+			perror("eventfd:");
+			return errno;
+		}
+		irqThreadStop = false;
+
+		if (irqThreadConfig.lockMemory) {
+			if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+				perror("mlockall:");
+		}
+
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (irqThreadConfig.stackSize != 0) {
+			err = pthread_attr_setstacksize(&attr, irqThreadConfig.stackSize);
+			if (err != 0)
+				printf("\ncan't set the interrupt thread stack size :[%s]", strerror(err));
+		}
+
+		err = pthread_create(&irqThread, &attr, &intThreadEx, (void*)this);
+		pthread_attr_destroy(&attr);
+		if (err != 0) {
 			printf("\ncan't create thread :[%s]", strerror(err));
-		else
+			close(irqWakeFd);
+			irqWakeFd = -1;
+		}
+		else {
+			irqThreadRunning = true;
 			printf("\n Interrupt Thread created successfully\n");
+			if (applyIrqThreadSched(irqThread) != ERRCODE_NO_ERROR)
+				printf("Interrupt thread running with the default scheduling\n");
+		}
 
 	} else
 		printf("No valid board object\n");
 
 	return err;
 }
+
+/** @brief Apply the scheduling policy, priority and CPU affinity to the interrupt thread
+ *
+ * The default policy is only set to bring back a thread that runs with a real-time policy,
+ * and a null CPU mask leaves the affinity inherited from the process untouched.
+ *
+ * @param thread Interrupt thread.
+ * @retval ERRCODE_PERMISSION_DENIED if the process is not allowed to use a real-time policy (CAP_SYS_NICE.)
+ * @retval ERRCODE_INVALID_VALUE if the kernel rejected the settings.
+ */
+PCIeMini_status AlphiBoard::applyIrqThreadSched(pthread_t thread)
+{
+	struct sched_param param;
+	int policy;
+	int err;
+
+	memset(&param, 0, sizeof(param));
+	if (pthread_getschedparam(thread, &policy, &param) != 0)
+		policy = -1;
+	if ((irqThreadConfig.schedPolicy != SCHED_OTHER) || (policy != SCHED_OTHER)) {
+		memset(&param, 0, sizeof(param));
+		if (irqThreadConfig.schedPolicy != SCHED_OTHER)
+			param.sched_priority = irqThreadConfig.priority;
+		err = pthread_setschedparam(thread, irqThreadConfig.schedPolicy, &param);
+		if (err != 0) {
+			printf("can't set the interrupt thread scheduling :[%s]\n", strerror(err));
+			return (err == EPERM) ? ERRCODE_PERMISSION_DENIED : ERRCODE_INVALID_VALUE;
+		}
+	}
+
+	if (irqThreadConfig.cpuMask != 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (int cpu = 0; cpu < 64; cpu++)
+			if (irqThreadConfig.cpuMask & (1ull << cpu))
+				CPU_SET(cpu, &cpus);
+		err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+		if (err != 0) {
+			printf("can't set the interrupt thread affinity :[%s]\n", strerror(err));
+			return (err == EPERM) ? ERRCODE_PERMISSION_DENIED : ERRCODE_INVALID_VALUE;
+		}
+	}
+
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Touch the part of the stack used by the interrupt thread
+ *
+ * Called by the interrupt thread when it starts, so that the handlers do not take page faults.
+ * With lockMemory set, the pages then stay resident.
+ */
+void AlphiBoard::prefaultIrqThreadStack(void)
+{
+	size_t size = irqThreadConfig.prefaultSize;
+	size_t pageSize = getpagesize();
+
+	if (size == 0)
+		return;
+
+	volatile uint8_t* stack = (volatile uint8_t*)alloca(size);
+	for (size_t i = 0; i < size; i += pageSize)
+		stack[i] = 0;
+	stack[size - 1] = 0;
+}
+
+/** @brief Set the scheduling options of the interrupt thread
+ *
+ * Call before Open() for the stack size, the stack prefault and the memory lock to be
+ * taken into account. The policy, priority and CPU affinity are also applied immediately
+ * if the board is already open.
+ * @param config Options, see IrqThreadConfig.
+ * @retval ERRCODE_INVALID_VALUE if an option is out of range.
+ * @retval ERRCODE_PERMISSION_DENIED if the process is not allowed to use a real-time policy.
+ */
+PCIeMini_status AlphiBoard::setIrqThreadConfig(const IrqThreadConfig* config)
+{
+	switch (config->schedPolicy) {
+	case SCHED_OTHER:
+		break;
+	case SCHED_FIFO:
+	case SCHED_RR:
+		if (config->priority < sched_get_priority_min(config->schedPolicy) ||
+				config->priority > sched_get_priority_max(config->schedPolicy))
+			return ERRCODE_INVALID_VALUE;
+		break;
+	default:
+		return ERRCODE_INVALID_VALUE;
+	}
+
+	// keep some room on the stack for the thread itself
+	size_t stackSize = config->stackSize ? config->stackSize : 0x800000;
+	if (config->prefaultSize + 0x10000 > stackSize)
+		return ERRCODE_INVALID_VALUE;
+
+	irqThreadConfig = *config;
+
+	if (irqThreadRunning)
+		return applyIrqThreadSched(irqThread);
+
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return the scheduling options of the interrupt thread
+ * @param config Destination of the options.
+ */
+void AlphiBoard::getIrqThreadConfig(IrqThreadConfig* config)
+{
+	*config = irqThreadConfig;
+}
+
+/** @brief Measure how fast the interrupt thread wakes up
+ *
+ * The interrupt thread is woken up through its eventfd with a time stamp, the same way it is
+ * woken up by the UIO driver. The delay until it runs is recorded in the threadWake histogram
+ * of the latency statistics.
+ * @param nbrOfSamples Number of wake ups to measure.
+ * @retval ERRCODE_INVALID_HANDLE if the interrupt thread is not running.
+ * @retval ERRCODE_TIMEOUT if the thread did not wake up within a second.
+ */
+PCIeMini_status AlphiBoard::measureIrqThreadWakeLatency(int nbrOfSamples)
+{
+	uint64_t one = 1;
+
+	if (!irqThreadRunning)
+		return ERRCODE_INVALID_HANDLE;
+
+	for (int i = 0; i < nbrOfSamples; i++) {
+		__atomic_store_n(&wakeProbeTime, LatencyHistogram::getTimeNs(), __ATOMIC_RELEASE);
+		if (write(irqWakeFd, &one, sizeof(one)) != sizeof(one)) {
+			__atomic_store_n(&wakeProbeTime, 0, __ATOMIC_RELEASE);
+			return ERRCODE_INTERNAL_ERROR;
+		}
+
+		int timeout = 10000;
+		while (__atomic_load_n(&wakeProbeTime, __ATOMIC_ACQUIRE) != 0 && --timeout > 0)
+			usleep(100);
+		if (timeout == 0) {
+			__atomic_store_n(&wakeProbeTime, 0, __ATOMIC_RELEASE);
+			return ERRCODE_TIMEOUT;
+		}
+
+		// let the thread go back to sleep in poll()
+		usleep(1000);
+	}
+
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Stop the interrupt thread and wait for its termination
+ *
+ * Must not be called from an interrupt handler.
+ */
+void AlphiBoard::stopIntThread()
+{
+	uint64_t one = 1;
+
+	if (!irqThreadRunning)
+		return;
+
+	irqThreadStop = true;
+	if (write(irqWakeFd, &one, sizeof(one)) != sizeof(one))
+		perror("eventfd write:");
+	pthread_join(irqThread, NULL);
+	irqThreadRunning = false;
+
+	close(irqWakeFd);
+	irqWakeFd = -1;
+}
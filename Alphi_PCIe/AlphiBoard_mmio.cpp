@@ -0,0 +1,235 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file AlphiBoard_mmio.cpp
+* @brief Block transfers to and from the memory mapped in the BARs
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include "AlphiBoard.h"
+#include "stdio.h"
+#include "string.h"
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MMIO_VECTOR 1
+#endif
+
+/* -----------------------------------------------
+Block MMIO
+Each PCIe access costs a TLP. The block functions use the widest naturally aligned accesses
+the processor offers: single bytes, 16, 32 and 64 bit words to reach the alignment, then 128
+bit (SSE2) or 256 bit (AVX, when the processor supports it) accesses for the body of the block.
+----------------------------------------------- */
+
+/** @brief Copy with scalar accesses until the destination is aligned on align bytes
+ *
+ * Each access uses the widest size allowed by the alignment of the destination and the
+ * remaining length. With align = 0 the whole block is copied.
+ */
+static inline void writeScalar(volatile uint8_t*& d, const uint8_t*& s, size_t& len, uintptr_t align)
+{
+	while (len > 0 && (align == 0 || ((uintptr_t)d & (align - 1)) != 0)) {
+		uintptr_t a = (uintptr_t)d;
+		if ((a & 7) == 0 && len >= 8) {
+			uint64_t v;
+			memcpy(&v, s, 8);
+			*(volatile uint64_t*)d = v;
+			d += 8; s += 8; len -= 8;
+		}
+		else if ((a & 3) == 0 && len >= 4) {
+			uint32_t v;
+			memcpy(&v, s, 4);
+			*(volatile uint32_t*)d = v;
+			d += 4; s += 4; len -= 4;
+		}
+		else if ((a & 1) == 0 && len >= 2) {
+			uint16_t v;
+			memcpy(&v, s, 2);
+			*(volatile uint16_t*)d = v;
+			d += 2; s += 2; len -= 2;
+		}
+		else {
+			*d++ = *s++;
+			len--;
+		}
+	}
+}
+
+/** @brief Read with scalar accesses until the source is aligned on align bytes, see writeScalar() */
+static inline void readScalar(uint8_t*& d, const volatile uint8_t*& s, size_t& len, uintptr_t align)
+{
+	while (len > 0 && (align == 0 || ((uintptr_t)s & (align - 1)) != 0)) {
+		uintptr_t a = (uintptr_t)s;
+		if ((a & 7) == 0 && len >= 8) {
+			uint64_t v = *(const volatile uint64_t*)s;
+			memcpy(d, &v, 8);
+			d += 8; s += 8; len -= 8;
+		}
+		else if ((a & 3) == 0 && len >= 4) {
+			uint32_t v = *(const volatile uint32_t*)s;
+			memcpy(d, &v, 4);
+			d += 4; s += 4; len -= 4;
+		}
+		else if ((a & 1) == 0 && len >= 2) {
+			uint16_t v = *(const volatile uint16_t*)s;
+			memcpy(d, &v, 2);
+			d += 2; s += 2; len -= 2;
+		}
+		else {
+			*d++ = *s++;
+			len--;
+		}
+	}
+}
+
+#ifdef MMIO_VECTOR
+/** @brief Return true if the processor and the OS support the AVX registers */
+static bool hasAvx(void)
+{
+	static int avx = -1;
+	if (avx < 0)
+		avx = __builtin_cpu_supports("avx") ? 1 : 0;
+	return avx != 0;
+}
+
+__attribute__((target("avx")))
+static void writeAvx(volatile uint8_t*& d, const uint8_t*& s, size_t& len)
+{
+	for (; len >= 32; d += 32, s += 32, len -= 32)
+		_mm256_store_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx")))
+static void readAvx(uint8_t*& d, const volatile uint8_t*& s, size_t& len)
+{
+	for (; len >= 32; d += 32, s += 32, len -= 32)
+		_mm256_storeu_si256((__m256i*)d, _mm256_load_si256((const __m256i*)s));
+	_mm256_zeroupper();
+}
+
+__attribute__((target("avx")))
+static void fillAvx(volatile uint8_t*& d, uint8_t value, size_t& len)
+{
+	__m256i v = _mm256_set1_epi8(value);
+	for (; len >= 32; d += 32, len -= 32)
+		_mm256_store_si256((__m256i*)d, v);
+	_mm256_zeroupper();
+}
+#endif
+
+/** @brief Copy a block from local memory to a BAR
+ *
+ * The stores are fenced at the end: when the function returns, the data is ordered before
+ * any following register write, write-combined mapping or not.
+ * @param dest Destination in a BAR.
+ * @param src Source in local memory.
+ * @param len Length in bytes, any alignment.
+ */
+void AlphiBoard::mmioWrite(volatile void* dest, const void* src, size_t len)
+{
+	volatile uint8_t* d = (volatile uint8_t*)dest;
+	const uint8_t* s = (const uint8_t*)src;
+
+#ifdef MMIO_VECTOR
+	bool avx = hasAvx() && len >= 64;
+	writeScalar(d, s, len, avx ? 32 : 16);
+	if (avx)
+		writeAvx(d, s, len);
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		_mm_store_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+#endif
+	writeScalar(d, s, len, 0);
+	flushWriteCombined();
+}
+
+/** @brief Copy a block from a BAR to local memory
+ *
+ * Each read is a round trip on the PCIe bus: wide reads divide the time by the access size.
+ * @param dest Destination in local memory.
+ * @param src Source in a BAR.
+ * @param len Length in bytes, any alignment.
+ */
+void AlphiBoard::mmioRead(void* dest, const volatile void* src, size_t len)
+{
+	uint8_t* d = (uint8_t*)dest;
+	const volatile uint8_t* s = (const volatile uint8_t*)src;
+
+#ifdef MMIO_VECTOR
+	bool avx = hasAvx() && len >= 64;
+	readScalar(d, s, len, avx ? 32 : 16);
+	if (avx)
+		readAvx(d, s, len);
+	for (; len >= 16; d += 16, s += 16, len -= 16)
+		_mm_storeu_si128((__m128i*)d, _mm_load_si128((const __m128i*)s));
+#endif
+	readScalar(d, s, len, 0);
+}
+
+/** @brief Fill a block of a BAR with a byte value, like memset()
+ * @param dest Destination in a BAR.
+ * @param value Value of each byte.
+ * @param len Length in bytes, any alignment.
+ */
+void AlphiBoard::mmioFill(volatile void* dest, uint8_t value, size_t len)
+{
+	volatile uint8_t* d = (volatile uint8_t*)dest;
+	uint8_t pattern[16];
+	const uint8_t* s;
+
+	memset(pattern, value, sizeof(pattern));
+
+	// head: the pattern is uniform, the source pointer can restart for each access
+	while (len > 0 && ((uintptr_t)d & 15) != 0) {
+		size_t l = 16 - ((uintptr_t)d & 15);
+		if (l > len)
+			l = len;
+		s = pattern;
+		len -= l;
+		writeScalar(d, s, l, 0);
+	}
+#ifdef MMIO_VECTOR
+	if (hasAvx() && len >= 64) {
+		if (((uintptr_t)d & 31) != 0) {
+			_mm_store_si128((__m128i*)d, _mm_set1_epi8(value));
+			d += 16; len -= 16;
+		}
+		fillAvx(d, value, len);
+	}
+	for (__m128i v = _mm_set1_epi8(value); len >= 16; d += 16, len -= 16)
+		_mm_store_si128((__m128i*)d, v);
+#else
+	for (uint64_t v = 0x0101010101010101ull * value; len >= 8; d += 8, len -= 8)
+		*(volatile uint64_t*)d = v;
+#endif
+	s = pattern;
+	writeScalar(d, s, len, 0);
+	flushWriteCombined();
+}
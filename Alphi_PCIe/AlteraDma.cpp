@@ -0,0 +1,580 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file AlteraDma.cpp
+* @brief Avalon DMA controller and the descriptor queue chaining its transfers
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <errno.h>
+#include "AlteraDma.h"
+
+/** @brief Constructor
+ * @param dmaAddress Pointer to the DMA controller in user space.
+ */
+AlteraDma::AlteraDma(volatile void* dmaAddress)
+{
+    pthread_condattr_t attr;
+
+    base = (volatile uint32_t*)dmaAddress;
+    doneSeq = 0;
+    expectedSeq = 0;
+    current = NULL;
+    useIrq = false;
+    doneCallback = NULL;
+    doneHandle = NULL;
+    owned = false;
+    pthread_mutex_init(&ownerLock, NULL);
+    pthread_cond_init(&ownerCond, NULL);
+    pthread_mutex_init(&doneLock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&doneCond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+AlteraDma::~AlteraDma()
+{
+    pthread_cond_destroy(&doneCond);
+    pthread_mutex_destroy(&doneLock);
+    pthread_cond_destroy(&ownerCond);
+    pthread_mutex_destroy(&ownerLock);
+}
+
+/** @brief Take exclusive use of the controller, for users sharing it between threads
+ *
+ * The ownership is not tied to the calling thread: a transfer started by one thread may be
+ * released by the thread that sees its completion.
+ */
+void AlteraDma::acquire()
+{
+    pthread_mutex_lock(&ownerLock);
+    while (owned)
+        pthread_cond_wait(&ownerCond, &ownerLock);
+    owned = true;
+    pthread_mutex_unlock(&ownerLock);
+}
+
+/** @brief Take the controller if nobody owns it
+ * @return True when the controller is now owned by the caller.
+ */
+bool AlteraDma::tryAcquire()
+{
+    bool taken = false;
+
+    pthread_mutex_lock(&ownerLock);
+    if (!owned) {
+        owned = true;
+        taken = true;
+    }
+    pthread_mutex_unlock(&ownerLock);
+    return taken;
+}
+
+/** @brief Give back the controller taken with acquire() or tryAcquire() */
+void AlteraDma::release()
+{
+    pthread_mutex_lock(&ownerLock);
+    owned = false;
+    pthread_cond_signal(&ownerCond);
+    pthread_mutex_unlock(&ownerLock);
+}
+
+/** @brief Launch a memory to memory transfer
+ *
+ * The controller is stopped while the addresses and the length are programmed, then restarted
+ * with the end of transfer on length. The other control bits (word size, RCON, WCON, I_EN) are
+ * left as they are.
+ * @param t Descriptor of the transfer.
+ */
+void AlteraDma::launch_bidir(TransferDesc* t)
+{
+    ControlReg::modify(base, ALTERA_AVALON_DMA_CONTROL_GO_MSK, 0);
+    StatusReg::write(base, 0);
+    RdAddressReg::write(base, t->src_offset);
+    WrAddressReg::write(base, t->dest_offset);
+    LengthReg::write(base, t->tfr_length);
+    ControlReg::modify(base, 0, ALTERA_AVALON_DMA_CONTROL_GO_MSK | ALTERA_AVALON_DMA_CONTROL_LEEN_MSK);
+}
+
+/** @brief Acknowledge the DMA interrupt
+ * @param context Not used.
+ * @param id Not used.
+ */
+void AlteraDma::irq(void* context, uint32_t id)
+{
+    StatusReg::write(base, 0);
+}
+
+/* -----------------------------------------------
+Completion
+A transfer launched with start() ends either in waitDone() in polling mode, or in the interrupt
+handler: the handler acknowledges the controller, wakes up the waiters and calls the callback.
+The latency histograms are written with doneLock held.
+----------------------------------------------- */
+
+/** @brief Select how the end of the transfers started by start() is detected
+ *
+ * In interrupt mode, irqHandler() must be hooked on the interrupt line of the controller.
+ * @param irqMode When true the interrupt of the controller is enabled.
+ */
+void AlteraDma::setIrqMode(bool irqMode)
+{
+    pthread_mutex_lock(&doneLock);
+    useIrq = irqMode;
+    if (irqMode)
+        ControlReg::modify(base, 0, ALTERA_AVALON_DMA_CONTROL_I_EN_MSK);
+    else
+        ControlReg::modify(base, ALTERA_AVALON_DMA_CONTROL_I_EN_MSK, 0);
+    pthread_mutex_unlock(&doneLock);
+}
+
+/** @brief Set the routine called by the interrupt handler at the end of each transfer
+ * @param done Callback, NULL for none. It is called from the interrupt thread.
+ * @param handle First argument of the callback.
+ */
+void AlteraDma::setDoneCallback(DoneCallback* done, void* handle)
+{
+    pthread_mutex_lock(&doneLock);
+    doneCallback = done;
+    doneHandle = handle;
+    pthread_mutex_unlock(&doneLock);
+}
+
+/** @brief Launch a transfer and record its start time
+ * @param t Descriptor of the transfer, it must stay valid until the end of the transfer.
+ */
+void AlteraDma::start(TransferDesc* t)
+{
+    pthread_mutex_lock(&doneLock);
+    current = t;
+    t->status = 0;
+    t->doneNs = 0;
+    t->fPolling = !useIrq;
+    expectedSeq = doneSeq + 1;
+    t->startNs = LatencyHistogram::getTimeNs();
+    launch_bidir(t);
+    pthread_mutex_unlock(&doneLock);
+}
+
+/** @brief End of transfer seen by the interrupt thread */
+void AlteraDma::serviceIrq()
+{
+    uint32_t status = StatusReg::read(base);
+    if ((status & ALTERA_AVALON_DMA_STATUS_DONE_MSK) == 0)
+        return;
+    StatusReg::write(base, 0);
+    uint64_t now = LatencyHistogram::getTimeNs();
+
+    pthread_mutex_lock(&doneLock);
+    TransferDesc* t = current;
+    DoneCallback* done = doneCallback;
+    void* handle = doneHandle;
+    if (t != NULL) {
+        t->status = status;
+        t->doneNs = now;
+        irqLatency.record(now - t->startNs);
+    }
+    current = NULL;
+    doneSeq++;
+    pthread_cond_broadcast(&doneCond);
+    pthread_mutex_unlock(&doneLock);
+
+    if (done != NULL && t != NULL)
+        done(handle, t);
+}
+
+/** @brief Wait for the end of the transfer launched by start()
+ *
+ * In polling mode, the calling thread spins on the DONE bit: lowest latency, one core busy. Otherwise
+ * it sleeps until the interrupt handler signals the end of the transfer.
+ * @param t Descriptor given to start().
+ * @param timeoutUs Maximum waiting time in microseconds.
+ * @param polling When true, poll the controller even in interrupt mode.
+ * @retval ERRCODE_TIMEOUT if the transfer is not completed in time.
+ */
+PCIeMini_status AlteraDma::waitDone(TransferDesc* t, uint32_t timeoutUs, bool polling)
+{
+    uint64_t deadline = t->startNs + (uint64_t)timeoutUs * 1000;
+
+    if (polling || !useIrq) {
+        uint32_t status;
+        while (((status = StatusReg::read(base)) & ALTERA_AVALON_DMA_STATUS_DONE_MSK) == 0) {
+            if (LatencyHistogram::getTimeNs() > deadline)
+                return ERRCODE_TIMEOUT;
+        }
+        StatusReg::write(base, 0);
+        uint64_t now = LatencyHistogram::getTimeNs();
+
+        pthread_mutex_lock(&doneLock);
+        t->status = status;
+        t->doneNs = now;
+        pollLatency.record(now - t->startNs);
+        if (current == t) {
+            current = NULL;
+            doneSeq++;
+            pthread_cond_broadcast(&doneCond);
+        }
+        pthread_mutex_unlock(&doneLock);
+        return ERRCODE_NO_ERROR;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / 1000000000);
+    ts.tv_nsec = (long)(deadline % 1000000000);
+
+    PCIeMini_status result = ERRCODE_NO_ERROR;
+    pthread_mutex_lock(&doneLock);
+    uint32_t expected = expectedSeq;
+    while ((int32_t)(doneSeq - expected) < 0) {
+        if (pthread_cond_timedwait(&doneCond, &doneLock, &ts) != 0 && (int32_t)(doneSeq - expected) < 0) {
+            result = ERRCODE_TIMEOUT;
+            break;
+        }
+    }
+    if (result == ERRCODE_NO_ERROR && t->doneNs != 0)
+        wakeLatency.record(LatencyHistogram::getTimeNs() - t->doneNs);
+    pthread_mutex_unlock(&doneLock);
+    return result;
+}
+
+/** @brief Select the width of the transfers, as the ioctl of the Altera HAL driver
+ *
+ * The length and the addresses of the following transfers must be multiples of the width.
+ * reset() goes back to 32-bit transfers.
+ * @param mode ALT_DMA_SET_MODE_8 to ALT_DMA_SET_MODE_128.
+ * @retval ERRCODE_INVALID_MODE for the other values.
+ */
+PCIeMini_status AlteraDma::setMode(int mode)
+{
+    const uint32_t widthMask = ALTERA_AVALON_DMA_CONTROL_BYTE_MSK | ALTERA_AVALON_DMA_CONTROL_HW_MSK |
+        ALTERA_AVALON_DMA_CONTROL_WORD_MSK | ALTERA_AVALON_DMA_CONTROL_DWORD_MSK | ALTERA_AVALON_DMA_CONTROL_QWORD_MSK;
+    uint32_t width;
+
+    switch (mode) {
+    case ALT_DMA_SET_MODE_8:
+        width = ALTERA_AVALON_DMA_CONTROL_BYTE_MSK;
+        break;
+    case ALT_DMA_SET_MODE_16:
+        width = ALTERA_AVALON_DMA_CONTROL_HW_MSK;
+        break;
+    case ALT_DMA_SET_MODE_32:
+        width = ALTERA_AVALON_DMA_CONTROL_WORD_MSK;
+        break;
+    case ALT_DMA_SET_MODE_64:
+        width = ALTERA_AVALON_DMA_CONTROL_DWORD_MSK;
+        break;
+    case ALT_DMA_SET_MODE_128:
+        width = ALTERA_AVALON_DMA_CONTROL_QWORD_MSK;
+        break;
+    default:
+        return ERRCODE_INVALID_MODE;
+    }
+    ControlReg::modify(base, widthMask, width);
+    return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return the width of the transfers in bytes */
+uint32_t AlteraDma::getModeWidth()
+{
+    uint32_t control = ControlReg::read(base);
+
+    if (control & ALTERA_AVALON_DMA_CONTROL_QWORD_MSK)
+        return 16;
+    if (control & ALTERA_AVALON_DMA_CONTROL_DWORD_MSK)
+        return 8;
+    if (control & ALTERA_AVALON_DMA_CONTROL_WORD_MSK)
+        return 4;
+    if (control & ALTERA_AVALON_DMA_CONTROL_HW_MSK)
+        return 2;
+    return 1;
+}
+
+void AlteraDma::clearStats()
+{
+    pthread_mutex_lock(&doneLock);
+    pollLatency.reset();
+    irqLatency.reset();
+    wakeLatency.reset();
+    pthread_mutex_unlock(&doneLock);
+}
+
+void AlteraDma::printStats(const char* title)
+{
+    LatencyHistogram p, i, w;
+
+    pthread_mutex_lock(&doneLock);
+    pollLatency.snapshot(&p);
+    irqLatency.snapshot(&i);
+    wakeLatency.snapshot(&w);
+    pthread_mutex_unlock(&doneLock);
+
+    if (title)
+        printf("\n%s\n", title);
+    p.print("polled completion");
+    i.print("irq completion");
+    w.print("waiter wake up");
+}
+
+/* -----------------------------------------------
+Descriptor queue
+The slots form a ring indexed by free running counters: head is incremented by enqueue(), tail
+when a transfer ends. The slot at tail is the one in the controller while active is set.
+----------------------------------------------- */
+
+/** @brief Constructor
+ * @param dmaCtrl DMA controller used by the queue. The queue must be its only user.
+ * @param irqMode When true, the transfers are launched with the interrupt enabled and
+ *                  irqHandler() must be hooked on the DMA interrupt. When false, service() must
+ *                  be called to detect the end of the transfers.
+ */
+AlteraDmaQueue::AlteraDmaQueue(AlteraDma* dmaCtrl, bool irqMode)
+{
+    dma = dmaCtrl;
+    head = 0;
+    tail = 0;
+    active = false;
+    useIrq = irqMode;
+    completed = 0;
+    memset(slots, 0, sizeof(slots));
+    pthread_mutex_init(&lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&progress, &attr);
+    pthread_condattr_destroy(&attr);
+    setIrqMode(irqMode);
+}
+
+AlteraDmaQueue::~AlteraDmaQueue()
+{
+    abort();
+    pthread_cond_destroy(&progress);
+    pthread_mutex_destroy(&lock);
+}
+
+/** @brief Launch the transfer at tail, if any. Called with the lock held. */
+void AlteraDmaQueue::startNext(uint64_t now)
+{
+    if (tail == head)
+        return;
+    TransferDesc* t = slots[tail & (nbrOfSlots - 1)].desc;
+    t->fPolling = !useIrq;
+    t->startNs = now;
+    queueTime.record(now - t->queuedNs);
+    active = true;
+    dma->launch_bidir(t);
+}
+
+/** @brief Queue a transfer
+ *
+ * The transfer is launched at once when the controller is idle.
+ * @param t Descriptor of the transfer, owned by the caller.
+ * @param done Callback called at the end of the transfer, can be NULL.
+ * @param handle First argument of the callback.
+ * @retval ERRCODE_NO_ERROR
+ * @retval ERRCODE_INVALID_VALUE when t is NULL.
+ * @retval ERRCODE_BUSY when the queue is full.
+ */
+PCIeMini_status AlteraDmaQueue::enqueue(TransferDesc* t, DoneCallback* done, void* handle)
+{
+    if (t == NULL)
+        return ERRCODE_INVALID_VALUE;
+
+    pthread_mutex_lock(&lock);
+    if (head - tail >= nbrOfSlots) {
+        pthread_mutex_unlock(&lock);
+        return ERRCODE_BUSY;
+    }
+    Slot& s = slots[head & (nbrOfSlots - 1)];
+    s.desc = t;
+    s.done = done;
+    s.handle = handle;
+    t->status = 0;
+    t->startNs = 0;
+    t->doneNs = 0;
+    t->queuedNs = LatencyHistogram::getTimeNs();
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    if (!active)
+        startNext(t->queuedNs);
+    pthread_mutex_unlock(&lock);
+    return ERRCODE_NO_ERROR;
+}
+
+/** @brief Check the end of the current transfer and launch the next one
+ *
+ * The next transfer is launched before the callback of the completed one is called.
+ * @return 1 when a transfer was completed, else 0.
+ */
+int AlteraDmaQueue::service()
+{
+    Slot s;
+
+    pthread_mutex_lock(&lock);
+    if (!active) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    uint32_t status = dma->getStatus();
+    if ((status & ALTERA_AVALON_DMA_STATUS_DONE_MSK) == 0) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    dma->clearDone();
+    uint64_t now = LatencyHistogram::getTimeNs();
+    s = slots[tail & (nbrOfSlots - 1)];
+    s.desc->status = status;
+    s.desc->doneNs = now;
+    transferTime.record(now - s.desc->startNs);
+    active = false;
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&completed, completed + 1, __ATOMIC_RELEASE);
+    startNext(now);
+    pthread_cond_broadcast(&progress);
+    pthread_mutex_unlock(&lock);
+
+    if (s.done)
+        s.done(s.handle, s.desc);
+    return 1;
+}
+
+/** @brief Wait until all the queued transfers are completed
+ *
+ * In polling mode the queue is serviced by the waiting thread. In interrupt mode the thread
+ * sleeps until service(), called by the interrupt handler, completes a transfer.
+ * @param timeoutMs Maximum time to wait without any transfer completing.
+ * @retval ERRCODE_NO_ERROR
+ * @retval ERRCODE_TIMEOUT
+ */
+PCIeMini_status AlteraDmaQueue::waitIdle(uint32_t timeoutMs)
+{
+    uint64_t timeout = (uint64_t)timeoutMs * 1000000;
+    uint64_t last = LatencyHistogram::getTimeNs();
+
+    if (useIrq) {
+        PCIeMini_status status = ERRCODE_NO_ERROR;
+        pthread_mutex_lock(&lock);
+        while (!isIdle()) {
+            uint64_t done = completed;
+            uint64_t deadline = last + timeout;
+            struct timespec ts;
+            ts.tv_sec = (time_t)(deadline / 1000000000);
+            ts.tv_nsec = (long)(deadline % 1000000000);
+            int err = pthread_cond_timedwait(&progress, &lock, &ts);
+            if (completed != done)
+                last = LatencyHistogram::getTimeNs();
+            else if (err == ETIMEDOUT) {
+                status = ERRCODE_TIMEOUT;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&lock);
+        return status;
+    }
+
+    while (!isIdle()) {
+        if (service() != 0) {
+            last = LatencyHistogram::getTimeNs();
+            continue;
+        }
+        if (LatencyHistogram::getTimeNs() - last > timeout)
+            return ERRCODE_TIMEOUT;
+    }
+    return ERRCODE_NO_ERROR;
+}
+
+/** @brief Reset the controller and drop all the queued transfers
+ *
+ * The callbacks of the dropped transfers are called, with DONE clear in the status of the descriptor.
+ * @return The number of transfers dropped.
+ */
+int AlteraDmaQueue::abort()
+{
+    Slot dropped[nbrOfSlots];
+    int nbrDropped = 0;
+
+    pthread_mutex_lock(&lock);
+    if (active) {
+        dma->reset();
+        if (useIrq)
+            dma->setControlBit(ALTERA_AVALON_DMA_CONTROL_I_EN_MSK);
+    }
+    for (uint32_t i = tail; i != head; i++) {
+        Slot& s = slots[i & (nbrOfSlots - 1)];
+        s.desc->status = 0;
+        dropped[nbrDropped++] = s;
+    }
+    __atomic_store_n(&tail, head, __ATOMIC_RELEASE);
+    active = false;
+    pthread_cond_broadcast(&progress);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < nbrDropped; i++)
+        if (dropped[i].done)
+            dropped[i].done(dropped[i].handle, dropped[i].desc);
+    return nbrDropped;
+}
+
+/** @brief Select how the end of the transfers is detected
+ * @param irqMode When true the interrupt of the controller is enabled.
+ */
+void AlteraDmaQueue::setIrqMode(bool irqMode)
+{
+    pthread_mutex_lock(&lock);
+    useIrq = irqMode;
+    if (irqMode)
+        dma->setControlBit(ALTERA_AVALON_DMA_CONTROL_I_EN_MSK);
+    else
+        dma->clearControlBit(ALTERA_AVALON_DMA_CONTROL_I_EN_MSK);
+    pthread_mutex_unlock(&lock);
+}
+
+void AlteraDmaQueue::clearStats()
+{
+    pthread_mutex_lock(&lock);
+    queueTime.reset();
+    transferTime.reset();
+    completed = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void AlteraDmaQueue::printStats(const char* title)
+{
+    LatencyHistogram q, t;
+
+    pthread_mutex_lock(&lock);
+    queueTime.snapshot(&q);
+    transferTime.snapshot(&t);
+    pthread_mutex_unlock(&lock);
+
+    if (title)
+        printf("\n%s\n", title);
+    printf("%llu transfers completed, %u pending\n", (unsigned long long)getCompleted(), getPending());
+    q.print("queue wait");
+    t.print("transfer");
+}
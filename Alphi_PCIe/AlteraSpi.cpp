@@ -44,13 +44,85 @@ AlteraSpi::AlteraSpi(volatile void* addr, uint8_t width)
 {
     base = (volatile uint32_t *)addr;
     wordSize = width;
+    fifoDepth = 1;
+    rxLevelInStatus = false;
+    lastStatusPolls = 0;
+    controlShadow = 0;
+    clearPollStats();
+}
+
+/** @brief Select how many words sendSpiCommand() keeps in flight
+ *
+ * With a depth of 1, each word is written when TRDY is set and read when RRDY is set, two status
+ * reads per word at least. With a larger depth, up to depth words are written without polling,
+ * then the received words are read in a batch: the controller must have transmit and receive
+ * FIFOs of at least depth words. When the controller reports the receive FIFO level in the
+ * status register, one status read gives the size of the batch; otherwise RRDY gives one word
+ * per status read, and only the writes are saved.
+ * @param depth Number of words in flight, 1 for the controllers without FIFO.
+ * @param levelInStatus True when bits 16-23 of the status register hold the receive FIFO level.
+ */
+void AlteraSpi::setFifoDepth(uint32_t depth, bool levelInStatus)
+{
+    fifoDepth = (depth == 0) ? 1 : depth;
+    rxLevelInStatus = levelInStatus;
+}
+
+/** @brief Select how the received words are waited for
+ *
+ * In interrupt mode, the transfers of at least minIrqWords words sleep until RRDY instead of
+ * polling the status register. irqHandler() must be hooked on the interrupt line of the
+ * controller, with the controller as user data.
+ * @param irqMode True to sleep on the interrupt.
+ * @param minIrqWords Shortest transfer waited for by interrupt, the shorter ones are polled.
+ */
+void AlteraSpi::setIrqMode(bool irqMode, uint32_t minIrqWords)
+{
+    completion.setIrqMode(irqMode, minIrqWords);
+}
+
+/** @brief RRDY stays set until the data is read: mask it and wake up the waiter, which reads the data */
+void AlteraSpi::serviceIrq()
+{
+    ControlReg::write(base, controlShadow & ~ALTERA_AVALON_SPI_CONTROL_IRRDY_MSK);
+    completion.signal();
+}
+
+/** @brief Sleep until the receive data is ready
+ * @retval The status register with RRDY set.
+ */
+uint32_t AlteraSpi::waitRxReady()
+{
+    uint32_t status;
+
+    for (;;) {
+        uint32_t seq = completion.arm();
+        setControl(controlShadow | ALTERA_AVALON_SPI_CONTROL_IRRDY_MSK);
+        status = pollStatus();
+        if ((status & status_RRDY_mask) == 0) {
+            completion.wait(seq);
+            status = pollStatus();
+        }
+        setControl(controlShadow & ~ALTERA_AVALON_SPI_CONTROL_IRRDY_MSK);
+        if ((status & status_RRDY_mask) != 0)
+            return status;
+    }
+}
+
+void AlteraSpi::clearPollStats()
+{
+    totalStatusPolls = 0;
+    totalWords = 0;
+    totalCommands = 0;
 }
 
 /** @brief Send an SPI command
  *
  * This is a very simple routine which performs one SPI master transaction.
- * It would be possible to implement a more efficient version using interrupts
- * and sleeping threads but this is probably not worthwhile initially.
+ * The long transfers sleep on the receive interrupt after setIrqMode(true), see waitRxReady().
+ *
+ * The words are sent one at a time, or pipelined when a FIFO depth is set with setFifoDepth().
+ * The number of status reads is kept in getLastStatusPolls() and getPollStats().
  *
  *  @param slave Slave number select 0-31
  *  @param write_length Number of bytes to send
@@ -66,23 +138,15 @@ int AlteraSpi::sendSpiCommand(uint32_t slave,
                            uint32_t read_length, uint32_t * read_data,
                            uint32_t flags)
 {
-  const uint32_t * write_end = write_data + write_length;
-  uint32_t * read_end = read_data + read_length;
-
-  uint32_t write_zeros = read_length;
-  uint32_t read_ignore = write_length;
   uint32_t status;
-
-  /* We must not send more than two bytes to the target before it has
-   * returned any as otherwise it will overflow. */
-  /* Unfortunately the hardware does not seem to work with credits > 1,
-   * leave it at 1 for now. */
-  uint32_t credits = 1;
+  bool irq = completion.useIrqFor(write_length + read_length);
 
   /* Warning: this function is not currently safe if called in a multi-threaded
    * environment, something above must perform locking to make it safe if more
    * than one thread intends to use it.
    */
+  completion.beginTransfer();
+  lastStatusPolls = 0;
   selectSlave(1 << slave);
   
   /* Set the SSO bit (force chipselect) only if the toggle flag is not set */
@@ -90,6 +154,51 @@ int AlteraSpi::sendSpiCommand(uint32_t slave,
       setControl(ALTERA_AVALON_SPI_CONTROL_SSO_MSK);
   }
 
+  if (fifoDepth > 1)
+    transferPipelined(write_length, write_data, read_length, read_data, irq);
+  else
+    transferLockstep(write_length, write_data, read_length, read_data, irq);
+
+  /* Wait until the interface has finished transmitting */
+  do
+  {
+    status = pollStatus();
+  }
+  while ((status & status_TMT_mask) == 0);
+
+  /* Clear SSO (release chipselect) unless the caller is going to
+   * keep using this chip
+   */
+  if ((flags & ALT_AVALON_SPI_COMMAND_MERGE) == 0)
+      setControl(0);
+
+  totalStatusPolls += lastStatusPolls;
+  totalWords += write_length + read_length;
+  totalCommands++;
+  completion.endTransfer(write_length + read_length, irq);
+  return read_length;
+}
+
+/** @brief Transfer the words one at a time, for the controllers without FIFO
+ *
+ * In interrupt mode, the thread sleeps while it waits for a received word.
+ */
+void AlteraSpi::transferLockstep(uint32_t write_length, const uint32_t * write_data,
+                                 uint32_t read_length, uint32_t * read_data, bool irq)
+{
+  const uint32_t * write_end = write_data + write_length;
+  uint32_t * read_end = read_data + read_length;
+
+  uint32_t write_zeros = read_length;
+  uint32_t read_ignore = write_length;
+  uint32_t status;
+
+  /* We must not send more than two bytes to the target before it has
+   * returned any as otherwise it will overflow. */
+  /* Unfortunately the hardware does not seem to work with credits > 1,
+   * leave it at 1 for now. */
+  uint32_t credits = 1;
+
   /*
    * Discard any stale data present in the RXDATA register, in case
    * previous communication was interrupted and stale data was left
@@ -103,7 +212,9 @@ int AlteraSpi::sendSpiCommand(uint32_t slave,
     
     do
     {
-      status = getStatus();
+      status = pollStatus();
+      if (irq && credits == 0 && (status & status_RRDY_mask) == 0)
+        status = waitRxReady();
     }
     while (((status & status_TRDY_mask) == 0 || credits == 0) &&
             (status & status_RRDY_mask) == 0);
@@ -138,20 +249,52 @@ int AlteraSpi::sendSpiCommand(uint32_t slave,
     }
     
   }
+}
 
-  /* Wait until the interface has finished transmitting */
-  do
+/** @brief Transfer the words with fifoDepth words in flight
+ *
+ * A word written and not yet read is in the transmit FIFO, in the shift register or in the
+ * receive FIFO, so keeping at most fifoDepth of them overflows neither FIFO: the writes need
+ * no status read. In interrupt mode, the thread sleeps while the receive FIFO is empty.
+ */
+void AlteraSpi::transferPipelined(uint32_t write_length, const uint32_t * write_data,
+                                  uint32_t read_length, uint32_t * read_data, bool irq)
+{
+  uint32_t total = write_length + read_length;
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t status;
+
+  /* Discard the stale data of an interrupted transfer */
+  while ((pollStatus() & status_RRDY_mask) != 0)
+    getRxData();
+
+  while (received < total)
   {
-    status = getStatus();
-  }
-  while ((status & status_TMT_mask) == 0);
+    while (sent < total && sent - received < fifoDepth)
+    {
+      setTxData(sent < write_length ? write_data[sent] : 0);
+      sent++;
+    }
 
-  /* Clear SSO (release chipselect) unless the caller is going to
-   * keep using this chip
-   */
-  if ((flags & ALT_AVALON_SPI_COMMAND_MERGE) == 0)
-      setControl(0);
+    status = pollStatus();
+    if (irq && (status & status_RRDY_mask) == 0)
+      status = waitRxReady();
+    uint32_t ready;
+    if (rxLevelInStatus)
+      ready = (status & status_rxLevel_mask) >> status_rxLevel_bitNbr;
+    else
+      ready = (status & status_RRDY_mask) ? 1 : 0;
+    if (ready > sent - received)
+      ready = sent - received;
 
-  return read_length;
-}
+    for ( ; ready > 0; ready--)
+    {
+      uint32_t rxdata = getRxData();
 
+      if (received >= write_length)
+        read_data[received - write_length] = rxdata;
+      received++;
+    }
+  }
+}
@@ -6,26 +6,50 @@
 CPP_SRCS += \
 ../AlphiBoard.cpp \
 ../AlphiBoard_irq.cpp \
+../AlphiBoard_mmio.cpp \
+../AlteraDma.cpp \
 ../AlteraSpi.cpp \
+../DmaBufferProvider.cpp \
+../DmaEngine.cpp \
 ../PCIeMini_error.cpp \
 ../PcieCra.cpp \
-../TestProgram.cpp 
+../SimBackend.cpp \
+../SpiCompletion.cpp \
+../TestProgram.cpp \
+../UioBackend.cpp \
+../UioEnumerator.cpp 
 
 OBJS += \
 ./AlphiBoard.o \
 ./AlphiBoard_irq.o \
+./AlphiBoard_mmio.o \
+./AlteraDma.o \
 ./AlteraSpi.o \
+./DmaBufferProvider.o \
+./DmaEngine.o \
 ./PCIeMini_error.o \
 ./PcieCra.o \
-./TestProgram.o 
+./SimBackend.o \
+./SpiCompletion.o \
+./TestProgram.o \
+./UioBackend.o \
+./UioEnumerator.o 
 
 CPP_DEPS += \
 ./AlphiBoard.d \
 ./AlphiBoard_irq.d \
+./AlphiBoard_mmio.d \
+./AlteraDma.d \
 ./AlteraSpi.d \
+./DmaBufferProvider.d \
+./DmaEngine.d \
 ./PCIeMini_error.d \
 ./PcieCra.d \
-./TestProgram.d 
+./SimBackend.d \
+./SpiCompletion.d \
+./TestProgram.d \
+./UioBackend.d \
+./UioEnumerator.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
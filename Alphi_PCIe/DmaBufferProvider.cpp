@@ -0,0 +1,296 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file DmaBufferProvider.cpp
+* @brief Host memory buffers the board DMA controllers can reach
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include "DmaBufferProvider.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static DmaBuffer* newBuffer(DmaBufferProvider* provider, size_t length, size_t chunkSize)
+{
+	DmaBuffer* b = new DmaBuffer();
+	b->address = NULL;
+	b->length = length;
+	b->chunkSize = chunkSize;
+	b->nbrOfChunks = (uint32_t)((length + chunkSize - 1) / chunkSize);
+	b->busAddress = new uint64_t[b->nbrOfChunks];
+	b->provider = provider;
+	b->mappedLength = 0;
+	b->fd = -1;
+	return b;
+}
+
+static void deleteBuffer(DmaBuffer* b)
+{
+	delete[] b->busAddress;
+	delete b;
+}
+
+/* -----------------------------------------------
+Huge pages
+----------------------------------------------- */
+
+/** @brief Constructor
+ * @param fallbackToSmallPages When true, allocate() uses locked regular pages when no huge page is available.
+ *		Unsafe: the kernel may migrate regular pages, locked or not, under a running DMA.
+ */
+HugePageDmaProvider::HugePageDmaProvider(bool fallbackToSmallPages)
+{
+	fallback = fallbackToSmallPages;
+	hugePageSize = 0x200000;
+
+	FILE* f = fopen("/proc/meminfo", "r");
+	if (f != NULL) {
+		char line[128];
+		unsigned long kb;
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+				hugePageSize = (size_t)kb * 1024;
+				break;
+			}
+		}
+		fclose(f);
+	}
+}
+
+/** @brief Allocate a buffer
+ *
+ * The length is rounded up to a whole number of pages. The pages are populated, locked and
+ * cleared before their addresses are resolved.
+ */
+PCIeMini_status HugePageDmaProvider::allocate(size_t length, DmaBuffer** buffer)
+{
+	if (length == 0)
+		return ERRCODE_INVALID_VALUE;
+
+	size_t pageSize = hugePageSize;
+	size_t mapLength = (length + pageSize - 1) & ~(pageSize - 1);
+	void* addr = mmap(NULL, mapLength, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE | MAP_LOCKED, -1, 0);
+	if (addr == MAP_FAILED) {
+		if (!fallback)
+			return ERRCODE_INVALID_VALUE;
+		fprintf(stderr, "WARNING: no huge page available, the DMA buffer uses regular pages.\n"
+			"WARNING: the kernel may migrate them and the board would then write to memory it does not own.\n");
+		pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		mapLength = (length + pageSize - 1) & ~(pageSize - 1);
+		addr = mmap(NULL, mapLength, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_LOCKED, -1, 0);
+		if (addr == MAP_FAILED)
+			return ERRCODE_INVALID_VALUE;
+	}
+	// keep the pages resident; hugetlb pages are not moved by compaction, regular pages may still migrate
+	if (mlock(addr, mapLength) != 0) {
+		munmap(addr, mapLength);
+		return ERRCODE_PERMISSION_DENIED;
+	}
+	memset(addr, 0, mapLength);
+
+	DmaBuffer* b = newBuffer(this, length, pageSize);
+	b->address = addr;
+	b->mappedLength = mapLength;
+
+	PCIeMini_status status = resolve(b);
+	if (status != ERRCODE_NO_ERROR) {
+		release(b);
+		return status;
+	}
+	*buffer = b;
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Read the physical address of each chunk in /proc/self/pagemap
+ *
+ * Each entry of pagemap is 64 bits: bit 63 is set when the page is present, bits 54:0 are the
+ * page frame number. The frame number reads as 0 without CAP_SYS_ADMIN.
+ */
+PCIeMini_status HugePageDmaProvider::resolve(DmaBuffer* buffer)
+{
+	size_t sysPageSize = (size_t)sysconf(_SC_PAGESIZE);
+	int fd = ::open("/proc/self/pagemap", O_RDONLY);
+	if (fd < 0)
+		return ERRCODE_PERMISSION_DENIED;
+
+	for (uint32_t i = 0; i < buffer->nbrOfChunks; i++) {
+		uintptr_t va = (uintptr_t)buffer->address + i * buffer->chunkSize;
+		uint64_t entry;
+		if (pread(fd, &entry, sizeof(entry), (off_t)(va / sysPageSize) * sizeof(entry)) != sizeof(entry)
+			|| (entry & (1ull << 63)) == 0) {
+			close(fd);
+			return ERRCODE_INTERNAL_ERROR;
+		}
+		uint64_t pfn = entry & ((1ull << 55) - 1);
+		if (pfn == 0) {
+			close(fd);
+			return ERRCODE_PERMISSION_DENIED;
+		}
+		buffer->busAddress[i] = pfn * sysPageSize + (va % sysPageSize);
+	}
+	close(fd);
+	return ERRCODE_NO_ERROR;
+}
+
+void HugePageDmaProvider::release(DmaBuffer* buffer)
+{
+	if (buffer == NULL)
+		return;
+	munlock(buffer->address, buffer->mappedLength);
+	munmap(buffer->address, buffer->mappedLength);
+	deleteBuffer(buffer);
+}
+
+/* -----------------------------------------------
+u-dma-buf
+----------------------------------------------- */
+
+/** @brief Constructor
+ * @param deviceName Name of the u-dma-buf device, without /dev/.
+ */
+UdmabufDmaProvider::UdmabufDmaProvider(const char* deviceName)
+{
+	snprintf(name, sizeof(name), "%s", deviceName);
+	inUse = false;
+}
+
+/** @brief Read a number from a sysfs attribute of the device */
+static bool readUdmabufAttribute(const char* name, const char* attribute, unsigned long long* value)
+{
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/class/u-dma-buf/%s/%s", name, attribute);
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return false;
+	int n = fscanf(f, "%lli", value);
+	fclose(f);
+	return n == 1;
+}
+
+/** @brief Map the device buffer
+ * @retval ERRCODE_BUSY if the buffer is already allocated.
+ * @retval ERRCODE_BOARD_NOT_PRESENT if the module is not loaded.
+ * @retval ERRCODE_INVALID_VALUE if the buffer is smaller than length.
+ */
+PCIeMini_status UdmabufDmaProvider::allocate(size_t length, DmaBuffer** buffer)
+{
+	unsigned long long physAddr, size;
+
+	if (inUse)
+		return ERRCODE_BUSY;
+	if (!readUdmabufAttribute(name, "phys_addr", &physAddr) || !readUdmabufAttribute(name, "size", &size))
+		return ERRCODE_BOARD_NOT_PRESENT;
+	if (length == 0 || length > size)
+		return ERRCODE_INVALID_VALUE;
+
+	char path[64];
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	int fd = ::open(path, O_RDWR);
+	if (fd < 0)
+		return ERRCODE_PERMISSION_DENIED;
+	void* addr = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED) {
+		close(fd);
+		return ERRCODE_PERMISSION_DENIED;
+	}
+
+	DmaBuffer* b = newBuffer(this, length, (size_t)size);
+	b->address = addr;
+	b->mappedLength = (size_t)size;
+	b->fd = fd;
+	b->busAddress[0] = physAddr;
+	inUse = true;
+	*buffer = b;
+	return ERRCODE_NO_ERROR;
+}
+
+void UdmabufDmaProvider::release(DmaBuffer* buffer)
+{
+	if (buffer == NULL)
+		return;
+	munmap(buffer->address, buffer->mappedLength);
+	close(buffer->fd);
+	deleteBuffer(buffer);
+	inUse = false;
+}
+
+/* -----------------------------------------------
+Simulation
+----------------------------------------------- */
+
+/** @brief Constructor
+ * @param busBase Bus address of the first buffer.
+ * @param chunkSize Size of the contiguous chunks, power of 2.
+ * @param scatter When true, the chunks are not contiguous on the bus.
+ */
+SimDmaProvider::SimDmaProvider(uint64_t busBase, size_t chunkSize, bool scatter)
+{
+	nextBusAddress = busBase;
+	simChunkSize = chunkSize;
+	simScatter = scatter;
+	allocatedCount = 0;
+}
+
+PCIeMini_status SimDmaProvider::allocate(size_t length, DmaBuffer** buffer)
+{
+	void* addr;
+
+	if (length == 0)
+		return ERRCODE_INVALID_VALUE;
+	size_t mapLength = (length + simChunkSize - 1) & ~(simChunkSize - 1);
+	if (posix_memalign(&addr, simChunkSize, mapLength) != 0)
+		return ERRCODE_INVALID_VALUE;
+	memset(addr, 0, mapLength);
+
+	DmaBuffer* b = newBuffer(this, length, simChunkSize);
+	b->address = addr;
+	b->mappedLength = mapLength;
+	for (uint32_t i = 0; i < b->nbrOfChunks; i++) {
+		b->busAddress[i] = nextBusAddress;
+		nextBusAddress += simScatter ? 2 * simChunkSize : simChunkSize;
+	}
+	nextBusAddress += simChunkSize;		// hole between buffers
+	allocatedCount++;
+	*buffer = b;
+	return ERRCODE_NO_ERROR;
+}
+
+void SimDmaProvider::release(DmaBuffer* buffer)
+{
+	if (buffer == NULL)
+		return;
+	free(buffer->address);
+	deleteBuffer(buffer);
+	allocatedCount--;
+}
@@ -0,0 +1,455 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file DmaEngine.cpp
+* @brief Asynchronous submission of DMA transfers
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include "DmaEngine.h"
+
+/** @brief Initialize a condition variable waiting on the monotonic clock */
+static void initMonotonicCond(pthread_cond_t* cond)
+{
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+/** @brief Wait on a condition variable until a LatencyHistogram::getTimeNs() date
+ * @return 0 when signaled, ETIMEDOUT at the deadline. UINT64_MAX waits forever.
+ */
+static int condWaitUntil(pthread_cond_t* cond, pthread_mutex_t* mutex, uint64_t deadline)
+{
+	if (deadline == UINT64_MAX)
+		return pthread_cond_wait(cond, mutex);
+
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadline / 1000000000);
+	ts.tv_nsec = (long)(deadline % 1000000000);
+	return pthread_cond_timedwait(cond, mutex, &ts);
+}
+
+DmaRequest::DmaRequest()
+{
+	done = NULL;
+	handle = NULL;
+	state = stateIdle;
+	result = ERRCODE_INVALID_VALUE;
+	trEntry = -1;
+	engine = NULL;
+	pthread_mutex_init(&lock, NULL);
+	initMonotonicCond(&cond);
+}
+
+DmaRequest::~DmaRequest()
+{
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+/** @brief Wait for the end of the transfer
+ * @param timeoutUs Maximum waiting time in microseconds, waitForever to wait without limit.
+ * @return The result of the transfer, ERRCODE_TIMEOUT if it is not done in time,
+ *		ERRCODE_INVALID_VALUE if the request was never submitted.
+ */
+PCIeMini_status DmaRequest::wait(uint32_t timeoutUs)
+{
+	uint64_t deadline = (timeoutUs == waitForever) ? UINT64_MAX
+		: LatencyHistogram::getTimeNs() + (uint64_t)timeoutUs * 1000;
+
+	pthread_mutex_lock(&lock);
+	while (state == statePending) {
+		if (condWaitUntil(&cond, &lock, deadline) != 0 && state == statePending) {
+			pthread_mutex_unlock(&lock);
+			return ERRCODE_TIMEOUT;
+		}
+	}
+	PCIeMini_status status = result;
+	pthread_mutex_unlock(&lock);
+	return status;
+}
+
+/** @brief Publish the result and wake up the waiters, called by the executor */
+void DmaRequest::finish(PCIeMini_status status)
+{
+	pthread_mutex_lock(&lock);
+	result = status;
+	__atomic_store_n(&state, stateDone, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/*-----------------------------------------------
+The requests go through three stages:
+- submit() counts them in inFlight and gives their descriptor to the AlteraDmaQueue,
+- queueDone(), called by the queue at the end of the transfer, pushes them in doneRing,
+- the executor thread pops them, calls their callback, marks them done and decrements inFlight.
+inFlight is never above limit, so doneRing cannot overflow.
+-----------------------------------------------*/
+
+/** @brief Constructor
+ * @param dmaCtrl DMA controller driven by the engine.
+ * @param pcieCra PCIe bridge used by submitHost() to map the host buffers, NULL if not used.
+ */
+DmaEngine::DmaEngine(AlteraDma* dmaCtrl, PcieCra* pcieCra)
+{
+	dma = dmaCtrl;
+	cra = pcieCra;
+	queue = NULL;
+	limit = 0;
+	inFlight = 0;
+	completions = 0;
+	doneHead = 0;
+	doneTail = 0;
+	running = false;
+	accepting = false;
+	stopRequest = false;
+	useIrq = false;
+	pthread_mutex_init(&lock, NULL);
+	initMonotonicCond(&executorCond);
+	initMonotonicCond(&slotCond);
+}
+
+DmaEngine::~DmaEngine()
+{
+	stop();
+	pthread_cond_destroy(&slotCond);
+	pthread_cond_destroy(&executorCond);
+	pthread_mutex_destroy(&lock);
+}
+
+/** @brief Take the controller and start the executor thread
+ * @param inFlightLimit Maximum number of requests submitted and not done, up to maxInFlight.
+ * @param irqMode When true, the end of the transfers is signaled by irqHandler().
+ * @retval ERRCODE_BUSY if the engine is already started.
+ */
+PCIeMini_status DmaEngine::start(uint32_t inFlightLimit, bool irqMode)
+{
+	if (running)
+		return ERRCODE_BUSY;
+	if (inFlightLimit == 0 || inFlightLimit > maxInFlight)
+		return ERRCODE_INVALID_VALUE;
+
+	dma->acquire();
+	queue = new AlteraDmaQueue(dma, irqMode);
+	limit = inFlightLimit;
+	inFlight = 0;
+	completions = 0;
+	doneHead = 0;
+	doneTail = 0;
+	stopRequest = false;
+	useIrq = irqMode;
+	if (pthread_create(&executor, NULL, &executorEntry, (void*)this) != 0) {
+		printf("can't create the DMA executor thread\n");
+		delete queue;
+		queue = NULL;
+		dma->release();
+		return ERRCODE_INTERNAL_ERROR;
+	}
+	running = true;
+	accepting = true;
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Wait for the requests in flight, stop the executor and give back the controller
+ *
+ * The requests still in flight after timeoutMs are dropped and complete with ERRCODE_TIMEOUT.
+ * The submissions made during the stop fail with ERRCODE_INVALID_HANDLE.
+ * @param timeoutMs Maximum time given to the requests in flight.
+ */
+void DmaEngine::stop(uint32_t timeoutMs)
+{
+	if (!running)
+		return;
+
+	uint64_t deadline = LatencyHistogram::getTimeNs() + (uint64_t)timeoutMs * 1000000;
+	pthread_mutex_lock(&lock);
+	accepting = false;
+	pthread_cond_broadcast(&slotCond);
+	while (inFlight > 0) {
+		if (condWaitUntil(&slotCond, &lock, deadline) != 0)
+			break;
+	}
+	bool hung = inFlight > 0;
+	pthread_mutex_unlock(&lock);
+
+	if (hung)
+		printf("DMA engine: %d requests dropped\n", queue->abort());
+
+	pthread_mutex_lock(&lock);
+	stopRequest = true;
+	pthread_cond_signal(&executorCond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(executor, NULL);
+
+	AlteraDmaQueue* q = queue;
+	queue = NULL;
+	delete q;
+	// the queue set I_EN for its own mode, give the controller back in its own mode
+	dma->setIrqMode(dma->getIrqMode());
+	running = false;
+	dma->release();
+}
+
+/** @brief Convert a timeout into a deadline, UINT64_MAX for DmaRequest::waitForever */
+uint64_t DmaEngine::deadlineOf(uint32_t timeoutUs)
+{
+	if (timeoutUs == DmaRequest::waitForever)
+		return UINT64_MAX;
+	return LatencyHistogram::getTimeNs() + (uint64_t)timeoutUs * 1000;
+}
+
+/** @brief Wait on one of the engine conditions, lock held */
+int DmaEngine::waitUntil(pthread_cond_t* cond, uint64_t deadline)
+{
+	if (deadline != UINT64_MAX && LatencyHistogram::getTimeNs() >= deadline)
+		return ETIMEDOUT;
+	return condWaitUntil(cond, &lock, deadline);
+}
+
+/** @brief Queue a transfer
+ *
+ * The descriptor of the request (src_offset, dest_offset, tfr_length) is set by the caller.
+ * @param req Request, not pending.
+ * @param timeoutUs Maximum time to wait for room in the in-flight queue, 0 to return at once.
+ * @retval ERRCODE_BUSY if the request is pending, or the queue is full and timeoutUs is 0.
+ * @retval ERRCODE_TIMEOUT if the queue stayed full for timeoutUs.
+ * @retval ERRCODE_INVALID_HANDLE if the engine is not started.
+ */
+PCIeMini_status DmaEngine::submit(DmaRequest* req, uint32_t timeoutUs)
+{
+	return submitUntil(req, deadlineOf(timeoutUs));
+}
+
+PCIeMini_status DmaEngine::submitUntil(DmaRequest* req, uint64_t deadline)
+{
+	if (req == NULL)
+		return ERRCODE_INVALID_VALUE;
+	if (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == DmaRequest::statePending)
+		return ERRCODE_BUSY;
+
+	uint64_t t0 = LatencyHistogram::getTimeNs();
+	pthread_mutex_lock(&lock);
+	while (accepting && inFlight >= limit) {
+		if (waitUntil(&slotCond, deadline) != 0 && inFlight >= limit) {
+			pthread_mutex_unlock(&lock);
+			return (deadline <= t0) ? ERRCODE_BUSY : ERRCODE_TIMEOUT;
+		}
+	}
+	if (!accepting) {
+		pthread_mutex_unlock(&lock);
+		return ERRCODE_INVALID_HANDLE;
+	}
+	__atomic_store_n(&inFlight, inFlight + 1, __ATOMIC_RELEASE);
+	req->engine = this;
+	req->result = ERRCODE_BUSY;
+	__atomic_store_n(&req->state, DmaRequest::statePending, __ATOMIC_RELEASE);
+	submitWait.record(LatencyHistogram::getTimeNs() - t0);		// single writer: recorded under the lock
+	pthread_mutex_unlock(&lock);
+
+	PCIeMini_status status = queue->enqueue(&req->desc, &queueDone, req);
+
+	pthread_mutex_lock(&lock);
+	if (status != ERRCODE_NO_ERROR) {
+		__atomic_store_n(&inFlight, inFlight - 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&req->state, DmaRequest::stateIdle, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&slotCond);
+	}
+	else if (!useIrq)
+		pthread_cond_signal(&executorCond);
+	pthread_mutex_unlock(&lock);
+	return status;
+}
+
+/** @brief Queue a transfer between a host buffer and the board
+ *
+ * The translation entry mapping the buffer is pinned until the request is done. When all the
+ * entries are pinned by requests to other pages, the call waits for one of them to complete.
+ * The transfer must be contiguous on the bus and stay in a translation page: longer transfers
+ * are split by the caller, one request per piece.
+ * @param req Request, not pending. Its descriptor is set by the call.
+ * @param buffer Host buffer, allocated by the DMA provider of the board.
+ * @param offset Offset of the transfer in the buffer.
+ * @param length Length of the transfer in bytes.
+ * @param fToDev When true DMA to device, when false DMA from device.
+ * @param localAddress Avalon address on the board side.
+ * @param timeoutUs Maximum waiting time for a translation entry and for room in the queue.
+ * @retval ERRCODE_INVALID_VALUE if the transfer is not contiguous or crosses a translation page.
+ */
+PCIeMini_status DmaEngine::submitHost(DmaRequest* req, DmaBuffer* buffer, size_t offset, uint32_t length, bool fToDev,
+	uint32_t localAddress, uint32_t timeoutUs)
+{
+	uint64_t deadline = deadlineOf(timeoutUs);
+	uint32_t txsLocalAddress, mappedLength;
+	int entry = -1;
+	PCIeMini_status status;
+
+	if (req == NULL || cra == NULL || buffer == NULL || length == 0 || buffer->getContiguousLength(offset) < length)
+		return ERRCODE_INVALID_VALUE;
+	if (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == DmaRequest::statePending)
+		return ERRCODE_BUSY;
+
+	uint64_t pcieAddress = buffer->getBusAddress(offset);
+	for (;;) {
+		status = cra->mapPcieAddress(pcieAddress, length, &txsLocalAddress, &mappedLength, &entry);
+		if (status != ERRCODE_BUSY)
+			break;
+
+		// all the entries are pinned, wait for a completion
+		pthread_mutex_lock(&lock);
+		uint64_t seen = completions;
+		while (completions == seen && inFlight > 0 && accepting) {
+			if (waitUntil(&slotCond, deadline) != 0)
+				break;
+		}
+		bool progress = completions != seen;
+		pthread_mutex_unlock(&lock);
+		if (!progress)
+			return ERRCODE_BUSY;
+	}
+	if (status != ERRCODE_NO_ERROR)
+		return status;
+	if (mappedLength < length) {
+		cra->unpinTrEntry(entry);
+		return ERRCODE_INVALID_VALUE;
+	}
+
+	req->desc.tfr_length = length;
+	req->desc.txs_offset = txsLocalAddress;
+	req->desc.bufLength = length;
+	req->desc.userSpaceBuffer = (uint32_t*)((uint8_t*)buffer->address + offset);
+	if (fToDev) {
+		req->desc.src_offset = txsLocalAddress;
+		req->desc.dest_offset = localAddress;
+	}
+	else {
+		req->desc.src_offset = localAddress;
+		req->desc.dest_offset = txsLocalAddress;
+	}
+	req->trEntry = entry;
+
+	status = submitUntil(req, deadline);
+	if (status != ERRCODE_NO_ERROR) {
+		req->trEntry = -1;
+		cra->unpinTrEntry(entry);
+	}
+	return status;
+}
+
+/** @brief End of transfer, called by the queue from the interrupt or the executor thread */
+void DmaEngine::queueDone(void* handle, TransferDesc* t)
+{
+	DmaRequest* req = (DmaRequest*)handle;
+	DmaEngine* engine = req->engine;
+
+	// the descriptors dropped by AlteraDmaQueue::abort() have DONE clear
+	PCIeMini_status status = (t->status & ALTERA_AVALON_DMA_STATUS_DONE_MSK) ? ERRCODE_NO_ERROR : ERRCODE_TIMEOUT;
+
+	pthread_mutex_lock(&engine->lock);
+	req->result = status;
+	engine->doneRing[engine->doneHead & (maxInFlight - 1)] = req;
+	engine->doneHead++;
+	pthread_cond_signal(&engine->executorCond);
+	pthread_mutex_unlock(&engine->lock);
+}
+
+void* DmaEngine::executorEntry(void* context)
+{
+	((DmaEngine*)context)->executorLoop();
+	return NULL;
+}
+
+/** @brief Release the resources of a request, call its callback and mark it done */
+void DmaEngine::complete(DmaRequest* req)
+{
+	if (req->trEntry >= 0) {
+		cra->unpinTrEntry(req->trEntry);
+		req->trEntry = -1;
+	}
+	completionTime.record(LatencyHistogram::getTimeNs() - req->desc.queuedNs);
+	if (req->done != NULL)
+		req->done(req->handle, req);
+	req->finish(req->result);
+}
+
+/** @brief Executor thread: runs the completions, and polls the controller in polling mode */
+void DmaEngine::executorLoop()
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		if (doneTail != doneHead) {
+			DmaRequest* req = doneRing[doneTail & (maxInFlight - 1)];
+			doneTail++;
+			pthread_mutex_unlock(&lock);
+			complete(req);
+			pthread_mutex_lock(&lock);
+			__atomic_store_n(&inFlight, inFlight - 1, __ATOMIC_RELEASE);
+			completions++;
+			pthread_cond_broadcast(&slotCond);
+			continue;
+		}
+		if (stopRequest && inFlight == 0)
+			break;
+		if (!useIrq && inFlight > 0) {
+			pthread_mutex_unlock(&lock);
+			if (queue->service() == 0)
+				sched_yield();
+			pthread_mutex_lock(&lock);
+			continue;
+		}
+		pthread_cond_wait(&executorCond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void DmaEngine::clearStats()
+{
+	submitWait.reset();
+	completionTime.reset();
+	if (queue != NULL)
+		queue->clearStats();
+}
+
+void DmaEngine::printStats(const char* title)
+{
+	if (title)
+		printf("\n%s\n", title);
+	printf("%s mode, %u requests in flight at most\n", useIrq ? "interrupt" : "polling", limit);
+	submitWait.print("submit wait");
+	completionTime.print("submit to completion");
+	if (queue != NULL)
+		queue->printStats();
+}
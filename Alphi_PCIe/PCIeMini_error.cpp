@@ -153,9 +153,18 @@ DLL char * getAlphiErrorMsg(PCIeMini_status errCode)
 	case ERRCODE_TX_OVERFLOW:
 		strcpy(ErrMsg, "Tx FIFO overflow.");
 		break;
+	case ERRCODE_BUSY:
+		strcpy(ErrMsg, "Device busy.");
+		break;
+	case ERRCODE_TIMEOUT:
+		strcpy(ErrMsg, "Timeout.");
+		break;
 	case ERRCODE_INVALID_ALIGNMENT:
 		strcpy(ErrMsg, "Invalid alignment.");
 		break;
+	case ERRCODE_PERMISSION_DENIED:
+		strcpy(ErrMsg, "Permission denied by the operating system.");
+		break;
 	default:
 //		char* wdErr = wdErrorToString(errCode);
 //		if (wdErr != NULL) return wdErr;
@@ -33,6 +33,7 @@
 //---------------------------------------------------------------------
 
 #include "PcieCra.h"
+#include <string.h>
 
 /** @brief constructor 
  * 
@@ -51,6 +52,22 @@ PcieCra::PcieCra(volatile void* cra_addr)
 	ttEntryOffset = 24;
 	ttNbrOfEntriesBits = 1;
 	ttPageAddressMask = 0x00ffffff;
+
+	pthread_mutex_init(&trLock, NULL);
+	memset(trState, 0, sizeof(trState));
+	trUseCounter = 0;
+	trHits = 0;
+	trWrites = 0;
+
+	pthread_mutex_init(&irqEnableLock, NULL);
+	irqEnableShadow = *pcieIrqEnable;
+	moderatedMask = 0;
+	polledMask = 0;
+	unclaimedMask = 0;
+	moderationEnabled = 0;
+	memset(moderationWindowUs, 0, sizeof(moderationWindowUs));
+	memset(moderationThreshold, 0, sizeof(moderationThreshold));
+	memset(moderationCounters, 0, sizeof(moderationCounters));
 }
 
 /** @brief Reset the CRA PCIe interface
@@ -59,7 +76,13 @@ PcieCra::PcieCra(volatile void* cra_addr)
 */
 void PcieCra::reset()
 {
+	pthread_mutex_lock(&irqEnableLock);
+	irqEnableShadow = 0;
+	moderatedMask = 0;
+	polledMask = 0;
+	unclaimedMask = 0;
 	*pcieIrqEnable = 0;
+	pthread_mutex_unlock(&irqEnableLock);
 }
 
 /** @brief return the interrupt status of the local IRQ lines
@@ -73,13 +96,29 @@ uint32_t PcieCra::getIrqStatus()
 	return *pcieIrqStatus;
 }
 
+/** @brief Acknowledge A2P mailbox interrupts
+*
+* The mailbox bits of the status register are latched and cleared by writing a 1 (RW1C).
+* The Avalon IRQ bits are read-only and are not affected.
+* @param mask bit mask of the mailbox interrupts to clear, as read in the status register
+*/
+void PcieCra::clearMailboxIrq(uint32_t mask)
+{
+	*pcieIrqStatus = mask & a2pMailboxIrqMask;
+}
+
 
 /** @brief Enable/disable the interrupts
+*
+* The sources currently masked by the interrupt moderation stay disabled until their window ends.
 * @param mask bit mask of enabled interrupts
 */
 void PcieCra::setIrqEnableMask(uint32_t mask)
 {
-	*pcieIrqEnable = mask;
+	pthread_mutex_lock(&irqEnableLock);
+	irqEnableShadow = mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
 }
 
 /** @brief return the interrupt enable mask
@@ -89,6 +128,139 @@ uint32_t PcieCra::getIrqEnableMask()
 	return *pcieIrqEnable;
 }
 
+/** @brief Update the enable register from the user mask and the moderation mask, lock held */
+void PcieCra::writeIrqEnable()
+{
+	*pcieIrqEnable = irqEnableShadow & ~(moderatedMask | polledMask | unclaimedMask);
+}
+
+/** @brief Configure the interrupt moderation of a source
+*
+* When a moderated source interrupts threshold times within a window, the interrupt thread masks it
+* for windowUs microseconds after serving it. At the end of the window, the source is served again
+* without interrupt if it is still asserted, and the window restarts; otherwise the source is
+* unmasked. This trades latency for fewer interrupts on bursty sources.
+* @param bitNbr Bit number of the source in the interrupt status register.
+* @param windowUs Window duration in microseconds, 0 to disable the moderation of the source.
+* @param threshold Number of interrupts within a window before the source is masked, 0 or 1 to mask after each interrupt.
+* The source is left out of the moderation while its parameters change, so it can be configured with the interrupt thread running.
+* @retval ERRCODE_INVALID_VALUE if the bit number is out of range.
+*/
+PCIeMini_status PcieCra::setIrqModeration(int bitNbr, uint32_t windowUs, uint32_t threshold)
+{
+	if (bitNbr < 0 || bitNbr >= nbrOfIrqSources)
+		return ERRCODE_INVALID_VALUE;
+
+	__atomic_and_fetch(&moderationEnabled, ~(1u << bitNbr), __ATOMIC_SEQ_CST);
+	__atomic_store_n(&moderationWindowUs[bitNbr], windowUs, __ATOMIC_RELAXED);
+	__atomic_store_n(&moderationThreshold[bitNbr], threshold, __ATOMIC_RELAXED);
+	if (windowUs != 0)
+		__atomic_or_fetch(&moderationEnabled, 1u << bitNbr, __ATOMIC_RELEASE);
+	else
+		unmaskModeratedSources(1 << bitNbr);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return the moderation counters of a source
+* @param bitNbr Bit number of the source in the interrupt status register.
+* @param counters Destination of the counters.
+* @retval ERRCODE_INVALID_VALUE if the bit number is out of range.
+*/
+PCIeMini_status PcieCra::getIrqModerationCounters(int bitNbr, IrqModerationCounters* counters)
+{
+	if (bitNbr < 0 || bitNbr >= nbrOfIrqSources)
+		return ERRCODE_INVALID_VALUE;
+
+	pthread_mutex_lock(&irqEnableLock);
+	*counters = moderationCounters[bitNbr];
+	pthread_mutex_unlock(&irqEnableLock);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Clear the moderation counters of all the sources */
+void PcieCra::resetIrqModerationCounters()
+{
+	pthread_mutex_lock(&irqEnableLock);
+	memset(moderationCounters, 0, sizeof(moderationCounters));
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
+/** @brief Mask sources for a moderation window
+* @param mask bit mask of the sources to mask
+*/
+void PcieCra::maskModeratedSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	moderatedMask |= mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
+/** @brief Unmask sources at the end of a moderation window
+* @param mask bit mask of the sources to unmask
+*/
+void PcieCra::unmaskModeratedSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	moderatedMask &= ~mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
+/** @brief Serve sources by polling instead of interrupts
+*
+* The polled sources are masked in the enable register; their status bits still reflect the interrupt lines.
+* @param mask bit mask of the sources to poll
+*/
+void PcieCra::addPolledSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	polledMask |= mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
+/** @brief Serve sources by interrupts again
+* @param mask bit mask of the sources to stop polling
+*/
+void PcieCra::removePolledSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	polledMask &= ~mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
+/** @brief Mask sources that interrupted with no handler to serve them
+*
+* A level interrupt nobody clears would wake up the interrupt thread again at each re-arm.
+* The sources stay masked until a handler is attached, see unmaskUnclaimedSources().
+* @param mask bit mask of the unclaimed sources
+* @return Bit mask of the sources that were not masked yet
+*/
+uint32_t PcieCra::maskUnclaimedSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	uint32_t newlyMasked = mask & ~unclaimedMask;
+	unclaimedMask |= mask;
+	writeIrqEnable();
+	pthread_mutex_unlock(&irqEnableLock);
+	return newlyMasked;
+}
+
+/** @brief Enable again sources masked as unclaimed, once a handler serves them
+* @param mask bit mask of the sources
+*/
+void PcieCra::unmaskUnclaimedSources(uint32_t mask)
+{
+	pthread_mutex_lock(&irqEnableLock);
+	if (unclaimedMask & mask) {
+		unclaimedMask &= ~mask;
+		writeIrqEnable();
+	}
+	pthread_mutex_unlock(&irqEnableLock);
+}
+
 /** @brief Set the local Avalon address for the PCIe txs port
 * 
 * For example, if the core is configured with an address translation table with the
@@ -139,7 +311,9 @@ uint32_t PcieCra::getIrqEnableMask()
 
 	* @param txs_addr Local Avalon Address of the txs area
 	* @param nbrOfEntries Number of table entries used to calculate the bit pattern
-	* @param pageSize size of each translation page (this is currently ignored, hard coded)
+	* @param pageSize size of each translation page, power of 2 from 4 KB to 4 GB
+	*
+	* The software copy of the translation table is invalidated.
  */
 PCIeMini_status PcieCra::setTxsAvlAddress(uint32_t txs_addr, uint64_t pageSize, uint16_t nbrOfEntries)
 {
@@ -174,19 +348,39 @@ PCIeMini_status PcieCra::setTxsAvlAddress(uint32_t txs_addr, uint64_t pageSize,
 		i /= 2;
 		ttNbrOfEntriesBits++;
 	}
+	invalidateTrEntries();
 	return ERRCODE_NO_ERROR;
 }
 
 /** @brief Calculate the DMA address through the txs
  * @param pcieAddress PCIe address of the PC memory
- * @param tableEntry entry number in the translation table
+ * @param tableEntry entry number in the translation table, -1 to search the table
  * @param localAddress Address to program in the DMA to access the txs port of the PCIe controller
+ * @retval ERRCODE_INVALID_VALUE if the entry does not map the page of pcieAddress.
  */
 PCIeMini_status PcieCra::getMappedAddress(uint64_t pcieAddress, int tableEntry, uint32_t* localAddress)
 {
+	uint64_t page = pcieAddress & ~(uint64_t)ttPageAddressMask;
+	int nbrOfEntries = getNbrOfTrEntries();
+
 	// compare mapping with the Address Translation Table
+	pthread_mutex_lock(&trLock);
+	if (tableEntry < 0) {
+		for (int i = 0; i < nbrOfEntries; i++) {
+			if (trState[i].valid && trState[i].pageAddress == page) {
+				tableEntry = i;
+				break;
+			}
+		}
+	}
+	bool found = tableEntry >= 0 && tableEntry < nbrOfEntries
+		&& trState[tableEntry].valid && trState[tableEntry].pageAddress == page;
+	pthread_mutex_unlock(&trLock);
 
 	// not found, return error
+	if (!found)
+		return ERRCODE_INVALID_VALUE;
+
 	// compose local address
 	uint32_t la = (uint32_t)pcieAddress & ttPageAddressMask;
 	la |= tableEntry << ttEntryOffset;
@@ -201,14 +395,147 @@ PCIeMini_status PcieCra::getMappedAddress(uint64_t pcieAddress, int tableEntry,
  * @param entryNbr Index of the entry to set up.
  * @param is64bitAddress True if the address of the target location is a 64-bit address
  * @param pcieAddress Address of the target location
+ * @retval ERRCODE_BUSY if the entry is pinned by a transfer mapped with mapPcieAddress().
 */
 
 int PcieCra::setTrEntry(int entryNbr, bool is64bitAddress, uint64_t pcieAddress)
 {
+	pthread_mutex_lock(&trLock);
+	if (entryNbr < maxTrEntries && trState[entryNbr].pinCount != 0) {
+		pthread_mutex_unlock(&trLock);
+		return ERRCODE_BUSY;
+	}
 	trEntry[entryNbr].setEntry((uint32_t)pcieAddress, (uint32_t)(pcieAddress >> 32), is64bitAddress);
+	if (entryNbr < maxTrEntries) {
+		trState[entryNbr].pageAddress = pcieAddress & ~(uint64_t)ttPageAddressMask;
+		trState[entryNbr].lastUse = ++trUseCounter;
+		trState[entryNbr].valid = true;
+	}
+	trWrites++;
+	pthread_mutex_unlock(&trLock);
 	return 0;
 }
 
+/** @brief Write an entry and its software copy, lock held */
+void PcieCra::writeTrEntry(int entryNbr, uint64_t pageAddress)
+{
+	trEntry[entryNbr].setEntry((uint32_t)pageAddress, (uint32_t)(pageAddress >> 32), true);
+	trState[entryNbr].pageAddress = pageAddress;
+	trState[entryNbr].valid = true;
+	trWrites++;
+}
+
+/** @brief Map a PCIe address in the txs window, reusing the translation entries
+ *
+ * When the page of pcieAddress is already in the table, the entry is reused and the CRA is
+ * not written. Otherwise the least recently used entry is reprogrammed. The mapping stays
+ * valid until getNbrOfTrEntries() other pages are mapped, so the caller must split a transfer
+ * in at most that many pages.
+ *
+ * The mapping ends at the end of the translation page: when mappedLength is less than length,
+ * the caller maps the rest of the transfer from pcieAddress + mappedLength.
+ *
+ * Callers queuing transfers ask for a pinned entry: it is not evicted until unpinTrEntry(),
+ * whatever the number of pages mapped in the meantime.
+ * @param pcieAddress PCIe address of the PC memory.
+ * @param length Length of the transfer in bytes.
+ * @param localAddress Receives the address to program in the DMA.
+ * @param mappedLength Receives the number of bytes reachable from localAddress, up to length.
+ * @param pinnedEntry When not NULL, the entry is pinned and its number is returned here.
+ * @return ERRCODE_BUSY when the page is not mapped and all the entries are pinned.
+ */
+PCIeMini_status PcieCra::mapPcieAddress(uint64_t pcieAddress, uint32_t length, uint32_t* localAddress, uint32_t* mappedLength,
+	int* pinnedEntry)
+{
+	uint64_t pageSize = (uint64_t)ttPageAddressMask + 1;
+	uint64_t page = pcieAddress & ~(uint64_t)ttPageAddressMask;
+	uint64_t inPage = pageSize - (pcieAddress - page);
+	int nbrOfEntries = getNbrOfTrEntries();
+	int entry = -1;
+	int lru = -1;
+
+	if (length == 0)
+		return ERRCODE_INVALID_VALUE;
+
+	pthread_mutex_lock(&trLock);
+	for (int i = 0; i < nbrOfEntries; i++) {
+		if (trState[i].valid && trState[i].pageAddress == page) {
+			entry = i;
+			break;
+		}
+		if (trState[i].pinCount != 0)
+			continue;
+		if (lru >= 0 && !trState[lru].valid)
+			continue;
+		if (lru < 0 || !trState[i].valid || trState[i].lastUse < trState[lru].lastUse)
+			lru = i;
+	}
+	if (entry >= 0)
+		trHits++;
+	else if (lru >= 0) {
+		entry = lru;
+		writeTrEntry(entry, page);
+	}
+	else {
+		pthread_mutex_unlock(&trLock);
+		return ERRCODE_BUSY;
+	}
+	trState[entry].lastUse = ++trUseCounter;
+	if (pinnedEntry) {
+		trState[entry].pinCount++;
+		*pinnedEntry = entry;
+	}
+	pthread_mutex_unlock(&trLock);
+
+	uint32_t la = (uint32_t)pcieAddress & ttPageAddressMask;
+	la |= entry << ttEntryOffset;
+	la += txs_AvlAddress;
+	*localAddress = la;
+	*mappedLength = (length < inPage) ? length : (uint32_t)inPage;
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Release an entry pinned by mapPcieAddress()
+ * @param entryNbr Entry number returned in pinnedEntry.
+ */
+void PcieCra::unpinTrEntry(int entryNbr)
+{
+	if (entryNbr < 0 || entryNbr >= maxTrEntries)
+		return;
+	pthread_mutex_lock(&trLock);
+	if (trState[entryNbr].pinCount > 0)
+		trState[entryNbr].pinCount--;
+	pthread_mutex_unlock(&trLock);
+}
+
+/** @brief Forget the content of the translation table
+ *
+ * To be called when the table may have been changed behind the manager, for example after a
+ * reset of the board. The next mappings reprogram the entries. The pins are kept.
+ */
+void PcieCra::invalidateTrEntries()
+{
+	pthread_mutex_lock(&trLock);
+	for (int i = 0; i < maxTrEntries; i++) {
+		trState[i].pageAddress = 0;
+		trState[i].lastUse = 0;
+		trState[i].valid = false;
+	}
+	pthread_mutex_unlock(&trLock);
+}
+
+/** @brief Return the translation table counters
+ * @param hits Number of mappings served without writing the CRA.
+ * @param writes Number of entries written to the CRA.
+ */
+void PcieCra::getTrStats(uint64_t* hits, uint64_t* writes)
+{
+	pthread_mutex_lock(&trLock);
+	*hits = trHits;
+	*writes = trWrites;
+	pthread_mutex_unlock(&trLock);
+}
+
 /** brief initialize a translation table entry */
 void PcieCra::TransEntry::setEntry(uint32_t lower, uint32_t upper, bool is64bitAddress)
 {
@@ -217,5 +544,4 @@ void PcieCra::TransEntry::setEntry(uint32_t lower, uint32_t upper, bool is64bitA
 		lower |= 1;
 	lower32 = lower;
 	upper32 = upper;
-	printf("setEntry: 0x%08x 0x%08x\n", upper, lower);
 }
@@ -0,0 +1,387 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file SimBackend.cpp
+* @brief Implementation of the simulated board backend
+*/
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#include "SimBackend.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+/** @brief Constructor
+ *
+ * @param vendorId PCI vendor identification reported by the simulated board.
+ * @param deviceId PCI device identification reported by the simulated board.
+ */
+SimBackend::SimBackend(uint16_t vendorId, uint16_t deviceId)
+{
+	pthread_mutexattr_t attr;
+
+	simVendorId = vendorId;
+	simDeviceId = deviceId;
+	for (int i = 0; i < nbrOfBars; i++) {
+		barSizes[i] = 0;
+		barMemory[i] = NULL;
+	}
+	barSizes[0] = defaultBar0Size;
+	barSizes[2] = defaultBar2Size;
+	isOpen = false;
+
+	sysIdSet = false;
+	sysIdVersion = 0;
+	sysIdTimeStamp = 0;
+
+	nbrOfModels = 0;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	irqFd = -1;
+	irqStarted = false;
+	irqSignaled = false;
+	irqLines = 0;
+	mailboxLatched = 0;
+	publishedStatus = 0;
+	signaledIrqCount = 0;
+
+	modelThread = 0;
+	modelThreadRunning = false;
+	modelThreadStop = false;
+	modelPeriodUs = 0;
+}
+
+/** @brief Destructor, releases the simulated BARs */
+SimBackend::~SimBackend()
+{
+	close();
+	pthread_mutex_destroy(&lock);
+}
+
+/** @brief Set the size of a simulated BAR, before the board is opened
+ *
+ * @param barNbr BAR number.
+ * @param size Size in bytes, rounded up to a page. 0 to remove the BAR.
+ * @retval ERRCODE_INVALID_VALUE if the BAR number is invalid, ERRCODE_BUSY if the board is open.
+ */
+PCIeMini_status SimBackend::setBarSize(int barNbr, size_t size)
+{
+	size_t page = getpagesize();
+
+	if (barNbr < 0 || barNbr >= nbrOfBars)
+		return ERRCODE_INVALID_VALUE;
+	if (isOpen)
+		return ERRCODE_BUSY;
+	barSizes[barNbr] = (size + page - 1) & ~(page - 1);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Set the content of the system identification component at the beginning of BAR 2
+ * @param version Board type and version.
+ * @param timeStamp Firmware time stamp.
+ */
+void SimBackend::setSysId(uint32_t version, uint32_t timeStamp)
+{
+	sysIdSet = true;
+	sysIdVersion = version;
+	sysIdTimeStamp = timeStamp;
+}
+
+/** @brief Add a register behaviour model
+ * @param model Model, owned by the caller, must stay valid while the board is open.
+ * @retval ERRCODE_INVALID_VALUE if there are already maxModels models.
+ */
+PCIeMini_status SimBackend::addRegisterModel(SimRegisterModel* model)
+{
+	PCIeMini_status status = ERRCODE_NO_ERROR;
+
+	pthread_mutex_lock(&lock);
+	if (nbrOfModels >= maxModels)
+		status = ERRCODE_INVALID_VALUE;
+	else
+		models[nbrOfModels++] = model;
+	pthread_mutex_unlock(&lock);
+	return status;
+}
+
+/** @brief Run the models periodically in a thread of the simulator
+ *
+ * Takes effect when the board is opened.
+ * @param periodUs Period in microseconds, 0 for no thread (default.)
+ */
+void SimBackend::setModelPeriod(uint32_t periodUs)
+{
+	modelPeriodUs = periodUs;
+}
+
+/** @brief Return a pointer to a 32-bit register of a simulated BAR
+ * @retval NULL if the board is not open or the offset is out of the BAR.
+ */
+volatile uint32_t* SimBackend::getBarRegister(int barNbr, size_t offset)
+{
+	if (barNbr < 0 || barNbr >= nbrOfBars || barMemory[barNbr] == NULL || offset + 4 > barSizes[barNbr])
+		return NULL;
+	return (volatile uint32_t*)((uint8_t*)barMemory[barNbr] + offset);
+}
+
+/** @brief Publish the interrupt state in the CRA status register, lock held
+ *
+ * A value different from the last one published means that the driver wrote the register
+ * to acknowledge mailbox interrupts (RW1C.)
+ */
+void SimBackend::syncCraStatus(void)
+{
+	volatile uint32_t* status = getBarRegister(0, craIrqStatus_offset);
+	if (status == NULL)
+		return;
+
+	uint32_t current = *status;
+	if (current != publishedStatus)
+		mailboxLatched &= ~(current & a2pMailboxIrqMask);
+
+	publishedStatus = irqLines | mailboxLatched | statusTag;
+	*status = publishedStatus;
+}
+
+/** @brief Wake up the interrupt thread if an enabled source is pending, lock held */
+void SimBackend::signalIfPending(void)
+{
+	volatile uint32_t* enable = getBarRegister(0, craIrqEnable_offset);
+	uint64_t one = 1;
+
+	if (!irqStarted || irqSignaled || enable == NULL)
+		return;
+	if ((publishedStatus & *enable & (avlIrqMask | a2pMailboxIrqMask)) == 0)
+		return;
+
+	irqSignaled = true;
+	signaledIrqCount++;
+	if (write(irqFd, &one, sizeof(one)) != sizeof(one))
+		perror("sim eventfd write:");
+}
+
+/** @brief Run the register models and update the interrupt state */
+void SimBackend::runModels(void)
+{
+	pthread_mutex_lock(&lock);
+	if (isOpen) {
+		for (int i = 0; i < nbrOfModels; i++)
+			models[i]->update(this);
+		syncCraStatus();
+		signalIfPending();
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/** @brief Assert interrupt sources
+ *
+ * The Avalon lines stay asserted until clearIrq(); the mailbox interrupts stay latched until
+ * the driver acknowledges them.
+ * @param mask Bit map in the CRA interrupt status register format.
+ */
+void SimBackend::injectIrq(uint32_t mask)
+{
+	pthread_mutex_lock(&lock);
+	irqLines |= mask & avlIrqMask;
+	mailboxLatched |= mask & a2pMailboxIrqMask;
+	syncCraStatus();
+	signalIfPending();
+	pthread_mutex_unlock(&lock);
+}
+
+/** @brief Deassert Avalon interrupt lines
+ * @param mask Bit map of the lines, in the CRA interrupt status register format.
+ */
+void SimBackend::clearIrq(uint32_t mask)
+{
+	pthread_mutex_lock(&lock);
+	irqLines &= ~(mask & avlIrqMask);
+	syncCraStatus();
+	pthread_mutex_unlock(&lock);
+}
+
+void* SimBackend::modelThreadEntry(void* arg)
+{
+	SimBackend* sim = (SimBackend*)arg;
+
+	while (!sim->modelThreadStop) {
+		sim->runModels();
+		usleep(sim->modelPeriodUs);
+	}
+	return NULL;
+}
+
+/** @brief Create the simulated BARs
+ *
+ * @param brdNbr Ignored.
+ * @param vendorId Expected PCI vendor identification.
+ * @param deviceId Expected PCI device identification.
+ * @retval ERRCODE_INVALID_BOARD_NUM if the identification does not match the simulated board.
+ */
+PCIeMini_status SimBackend::open(int brdNbr, uint16_t vendorId, uint16_t deviceId)
+{
+	if (vendorId != simVendorId || deviceId != simDeviceId) {
+		fprintf(stderr, "Simulated board is 0x%04x/0x%04x, not 0x%04x/0x%04x\n", simVendorId, simDeviceId, vendorId, deviceId);
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+	if (isOpen)
+		return ERRCODE_BUSY;
+
+	for (int i = 0; i < nbrOfBars; i++) {
+		if (barSizes[i] == 0)
+			continue;
+		barMemory[i] = mmap(NULL, barSizes[i], PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (barMemory[i] == MAP_FAILED) {
+			barMemory[i] = NULL;
+			perror("sim bar mmap:");
+			close();
+			return ERRCODE_INTERNAL_ERROR;
+		}
+	}
+
+	irqFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (irqFd < 0) {
+		perror("sim eventfd:");
+		close();
+		return ERRCODE_INTERNAL_ERROR;
+	}
+
+	isOpen = true;
+	if (sysIdSet && getBarRegister(2, 4) != NULL) {
+		*getBarRegister(2, 0) = sysIdVersion;
+		*getBarRegister(2, 4) = sysIdTimeStamp;
+	}
+	pthread_mutex_lock(&lock);
+	syncCraStatus();
+	pthread_mutex_unlock(&lock);
+
+	if (modelPeriodUs != 0) {
+		modelThreadStop = false;
+		if (pthread_create(&modelThread, NULL, &modelThreadEntry, (void*)this) == 0)
+			modelThreadRunning = true;
+		else
+			printf("can't create the simulator model thread\n");
+	}
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Release the simulated BARs */
+PCIeMini_status SimBackend::close(void)
+{
+	if (modelThreadRunning) {
+		modelThreadStop = true;
+		pthread_join(modelThread, NULL);
+		modelThreadRunning = false;
+	}
+
+	pthread_mutex_lock(&lock);
+	isOpen = false;
+	irqStarted = false;
+	irqSignaled = false;
+	for (int i = 0; i < nbrOfBars; i++) {
+		if (barMemory[i] != NULL) {
+			munmap(barMemory[i], barSizes[i]);
+			barMemory[i] = NULL;
+		}
+	}
+	if (irqFd >= 0) {
+		::close(irqFd);
+		irqFd = -1;
+	}
+	pthread_mutex_unlock(&lock);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return the size of a simulated BAR */
+size_t SimBackend::getBarSize(int barNbr)
+{
+	if (barNbr < 0 || barNbr >= nbrOfBars)
+		return 0;
+	return barSizes[barNbr];
+}
+
+/** @brief Return the memory of a simulated BAR, it stays allocated until close()
+ *
+ * The simulated BARs are ordinary memory, writeCombined is ignored.
+ */
+void* SimBackend::mapBar(int barNbr, bool writeCombined, bool* isWriteCombined)
+{
+	if (isWriteCombined != NULL)
+		*isWriteCombined = false;
+	if (barNbr < 0 || barNbr >= nbrOfBars)
+		return NULL;
+	return barMemory[barNbr];
+}
+
+/** @brief Nothing to do, the memory is released by close() */
+void SimBackend::unmapBar(int barNbr, void* address, size_t length)
+{
+}
+
+/** @brief Consume the interrupt signal
+ * @param count Number of interrupts signaled since the board was opened.
+ */
+PCIeMini_status SimBackend::readIrqCount(uint32_t* count)
+{
+	uint64_t value;
+
+	pthread_mutex_lock(&lock);
+	if (read(irqFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+		pthread_mutex_unlock(&lock);
+		perror("sim eventfd read:");
+		return ERRCODE_INTERNAL_ERROR;
+	}
+	irqSignaled = false;
+	*count = (uint32_t)signaledIrqCount;
+	syncCraStatus();
+	pthread_mutex_unlock(&lock);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Start delivering the simulated interrupts */
+PCIeMini_status SimBackend::startIrq(IrqRearmMode request)
+{
+	pthread_mutex_lock(&lock);
+	irqStarted = true;
+	signalIfPending();
+	pthread_mutex_unlock(&lock);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Re-enable the interrupt, signals again if an enabled source is still pending (INTx level) */
+PCIeMini_status SimBackend::rearmIrq(void)
+{
+	runModels();
+	return ERRCODE_NO_ERROR;
+}
@@ -0,0 +1,157 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file SpiCompletion.cpp
+* @brief Interrupt wait and CPU accounting shared by the SPI controllers
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <stdio.h>
+#include <time.h>
+#include "SpiCompletion.h"
+#include "LatencyHistogram.h"
+
+SpiCompletion::SpiCompletion()
+{
+	pthread_condattr_t attr;
+
+	useIrq = false;
+	statsEnabled = false;
+	measuring = false;
+	minIrqWords = defaultMinIrqWords;
+	irqSeq = 0;
+	transferStartNs = 0;
+	clearStats();
+	pthread_mutex_init(&lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+SpiCompletion::~SpiCompletion()
+{
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+/** @brief Select the completion mode
+ * @param irqMode When true, the transfers of at least minWords words sleep on the interrupt. The
+ *		interrupt handler of the controller must be hooked on its interrupt line.
+ * @param minWords Shortest transfer waited for by interrupt.
+ */
+void SpiCompletion::setIrqMode(bool irqMode, uint32_t minWords)
+{
+	useIrq = irqMode;
+	minIrqWords = minWords;
+}
+
+/** @brief Take the sequence number before enabling the interrupt source */
+uint32_t SpiCompletion::arm()
+{
+	return __atomic_load_n(&irqSeq, __ATOMIC_ACQUIRE);
+}
+
+/** @brief Sleep until signal() is called after arm()
+ * @param seq Value returned by arm().
+ * @param timeoutUs Longest sleep.
+ * @return false after timeoutUs without interrupt.
+ */
+bool SpiCompletion::wait(uint32_t seq, uint32_t timeoutUs)
+{
+	uint64_t deadline = LatencyHistogram::getTimeNs() + (uint64_t)timeoutUs * 1000;
+	struct timespec ts;
+	bool signaled = true;
+
+	ts.tv_sec = (time_t)(deadline / 1000000000);
+	ts.tv_nsec = (long)(deadline % 1000000000);
+
+	pthread_mutex_lock(&lock);
+	irqWaits++;
+	while (irqSeq == seq) {
+		if (pthread_cond_timedwait(&cond, &lock, &ts) != 0 && irqSeq == seq) {
+			irqTimeouts++;
+			signaled = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return signaled;
+}
+
+/** @brief Wake up the waiter, called by the interrupt handler of the controller */
+void SpiCompletion::signal()
+{
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&irqSeq, irqSeq + 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+uint64_t SpiCompletion::getThreadCpuNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** @brief Account the CPU time of the transfer started by beginTransfer() */
+void SpiCompletion::accountTransfer(uint32_t words, bool irq)
+{
+	uint64_t cpu = getThreadCpuNs() - transferStartNs;
+
+	if (irq) {
+		irqWords += words;
+		irqCpuNs += cpu;
+	}
+	else {
+		polledWords += words;
+		polledCpuNs += cpu;
+	}
+}
+
+void SpiCompletion::clearStats()
+{
+	polledWords = 0;
+	polledCpuNs = 0;
+	irqWords = 0;
+	irqCpuNs = 0;
+	irqWaits = 0;
+	irqTimeouts = 0;
+}
+
+void SpiCompletion::printStats(const char* title)
+{
+	if (title)
+		printf("\n%s\n", title);
+	printf("polled:    %llu words, %.1f ns CPU per word\n", (unsigned long long)polledWords,
+		polledWords ? (double)polledCpuNs / polledWords : 0.0);
+	printf("interrupt: %llu words, %.1f ns CPU per word, %llu sleeps, %llu timeouts (%u words and more)\n",
+		(unsigned long long)irqWords, irqWords ? (double)irqCpuNs / irqWords : 0.0,
+		(unsigned long long)irqWaits, (unsigned long long)irqTimeouts, minIrqWords);
+}
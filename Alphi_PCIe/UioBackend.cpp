@@ -0,0 +1,404 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file UioBackend.cpp
+* @brief Implementation of the board access through the Linux UIO driver
+*/
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#include "UioBackend.h"
+#include "UioEnumerator.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <dirent.h>
+
+/** @brief Constructor, the board is opened by open() */
+UioBackend::UioBackend()
+{
+	brdNumber = 0;
+	uiofd = -1;
+	configfd = -1;
+	for (int i = 0; i < nbrOfBars; i++)
+		uioBarSizes[i] = 0;
+	uioDev[0] = 0;
+	uioName[0] = 0;
+	uioVersion[0] = 0;
+	irqRearmMode = IRQ_REARM_AUTO;
+	commandHigh = 0;
+}
+
+/** @brief Destructor, closes the files left open */
+UioBackend::~UioBackend()
+{
+	close();
+}
+
+/** @brief Utility function to read an UIO config file containing a string
+ *
+ * @retval return an error number or 0.
+ */
+int UioBackend::readConfigString(char *data, int *len, const char *name)
+{
+	int infoFn;
+	int l;
+	char filename[100];
+
+	sprintf(filename, "/sys/class/uio/uio%d/%s", brdNumber, name);
+	infoFn = ::open(filename, O_RDWR);
+	if (infoFn < 0) {
+		perror("Cannot get uio dev info:");
+		return errno;
+	}
+	l = read(infoFn, data, *len - 1);
+	data[l] = 0;
+	*len = l;
+	return ::close(infoFn);
+}
+
+int UioBackend::readConfigHex(const char *name)
+{
+	int infoFn;
+	int l;
+	char filename[100];
+	char dataString[100];
+	int data;
+
+	sprintf(filename, "/sys/class/uio/uio%d/%s", brdNumber, name);
+	infoFn = ::open(filename, O_RDWR);
+	if (infoFn < 0) {
+		perror("Cannot get uio dev info:");
+		return errno;
+	}
+	l = read(infoFn, dataString, sizeof(dataString) - 1);
+	dataString[l] = 0;
+	sscanf(dataString, "%x", &data);
+	::close(infoFn);
+	return data;
+}
+
+int UioBackend::readUioResource()
+{
+	char filename[100];
+	int nbrBarsRead = 0;
+	uint64_t startAddr, endAddr, other;
+
+	sprintf(filename, "/sys/class/uio/uio%d/device/resource", brdNumber);
+	FILE *fp = fopen (filename, "r");
+	if (fp == NULL) {
+		perror("Cannot get uio dev info:");
+		return nbrBarsRead;
+	}
+
+	for (int i=0; i<nbrOfBars; i++)
+	{
+		fscanf(fp,"%lx %lx %lx\n", &startAddr, &endAddr, &other);
+		if (startAddr != 0) {
+			uioBarSizes[i] = endAddr - startAddr + 1;
+			nbrBarsRead++;
+		}
+		else
+			uioBarSizes[i] = 0;
+	}
+	fclose(fp);
+	return nbrBarsRead;
+}
+
+/** @brief Open a board using the UIO interface
+ *
+	@param brdNbr the UIO device number.
+	@param vendorId Expected PCI vendor identification.
+	@param deviceId Expected PCI device identification.
+	@return ERRCODE_INVALID_BOARD_NUM if there is no board corresponding to the number
+*/
+PCIeMini_status UioBackend::open(int brdNbr, uint16_t vendorId, uint16_t deviceId)
+{
+	char filename[100];
+	int i;
+
+	brdNumber = brdNbr;
+
+	// Check the identification against the enumeration table before opening anything
+	const UioBoardInfo* info = UioEnumerator::getInstance()->findByUio(brdNbr);
+	if (info != NULL && (info->vendorId != vendorId || info->deviceId != deviceId)) {
+		fprintf(stderr, "Invalid PCI ID: 0x%04x/0x%04x (should be 0x%04x/0x%04x)\n",
+			info->vendorId, info->deviceId, vendorId, deviceId);
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+
+	// Try to open the basic files
+	sprintf(filename, "/dev/uio%d", brdNbr);
+ 	printf("\n");
+	uiofd = ::open(filename, O_RDWR);
+	if (uiofd < 0) {
+		perror("dev uio open:");
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+
+	sprintf(filename, "/sys/class/uio/uio%d/device/config", brdNbr);
+	configfd = ::open(filename, O_RDWR);
+	if (configfd < 0) {
+		perror("config open:");
+		close();
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+
+	// Get board information from UIO
+	int l = sizeof(uioDev);
+	readConfigString(uioDev, &l, "dev");
+	l = sizeof(uioName);
+	readConfigString(uioName, &l, "name");
+	l = sizeof(uioVersion);
+	readConfigString(uioVersion, &l, "version");
+
+	if (info != NULL) {
+		for (i = 0, l = 0; i < nbrOfBars; i++) {
+			uioBarSizes[i] = info->barSizes[i];
+			if (uioBarSizes[i] != 0)
+				l++;
+		}
+		printf("%d BARs found: Bar #0 size = 0x%lx, Bar #2 size = 0x%lx\n", l, uioBarSizes[0], uioBarSizes[2]);
+		return ERRCODE_SUCCESS;
+	}
+
+	// Not in the enumeration table: read and check the sysfs files one by one
+	l = readUioResource();
+	printf("%d BARs found: Bar #0 size = 0x%lx, Bar #2 size = 0x%lx\n", l, uioBarSizes[0], uioBarSizes[2]);
+
+	i = readConfigHex("device/vendor");
+	if ((uint16_t)i != vendorId) {
+		fprintf(stderr, "Invalid PCI manufacturer ID: 0x%04x (should be 0x%04x)\n", i, vendorId);
+		close();
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+
+	i = readConfigHex("device/device");
+	if ((uint16_t)i != deviceId) {
+		fprintf(stderr, "Invalid PCI device ID: 0x%04x (should be 0x%04x)\n", i, deviceId);
+		close();
+		return ERRCODE_INVALID_BOARD_NUM;
+	}
+
+	return ERRCODE_SUCCESS;
+}
+
+/** @brief Close the UIO files */
+PCIeMini_status UioBackend::close(void)
+{
+	if (configfd >= 0) {
+		::close(configfd);
+		configfd = -1;
+	}
+	if (uiofd >= 0) {
+		::close(uiofd);
+		uiofd = -1;
+	}
+	irqRearmMode = IRQ_REARM_AUTO;
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return the size of a BAR, as found in the sysfs resource file */
+size_t UioBackend::getBarSize(int barNbr)
+{
+	if (barNbr < 0 || barNbr >= nbrOfBars)
+		return 0;
+	return uioBarSizes[barNbr];
+}
+
+/** @brief Map a BAR through its sysfs resource file
+ *
+ * A write-combined mapping uses the resourceN_wc file. The kernel only provides it for the
+ * prefetchable BARs; for the others the BAR is mapped uncached.
+ * @param barNbr BAR number.
+ * @param writeCombined Request a write-combined mapping.
+ * @param isWriteCombined If not NULL, receives true if the mapping is write-combined.
+ * @retval Address of the mapping, NULL if the BAR does not exist or cannot be mapped.
+ */
+void* UioBackend::mapBar(int barNbr, bool writeCombined, bool* isWriteCombined)
+{
+	char filename[100];
+	void* addr;
+	int fd = -1;
+
+	if (isWriteCombined != NULL)
+		*isWriteCombined = false;
+	if (getBarSize(barNbr) == 0)
+		return NULL;
+
+	if (writeCombined) {
+		sprintf(filename, "/sys/class/uio/uio%d/device/resource%d_wc", brdNumber, barNbr);
+		fd = ::open(filename, O_RDWR);
+		if (fd < 0)
+			fprintf(stderr, "bar %d: no write-combined mapping, using an uncached one\n", barNbr);
+		else if (isWriteCombined != NULL)
+			*isWriteCombined = true;
+	}
+	if (fd < 0) {
+		sprintf(filename, "/sys/class/uio/uio%d/device/resource%d", brdNumber, barNbr);
+		fd = ::open(filename, O_RDWR);
+		if (fd < 0) {
+			fprintf(stderr, "sys resource %d open: %s\n", barNbr, strerror(errno));
+			return NULL;
+		}
+	}
+
+	/* The offset selects the part of the resource to map; the whole BAR is mapped.
+	   The mapping keeps its own reference to the file, which can be closed right away. */
+	addr = mmap(NULL, uioBarSizes[barNbr], PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "bar %d mmap: %s\n", barNbr, strerror(errno));
+		if (isWriteCombined != NULL)
+			*isWriteCombined = false;
+		return NULL;
+	}
+	return addr;
+}
+
+/** @brief Unmap a BAR
+ * @param length Length of the mapping, as returned by getBarSize().
+ */
+void UioBackend::unmapBar(int barNbr, void* address, size_t length)
+{
+	if (address != NULL && length != 0)
+		munmap(address, length);
+}
+
+
+/** @brief Read the interrupt count from the UIO device */
+PCIeMini_status UioBackend::readIrqCount(uint32_t* count)
+{
+	if (read(uiofd, count, 4) != 4) {
+		perror("uio read:");
+		return ERRCODE_INTERNAL_ERROR;
+	}
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Detect whether the UIO driver delivers the interrupts with MSI
+ *
+ * @retval true when the PCI device has MSI or MSI-X vectors allocated.
+ */
+bool UioBackend::isMsiActive(void)
+{
+	char filename[100];
+	bool found = false;
+
+	sprintf(filename, "/sys/class/uio/uio%d/device/msi_irqs", brdNumber);
+	DIR* dir = opendir(filename);
+	if (dir == NULL)
+		return false;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.') {
+			found = true;
+			break;
+		}
+	}
+	closedir(dir);
+	return found;
+}
+
+/** @brief Select the interrupt re-arm method and enable the interrupts
+ *
+ * In automatic mode, the methods are tried in order of cost:
+ * - MSI: the interrupt is not masked by the kernel, there is nothing to do.
+ * - UIO irqcontrol: write(uiofd, 1) unmasks the INTx line from the driver.
+ * - PCI config: the INTx disable bit of the command register is cleared through sysfs.
+ * @param request Requested method.
+ * @retval ERRCODE_INTERNAL_ERROR if the interrupts cannot be enabled at all.
+ */
+PCIeMini_status UioBackend::startIrq(IrqRearmMode request)
+{
+	IrqRearmMode mode = request;
+	uint32_t one = 1;
+
+	if (mode == IRQ_REARM_AUTO || mode == IRQ_REARM_MSI) {
+		if (isMsiActive()) {
+			irqRearmMode = IRQ_REARM_MSI;
+			return ERRCODE_NO_ERROR;
+		}
+		if (mode == IRQ_REARM_MSI)
+			printf("MSI not enabled by the UIO driver, using INTx\n");
+		mode = IRQ_REARM_UIO;
+	}
+
+	if (mode == IRQ_REARM_UIO) {
+		if (write(uiofd, &one, sizeof(one)) == sizeof(one)) {
+			irqRearmMode = IRQ_REARM_UIO;
+			return ERRCODE_NO_ERROR;
+		}
+		// ENOSYS: the driver does not implement irqcontrol
+		if (request == IRQ_REARM_UIO)
+			perror("uio irqcontrol:");
+	}
+
+	/* Read and cache command value */
+	if (pread(configfd, &commandHigh, 1, 5) != 1) {
+		perror("command config read:");
+		return ERRCODE_INTERNAL_ERROR;
+	}
+	commandHigh &= ~0x4;
+	irqRearmMode = IRQ_REARM_CONFIG;
+
+	return rearmIrq();
+}
+
+/** @brief Re-enable the interrupt after it has been served
+ *
+ * @retval ERRCODE_INTERNAL_ERROR if the driver refused the operation.
+ */
+PCIeMini_status UioBackend::rearmIrq(void)
+{
+	uint32_t one = 1;
+
+	switch (irqRearmMode) {
+	case IRQ_REARM_MSI:
+		break;
+	case IRQ_REARM_UIO:
+		if (write(uiofd, &one, sizeof(one)) != sizeof(one)) {
+			perror("uio irqcontrol:");
+			return ERRCODE_INTERNAL_ERROR;
+		}
+		break;
+	default:
+		if (pwrite(configfd, &commandHigh, 1, 5) != 1) {
+			perror("config write:");
+			return ERRCODE_INTERNAL_ERROR;
+		}
+		break;
+	}
+	return ERRCODE_NO_ERROR;
+}
@@ -0,0 +1,344 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file UioEnumerator.cpp
+* @brief Implementation of the discovery of the Alphi boards handled by the UIO driver
+*/
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#include "UioEnumerator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/** @brief Return the process-wide board table */
+UioEnumerator* UioEnumerator::getInstance()
+{
+	static UioEnumerator instance;
+	return &instance;
+}
+
+UioEnumerator::UioEnumerator()
+{
+	scanned = false;
+	nbrOfBoards = 0;
+	memset(boards, 0, sizeof(boards));
+	pthread_mutex_init(&lock, NULL);
+}
+
+/** @brief Read a sysfs file containing an hexadecimal value
+ * @retval 0 if successful, -1 otherwise.
+ */
+int UioEnumerator::readSysfsHex(const char* path, uint32_t* value)
+{
+	char data[32];
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	int l = read(fd, data, sizeof(data) - 1);
+	close(fd);
+	if (l <= 0)
+		return -1;
+	data[l] = 0;
+	*value = strtoul(data, NULL, 16);
+	return 0;
+}
+
+/** @brief Read the sysid component at the beginning of BAR 2 */
+void UioEnumerator::readSysid(int uioNbr, UioBoardInfo* info)
+{
+	char path[100];
+	size_t page = getpagesize();
+
+	if (info->barSizes[2] < 8)
+		return;
+	sprintf(path, "/sys/class/uio/uio%d/device/resource2", uioNbr);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	void* addr = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+	if (addr != MAP_FAILED) {
+		volatile uint32_t* sysid = (volatile uint32_t*)addr;
+		info->sysidVersion = sysid[0];
+		info->sysidTimeStamp = sysid[1];
+		munmap(addr, page);
+	}
+	close(fd);
+}
+
+/** @brief Read the PCIe Device Serial Number extended capability
+ * @retval Serial number, 0 if the capability is absent or the extended configuration space is not readable.
+ */
+uint64_t UioEnumerator::readSerialNumber(int uioNbr)
+{
+	char path[100];
+	uint32_t header;
+	uint32_t dsn[2];
+	uint64_t serial = 0;
+	int offset = 0x100;
+
+	sprintf(path, "/sys/class/uio/uio%d/device/config", uioNbr);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	// walk the extended capability list, 48 entries at most
+	for (int i = 0; i < 48 && offset >= 0x100; i++) {
+		if (pread(fd, &header, 4, offset) != 4 || header == 0 || header == 0xffffffff)
+			break;
+		if ((header & 0xffff) == 0x0003) {		// Device Serial Number
+			if (pread(fd, dsn, 8, offset + 4) == 8)
+				serial = ((uint64_t)dsn[1] << 32) | dsn[0];
+			break;
+		}
+		offset = header >> 20;
+	}
+	close(fd);
+	return serial;
+}
+
+/** @brief Read everything about one UIO device
+ * @retval true if the device is a PCI device.
+ */
+bool UioEnumerator::readBoard(int uioNbr, UioBoardInfo* info)
+{
+	char path[100];
+	char link[256];
+	uint32_t value;
+
+	memset(info, 0, sizeof(*info));
+	info->uioNbr = uioNbr;
+
+	sprintf(path, "/sys/class/uio/uio%d/device/vendor", uioNbr);
+	if (readSysfsHex(path, &value) != 0)
+		return false;
+	info->vendorId = (uint16_t)value;
+	sprintf(path, "/sys/class/uio/uio%d/device/device", uioNbr);
+	if (readSysfsHex(path, &value) != 0)
+		return false;
+	info->deviceId = (uint16_t)value;
+
+	sprintf(path, "/sys/class/uio/uio%d/device", uioNbr);
+	int l = readlink(path, link, sizeof(link) - 1);
+	if (l > 0) {
+		link[l] = 0;
+		const char* name = strrchr(link, '/');
+		name = (name != NULL) ? name + 1 : link;
+		snprintf(info->slot, sizeof(info->slot), "%.*s", (int)sizeof(info->slot) - 1, name);
+	}
+
+	sprintf(path, "/sys/class/uio/uio%d/device/resource", uioNbr);
+	FILE* fp = fopen(path, "r");
+	if (fp != NULL) {
+		unsigned long long startAddr, endAddr, flags;
+		for (int i = 0; i < 8; i++) {
+			if (fscanf(fp, "%llx %llx %llx\n", &startAddr, &endAddr, &flags) != 3)
+				break;
+			info->barSizes[i] = (startAddr != 0) ? (size_t)(endAddr - startAddr + 1) : 0;
+		}
+		fclose(fp);
+	}
+	return true;
+}
+
+/** @brief Scan /sys/class/uio and rebuild the table
+ * @retval Number of Alphi boards found.
+ */
+int UioEnumerator::rescan(void)
+{
+	pthread_mutex_lock(&lock);
+	int n = scan();
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+/** @brief Rebuild the table, called with the lock held */
+int UioEnumerator::scan(void)
+{
+	DIR* dir;
+	struct dirent* entry;
+	int uioNbr;
+
+	nbrOfBoards = 0;
+	dir = opendir("/sys/class/uio");
+	if (dir != NULL) {
+		while ((entry = readdir(dir)) != NULL && nbrOfBoards < maxBoards) {
+			if (sscanf(entry->d_name, "uio%d", &uioNbr) != 1)
+				continue;
+			UioBoardInfo* info = &boards[nbrOfBoards];
+			if (!readBoard(uioNbr, info) || info->vendorId != alphiVendorId)
+				continue;
+			readSysid(uioNbr, info);
+			info->serialNumber = readSerialNumber(uioNbr);
+			nbrOfBoards++;
+		}
+		closedir(dir);
+	}
+
+	// keep the table sorted by UIO number, readdir() order is arbitrary
+	for (int i = 1; i < nbrOfBoards; i++) {
+		UioBoardInfo tmp = boards[i];
+		int j = i - 1;
+		while (j >= 0 && boards[j].uioNbr > tmp.uioNbr) {
+			boards[j + 1] = boards[j];
+			j--;
+		}
+		boards[j + 1] = tmp;
+	}
+	scanned = true;
+	return nbrOfBoards;
+}
+
+/** @brief Lock the table, scanning it the first time it is used. The caller unlocks it */
+void UioEnumerator::lockTable(void)
+{
+	pthread_mutex_lock(&lock);
+	if (!scanned)
+		scan();
+}
+
+/** @brief Return the number of Alphi boards in the table */
+int UioEnumerator::getNbrOfBoards(void)
+{
+	lockTable();
+	int n = nbrOfBoards;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+/** @brief Return a board of the table
+ * @param index Index in the table, from 0 to getNbrOfBoards() - 1.
+ * @retval NULL if the index is out of range. The description is valid until the next rescan().
+ */
+const UioBoardInfo* UioEnumerator::getBoard(int index)
+{
+	const UioBoardInfo* info = NULL;
+
+	lockTable();
+	if (index >= 0 && index < nbrOfBoards)
+		info = &boards[index];
+	pthread_mutex_unlock(&lock);
+	return info;
+}
+
+/** @brief Return the description of a UIO device, NULL if it is not an Alphi board
+ *
+ * The description is valid until the next rescan().
+ */
+const UioBoardInfo* UioEnumerator::findByUio(int uioNbr)
+{
+	const UioBoardInfo* info = NULL;
+
+	lockTable();
+	for (int i = 0; i < nbrOfBoards; i++)
+		if (boards[i].uioNbr == uioNbr) {
+			info = &boards[i];
+			break;
+		}
+	pthread_mutex_unlock(&lock);
+	return info;
+}
+
+/** @brief Find a board by PCI address
+ * @param slot PCI address, with or without the domain ("0000:03:00.0" or "03:00.0".)
+ * @retval Board number, -1 if not found.
+ */
+int UioEnumerator::findBySlot(const char* slot)
+{
+	int uioNbr = -1;
+
+	lockTable();
+	for (int i = 0; i < nbrOfBoards; i++) {
+		// the whole address, or the address without the domain
+		const char* bus = strchr(boards[i].slot, ':');
+		if (strcmp(boards[i].slot, slot) == 0 || (bus != NULL && strcmp(bus + 1, slot) == 0)) {
+			uioNbr = boards[i].uioNbr;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return uioNbr;
+}
+
+/** @brief Find a board by PCIe Device Serial Number
+ * @retval Board number, -1 if not found.
+ */
+int UioEnumerator::findBySerial(uint64_t serialNumber)
+{
+	int uioNbr = -1;
+
+	if (serialNumber == 0)
+		return -1;
+	lockTable();
+	for (int i = 0; i < nbrOfBoards; i++)
+		if (boards[i].serialNumber == serialNumber) {
+			uioNbr = boards[i].uioNbr;
+			break;
+		}
+	pthread_mutex_unlock(&lock);
+	return uioNbr;
+}
+
+/** @brief Find a board by type
+ * @param sysidVersion Board type, as returned by getFpgaID().
+ * @param instance 0 for the first board of this type, in UIO number order, 1 for the second...
+ * @retval Board number, -1 if not found.
+ */
+int UioEnumerator::findByType(uint32_t sysidVersion, int instance)
+{
+	int uioNbr = -1;
+
+	lockTable();
+	for (int i = 0; i < nbrOfBoards; i++)
+		if (boards[i].sysidVersion == sysidVersion && instance-- == 0) {
+			uioNbr = boards[i].uioNbr;
+			break;
+		}
+	pthread_mutex_unlock(&lock);
+	return uioNbr;
+}
+
+/** @brief Print the table on the console */
+void UioEnumerator::print(void)
+{
+	lockTable();
+	printf("%d Alphi board(s) found\n", nbrOfBoards);
+	for (int i = 0; i < nbrOfBoards; i++) {
+		UioBoardInfo* b = &boards[i];
+		time_t ts = b->sysidTimeStamp;
+		printf("uio%d %s 0x%04x/0x%04x type 0x%08x serial 0x%016llx bar0 0x%lx bar2 0x%lx bar3 0x%lx %s",
+			b->uioNbr, b->slot, b->vendorId, b->deviceId, b->sysidVersion,
+			(unsigned long long)b->serialNumber, b->barSizes[0], b->barSizes[2], b->barSizes[3], ctime(&ts));
+	}
+	pthread_mutex_unlock(&lock);
+}
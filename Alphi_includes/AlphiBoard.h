@@ -40,6 +40,10 @@
 #include "AlphiDll.h"
 #include "PcieCra.h"
 #include "AlteraDma.h"
+#include "LatencyHistogram.h"
+#include "ParallelInput.h"
+#include "BoardBackend.h"
+#include "DmaBufferProvider.h"
 
 //typedef void * WDC_DEVICE_HANDLE;
 #define ErrLog printf
@@ -52,6 +56,7 @@ typedef void (*MINIPCIE_INT_HANDLER)(void *pIntData);
 typedef struct LinearAddress {
 	void* Address;			///< Linear address.
 	size_t   Length;		///< Length of the mapping.
+	bool WriteCombined;		///< True when the mapping is write-combined
 } LinearAddress;
 
 /** @brief Board Hardware identification and version */
@@ -67,13 +72,36 @@ private:
 
 #define CLOCK_REALTIME 0
 
+/** @brief Interrupt latency statistics of a board, in nanoseconds */
+typedef struct IrqLatencyStats {
+	LatencyHistogram wakeToDispatch;	///< From the UIO read() returning to the call of the first handler
+	LatencyHistogram handlerTime;		///< From the call of the first handler to the exit of the last one
+	LatencyHistogram wakeToExit;		///< From the UIO read() returning to the exit of the last handler
+	LatencyHistogram threadWake;		///< Wake up latency of the interrupt thread, see measureIrqThreadWakeLatency()
+} IrqLatencyStats;
+
+/** @brief Scheduling options of the interrupt thread
+ *
+ * The options are applied when the interrupt thread is created by Open(). The scheduling
+ * policy, priority and affinity can also be changed while the board is open.
+ */
+typedef struct IrqThreadConfig {
+	int schedPolicy;			///< SCHED_OTHER (default), SCHED_FIFO or SCHED_RR
+	int priority;				///< Real-time priority, 1 to 99, used with SCHED_FIFO and SCHED_RR
+	uint64_t cpuMask;			///< Bit map of the CPUs the thread may run on, 0 to keep the affinity inherited from the process
+	size_t stackSize;			///< Stack size in bytes, 0 for the system default
+	size_t prefaultSize;		///< Number of stack bytes touched when the thread starts, 0 for none
+	bool lockMemory;			///< Lock the process memory with mlockall() before the thread is created
+} IrqThreadConfig;
+
 //! Base class implementing a PCIe board and the Jungo driver.
 class DLL AlphiBoard
 {
 public:
-	LinearAddress bar0;		///< Memory descriptor for the BAR0 in user memory
-	LinearAddress bar2;		///< Memory descriptor for the BAR2 in user memory
-	LinearAddress bar3;		///< Memory descriptor for the BAR3 in user memory
+	LinearAddress bars[BoardBackend::nbrOfBars];	///< Memory descriptors of the BARs in user memory, Address is NULL if not mapped
+	LinearAddress& bar0;	///< Memory descriptor for the BAR0 in user memory
+	LinearAddress& bar2;	///< Memory descriptor for the BAR2 in user memory
+	LinearAddress& bar3;	///< Memory descriptor for the BAR3 in user memory
 	PcieCra* cra;			///< PCIe Interface standard component. Used by the software for interrupt control and for DMA.
 	BoardVersion* sysid;	///< Board identification. It contains the board type and a time stamp identifying the release
 
@@ -83,6 +111,16 @@ public:
 
 	virtual PCIeMini_status Open(int board_num);
 
+	PCIeMini_status setBackend(BoardBackend* newBackend);
+	void setDmaProvider(DmaBufferProvider* provider);
+	DmaBufferProvider* getDmaProvider(void);
+
+	/** @brief Return the backend giving access to the board, NULL before the board is opened */
+	inline BoardBackend* getBackend(void)
+	{
+		return backend;
+	}
+
 	/** @brief reset some of the board resources
 	 *
 	 */
@@ -102,16 +140,101 @@ public:
 
 	PCIeMini_status unhookInterruptServiceRoutine(void);
 
+	PCIeMini_status hookIrqHandler(int irqNbr, MINIPCIE_INT_HANDLER handler, void* userData);
+	PCIeMini_status unhookIrqHandler(int irqNbr);
+	PCIeMini_status hookMailboxHandler(int mailboxNbr, MINIPCIE_INT_HANDLER handler, void* userData);
+	PCIeMini_status unhookMailboxHandler(int mailboxNbr);
+
+	/** @brief Return the interrupt mask of the catch-all interrupt service routine */
+	inline uint32_t getInterruptServiceRoutineMask(void)
+	{
+		return intHandlerMask;
+	}
+
 	PCIeMini_status enableInterrupts(uint16_t mask = 0xffff);
 	PCIeMini_status disableInterrupts(void);
+
+	/** @brief Enable or disable the interrupt latency measurement
+	 *
+	 * The measurement is enabled by default. When disabled, the interrupt thread does not read the clock.
+	 */
+	inline void setIrqLatencyEnable(bool enable)
+	{
+		irqLatencyEnabled = enable;
+	}
+
+	/** @brief Return true when the interrupt latency is measured */
+	inline bool getIrqLatencyEnable(void)
+	{
+		return irqLatencyEnabled;
+	}
+
+	void setIrqRearmMode(IrqRearmMode mode);
+
+	/** @brief Return the active interrupt re-arm method, IRQ_REARM_AUTO if the interrupt thread is not running */
+	inline IrqRearmMode getIrqRearmMode(void)
+	{
+		return (backend != NULL) ? backend->getIrqRearmMode() : IRQ_REARM_AUTO;
+	}
+	const char* getIrqRearmModeName(void);
+
+	/** @brief How an interrupt source is currently served */
+	enum IrqSourceMode {
+		IRQ_MODE_INTERRUPT,		///< The source wakes up the interrupt thread
+		IRQ_MODE_POLL			///< The interrupt thread polls the source status
+	};
+
+	PCIeMini_status setHybridPolling(int bitNbr, uint32_t enterRate, uint32_t exitRate);
+	PCIeMini_status setHybridPollStatus(int bitNbr, ParallelInput* pio, uint32_t pioMask);
+	void setHybridPollParameters(uint32_t rateWindowUs, uint32_t pollIntervalUs);
+	IrqSourceMode getIrqSourceMode(int bitNbr);
+	uint64_t getIrqModeSwitches(int bitNbr);
+
+	/** @brief Return the bit map of the sources currently served by polling */
+	inline uint32_t getIrqPollMask(void)
+	{
+		return (cra != NULL) ? cra->getPolledMask() : 0;
+	}
+
+	PCIeMini_status setIrqThreadConfig(const IrqThreadConfig* config);
+	void getIrqThreadConfig(IrqThreadConfig* config);
+	PCIeMini_status measureIrqThreadWakeLatency(int nbrOfSamples);
+
+	void getIrqLatencySnapshot(IrqLatencyStats* dest);
+	void resetIrqLatency(void);
+	void printIrqLatency(void);
 	void* intThreadLoop(void);
 
 	virtual PCIeMini_status Close(void);
 
+	volatile void* getBarAddress(int barNbr, size_t offset);
 	volatile void* getBar0Address(size_t offset);
 	volatile void* getBar2Address(size_t offset);
 	volatile void* getBar3Address(size_t offset);
 
+	PCIeMini_status setBarWriteCombined(int barNbr, bool enable);
+
+	/** @brief Return true if the BAR is requested write-combined, see setBarWriteCombined() */
+	inline bool getBarWriteCombined(int barNbr)
+	{
+		return barNbr >= 0 && barNbr < BoardBackend::nbrOfBars && (wcBarMask & (1 << barNbr)) != 0;
+	}
+
+	/** @brief Push the pending write-combined stores to the board
+	 *
+	 * Write-combined stores can be delayed and reordered with respect to the uncached register
+	 * accesses. Call this function after filling a write-combined buffer and before telling the
+	 * board that the buffer is ready.
+	 */
+	static inline void flushWriteCombined(void)
+	{
+		__sync_synchronize();
+	}
+
+	static void mmioWrite(volatile void* dest, const void* src, size_t len);
+	static void mmioRead(void* dest, const volatile void* src, size_t len);
+	static void mmioFill(volatile void* dest, uint8_t value, size_t len);
+
 	/** @brief Millisecond Delay Function */
 	static inline void MsSleep(int ms)
 	{
@@ -133,29 +256,71 @@ private:
 	static const uint32_t	sysid_offset = 0x0000;		///< Offset of the Sysid component in BAR 2.
 	static const uint32_t	cra_address = 0x0000;		///< Offset in BAR 0
 
-	MINIPCIE_INT_HANDLER funcDiagIntHandler;
+	MINIPCIE_INT_HANDLER funcDiagIntHandler;	///< Catch-all handler, called for the sources in intHandlerMask without a dedicated handler
 	void *intHandlerUserData;
-
-	// UIO specific
-	char uioDev[20];					///< UIO device name
-	char uioName[20];					///< UIO driver name
-	char uioVersion[20];				///< UIO driver version
-
-	static const int nbrOfBars = 8;
-	size_t uioBarSizes[nbrOfBars];
-
-	int readConfigString(char *data, int *len, const char *name);
-	int readConfigHex(const char *name);
-	int readUioResource();
+	uint32_t intHandlerMask;				///< CRA status bits served by funcDiagIntHandler
+
+	/** @brief Handler attached to one bit of the CRA interrupt status register */
+	typedef struct IrqSourceHandler {
+		MINIPCIE_INT_HANDLER handler;		///< Handler, NULL when the source is not hooked
+		void* userData;						///< Parameter passed to the handler
+	} IrqSourceHandler;
+	IrqSourceHandler irqSources[PcieCra::nbrOfIrqSources];	///< Indexed by bit number in the CRA interrupt status register
+
+	PCIeMini_status setIrqSourceHandler(int bitNbr, MINIPCIE_INT_HANDLER handler, void* userData);
+	void callIrqHandlers(uint32_t pending);
+	void dispatchInterrupt(uint64_t wakeTime);
+
+	/** @brief Moderation state of one interrupt source, owned by the interrupt thread */
+	typedef struct IrqModerationState {
+		uint64_t windowStart;		///< Start of the current counting window, ns
+		uint64_t deadline;			///< End of the masking window, ns
+		uint32_t count;				///< Interrupts in the current counting window
+	} IrqModerationState;
+	IrqModerationState irqModeration[PcieCra::nbrOfIrqSources];
+	void moderateIrqSources(uint32_t pending);
+	int64_t serviceModeratedIrq(void);
+
+	/** @brief Hybrid polling settings and state of one interrupt source */
+	typedef struct HybridSource {
+		uint32_t enterRate;			///< Events per second above which the source is polled
+		uint32_t exitRate;			///< Events per second below which the source interrupts again
+		ParallelInput* pio;			///< Optional status register polled instead of the CRA status
+		uint32_t pioMask;			///< Bits of the pio interrupt status belonging to the source
+		uint32_t count;				///< Events in the current rate window, atomic: reset by the configuration
+		uint64_t switches;			///< Number of mode changes, atomic
+	} HybridSource;
+	HybridSource hybridSources[PcieCra::nbrOfIrqSources];
+	uint32_t hybridEnabled;					///< Sources with hybrid polling enabled, atomic
+	uint32_t hybridRateWindowUs;			///< Period of the rate evaluation
+	uint32_t hybridPollIntervalUs;			///< Delay between two polls, 0 to spin
+	uint64_t hybridWindowStart;				///< Start of the current rate window, ns
+	void countHybridEvents(uint32_t pending);
+	int64_t serviceHybridPolling(void);
+
+	volatile bool irqLatencyEnabled;		///< When true, the interrupt thread time stamps each interrupt
+	IrqLatencyStats irqLatency;				///< Written by the interrupt thread only
+
+	BoardBackend* backend;				///< Access to the board, UIO by default
+	uint32_t wcBarMask;					///< BARs to map write-combined, one bit per BAR
+	bool ownBackend;					///< True when the backend has been created by Open() and must be deleted
+	DmaBufferProvider* dmaProvider;		///< Allocator of the host DMA buffers, huge pages by default
+	bool ownDmaProvider;				///< True when dmaProvider has been created by getDmaProvider() and must be deleted
 
 	bool brd_valid;						///< When true, the board should be open and allocated
-	int     uiofd;						///< UIO Descriptor for board
-	int     configfd;					///< UIO Descriptor for board config
-	int		resfd0;						///< UIO Descriptor for BAR #0
-	int		resfd2;						///< UIO Descriptor for BAR #0
 
 	pthread_t irqThread;				///< Thread managing the interrupts. Independent from the main driver thread, Beware of concurrency issues.
+	bool irqThreadRunning;				///< True when irqThread has been created and not joined yet
+	volatile bool irqThreadStop;		///< Request for the interrupt thread to exit
+	int irqWakeFd;						///< eventfd used to wake up the interrupt thread when it is waiting for an interrupt
+	IrqThreadConfig irqThreadConfig;	///< Scheduling options of the interrupt thread
+	volatile uint64_t wakeProbeTime;	///< Time stamp of a pending wake latency probe, 0 when none
+	IrqRearmMode irqRearmRequest;		///< Re-arm method requested by the user
+	void unmapBars(void);
 	int startIntThread();
+	PCIeMini_status applyIrqThreadSched(pthread_t thread);
+	void prefaultIrqThreadStack(void);
+	void stopIntThread();
 };
 
 #endif
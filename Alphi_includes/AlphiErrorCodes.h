@@ -84,6 +84,7 @@ typedef int PCIeMini_status;
 #define ERRCODE_BUSY								ERRCODE_TX_OVERFLOW + 1
 #define ERRCODE_TIMEOUT								ERRCODE_BUSY + 1
 #define ERRCODE_INVALID_ALIGNMENT					ERRCODE_TIMEOUT + 1
+#define ERRCODE_PERMISSION_DENIED					ERRCODE_INVALID_ALIGNMENT + 1
 
 DLL char* getAlphiErrorMsg(PCIeMini_status errCode);
 
@@ -31,13 +31,19 @@
  // Maintenance Log
  //---------------------------------------------------------------------
  // v1.0		7/23/2020	phf	Written
+ // v1.1		Descriptor queue chaining the transfers, with per transfer timing
+ // v1.2		Completion by interrupt, with a blocking wait or a callback
  //---------------------------------------------------------------------
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 #include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+#include "AvalonRegister.h"
+#include "LatencyHistogram.h"
 
 typedef void (alt_txchan_done)(void* handle);
 typedef void (alt_rxchan_done)(void* handle, void* data);
@@ -97,6 +103,12 @@ details, see the Addressing and Address Incrementing section.*/
 class DLL TransferDesc
 {
 public:
+    TransferDesc()
+        : dest_offset(0), src_offset(0), tfr_length(0), flags(0), txs_offset(0), bufLength(0),
+          userSpaceBuffer(NULL), fPolling(true), trEntry(-1), status(0), queuedNs(0), startNs(0), doneNs(0)
+    {
+    }
+
     // DMA controller specific
     volatile uint32_t   dest_offset;        ///< 32-bit FPGA Avalon bus address of destination
     volatile uint32_t   src_offset;         ///< 32-bit FPGA Avalon bus address of source
@@ -106,7 +118,13 @@ public:
     uint32_t            txs_offset;         ///< Offset in the mapping area
     uint32_t            bufLength;          ///< Size of the buffer in bytes
     uint32_t*           userSpaceBuffer;    ///< PC buffer address as an user-space address
-    bool                fPolling;           ///< Polling or interrupt for end of transfer (not yet implemented)
+    bool                fPolling;           ///< Polling or interrupt for end of transfer
+    int                 trEntry;            ///< Address translation entry pinned for the transfer, -1 if none
+    // filled by AlteraDmaQueue
+    uint32_t            status;             ///< DMA status at the end of the transfer, DONE is clear when the transfer was aborted
+    uint64_t            queuedNs;           ///< Time the descriptor was queued
+    uint64_t            startNs;            ///< Time the transfer was launched
+    uint64_t            doneNs;             ///< Time the end of the transfer was detected
 };
 
 
@@ -131,7 +149,39 @@ public:
 
 #define ALT_AVALON_DMA_NSLOTS_MSK (ALT_AVALON_DMA_NSLOTS - 1)
 
+    typedef void (DoneCallback)(void* handle, TransferDesc* t);
+
     AlteraDma(volatile void* dmaAddress);
+    ~AlteraDma();
+
+    void start(TransferDesc* t);
+    PCIeMini_status waitDone(TransferDesc* t, uint32_t timeoutUs, bool polling);
+    PCIeMini_status setMode(int mode);
+    uint32_t getModeWidth();
+    void setIrqMode(bool irqMode);
+    void setDoneCallback(DoneCallback* done, void* handle);
+    void clearStats();
+    void printStats(const char* title = 0);
+
+    /** @brief Interrupt handler, to be hooked on the DMA interrupt with the controller as user data */
+    static void irqHandler(void* context)
+    {
+        ((AlteraDma*)context)->serviceIrq();
+    }
+
+    void acquire();
+    bool tryAcquire();
+    void release();
+
+    /** @brief True when the end of the transfers is signaled by interrupt */
+    inline bool getIrqMode()
+    {
+        return useIrq;
+    }
+
+    LatencyHistogram pollLatency;       ///< From start() to the end of transfer seen by a polling waitDone()
+    LatencyHistogram irqLatency;        ///< From start() to the end of transfer seen by the interrupt handler
+    LatencyHistogram wakeLatency;       ///< From the interrupt handler to the return of a blocking waitDone()
 
  /*   int prepare(
         void* data,
@@ -162,41 +212,57 @@ public:
 */
     inline void reset()
     {
-        base[control_index] = ALTERA_AVALON_DMA_CONTROL_SOFTWARERESET_MSK;
-        base[control_index] = ALTERA_AVALON_DMA_CONTROL_SOFTWARERESET_MSK;
+        ControlReg::write(base, ALTERA_AVALON_DMA_CONTROL_SOFTWARERESET_MSK);
+        ControlReg::write(base, ALTERA_AVALON_DMA_CONTROL_SOFTWARERESET_MSK);
 
         /* Set the default mode of the device (32 bit block reads and writes from/to memory). */
-        base[control_index] =
-            ALTERA_AVALON_DMA_CONTROL_WORD_MSK |
+        ControlReg::write(base, ALTERA_AVALON_DMA_CONTROL_WORD_MSK |
             ALTERA_AVALON_DMA_CONTROL_GO_MSK |
-            ALTERA_AVALON_DMA_CONTROL_LEEN_MSK;
+            ALTERA_AVALON_DMA_CONTROL_LEEN_MSK |
+            (useIrq ? ALTERA_AVALON_DMA_CONTROL_I_EN_MSK : 0));
 
         /* Clear any pending interrupts and the DONE flag */
-        base[status_index] = 0;
+        StatusReg::write(base, 0);
     }
 
     void irq(void* context, uint32_t id);
 
     inline uint32_t getStatus()
     {
-        return base[status_index];
+        return StatusReg::read(base);
     }
 
     inline uint32_t getLength()
     {
-        return base[length_index];
+        return LengthReg::read(base);
     }
 
     inline uint32_t setControlBit(uint32_t mask)
     {
-        base[control_index] |= mask;
-        return base[control_index];
+        return ControlReg::modify(base, 0, mask);
+    }
+
+    inline uint32_t clearControlBit(uint32_t mask)
+    {
+        return ControlReg::modify(base, mask, 0);
+    }
+
+    /** @brief True when the last transfer is completed. The DONE bit stays set until clearDone() */
+    inline bool isDone()
+    {
+        return (StatusReg::read(base) & ALTERA_AVALON_DMA_STATUS_DONE_MSK) != 0;
+    }
+
+    /** @brief Clear DONE and the interrupt request */
+    inline void clearDone()
+    {
+        StatusReg::write(base, 0);
     }
 
     inline char* statusToString(char* buffer)
     {
         buffer[0] = 0;
-        uint32_t status = base[status_index];
+        uint32_t status = StatusReg::read(base);
         if (status & ALTERA_AVALON_DMA_STATUS_DONE_MSK)
             strcat(buffer, "DONE ");
         if (status & ALTERA_AVALON_DMA_STATUS_BUSY_MSK)
@@ -213,7 +279,7 @@ public:
     inline char* controlToString(char* buffer)
     {
         buffer[0] = 0;
-        uint32_t control = base[control_index];
+        uint32_t control = ControlReg::read(base);
         if (control & ALTERA_AVALON_DMA_CONTROL_BYTE_MSK)
             strcat(buffer, "8-bit ");
         if (control & ALTERA_AVALON_DMA_CONTROL_HW_MSK)
@@ -247,21 +313,119 @@ public:
         if (title)
             printf("\n%s\n", title);
         printf("Status:     %s\n", statusToString(buffer));
-        printf("RdAddress:  0x%08x\n", base[rdAddress_index]);
-        printf("WrAddress:  0x%08x\n", base[wrAddress_index]);
-        printf("Length:     0x%08x\n", base[length_index]);
+        printf("RdAddress:  0x%08x\n", RdAddressReg::read(base));
+        printf("WrAddress:  0x%08x\n", WrAddressReg::read(base));
+        printf("Length:     0x%08x\n", LengthReg::read(base));
         printf("Control:    %s\n", controlToString(buffer));
     }
 
 private:
         volatile uint32_t* base;
+
+        // ownership
+        pthread_mutex_t ownerLock;
+        pthread_cond_t ownerCond;       ///< Signaled by release()
+        bool owned;                     ///< True between acquire() and release()
+
+        // completion
+        pthread_mutex_t doneLock;
+        pthread_cond_t doneCond;        ///< Signaled by the interrupt handler at the end of each transfer
+        uint32_t doneSeq;               ///< Number of transfers completed
+        uint32_t expectedSeq;           ///< Value of doneSeq at the end of the current transfer
+        TransferDesc* current;          ///< Transfer started by start()
+        bool useIrq;
+        DoneCallback* doneCallback;
+        void* doneHandle;
+
+        void serviceIrq();
  //       alt_avalon_dma_txslot  tx_buf[ALT_AVALON_DMA_NSLOTS];
  //       alt_avalon_dma_rxslot  rx_buf[ALT_AVALON_DMA_NSLOTS];
 
-        // indices
-        static const uint8_t status_index = 0;
-        static const uint8_t rdAddress_index = 1;
-        static const uint8_t wrAddress_index = 2;
-        static const uint8_t length_index = 3;
-        static const uint8_t control_index = 6;
+        // registers
+        typedef AvalonReg<0, REG_RW> StatusReg;      ///< Writing clears DONE and the interrupt
+        typedef AvalonReg<1, REG_RW> RdAddressReg;
+        typedef AvalonReg<2, REG_RW> WrAddressReg;
+        typedef AvalonReg<3, REG_RW> LengthReg;
+        typedef AvalonReg<6, REG_RW> ControlReg;
+};
+
+/** @brief Scatter-gather queue on top of the Avalon DMA controller
+ *
+ * The controller runs one transfer at a time. The queue keeps the descriptors waiting for the
+ * controller and launches the next one as soon as the current one is done, so a list of
+ * transfers runs back to back without the application in the loop.
+ *
+ * The end of a transfer is detected either by service() in polling mode, or by irqHandler()
+ * hooked on the DMA interrupt. The completion callback is called in the thread that detected
+ * the end of the transfer, without the queue lock held, so it may enqueue the next transfers.
+ * The descriptors are owned by the caller and must stay valid until their callback is called.
+ */
+class DLL AlteraDmaQueue
+{
+public:
+    typedef AlteraDma::DoneCallback DoneCallback;
+
+    static const uint32_t nbrOfSlots = 32;                  ///< Queue depth, power of 2
+
+    AlteraDmaQueue(AlteraDma* dmaCtrl, bool irqMode = false);
+    ~AlteraDmaQueue();
+
+    PCIeMini_status enqueue(TransferDesc* t, DoneCallback* done = NULL, void* handle = NULL);
+    int service();
+    PCIeMini_status waitIdle(uint32_t timeoutMs = 1000);
+    int abort();
+    void setIrqMode(bool irqMode);
+
+    /** @brief Interrupt handler, to be hooked on the DMA interrupt with the queue as user data */
+    static void irqHandler(void* context)
+    {
+        ((AlteraDmaQueue*)context)->service();
+    }
+
+    inline bool getIrqMode()
+    {
+        return useIrq;
+    }
+
+    /** @brief Number of descriptors queued, including the one being transferred */
+    inline uint32_t getPending()
+    {
+        return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    }
+
+    inline bool isIdle()
+    {
+        return getPending() == 0;
+    }
+
+    inline uint64_t getCompleted()
+    {
+        return __atomic_load_n(&completed, __ATOMIC_ACQUIRE);
+    }
+
+    void clearStats();
+    void printStats(const char* title = 0);
+
+    LatencyHistogram queueTime;         ///< From enqueue() to the launch of the transfer
+    LatencyHistogram transferTime;      ///< From the launch to the detection of the end of the transfer
+
+private:
+    struct Slot
+    {
+        TransferDesc* desc;
+        DoneCallback* done;
+        void* handle;
+    };
+
+    void startNext(uint64_t now);
+
+    AlteraDma* dma;
+    Slot slots[nbrOfSlots];
+    uint32_t head;                      ///< Next free slot, free running
+    uint32_t tail;                      ///< Slot being transferred, free running
+    bool active;                        ///< A transfer is running
+    bool useIrq;
+    uint64_t completed;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;            ///< Signaled when a transfer ends or the queue is aborted
 };
@@ -36,9 +36,20 @@
 
 #include "AlphiDll.h"
 #include <stdint.h>
+#include "AvalonRegister.h"
+#include <pthread.h>
 #include "AlphiErrorCodes.h"
 
 /** @brief Altera Avalon Pio controller class
+ *
+ * The output data and the interrupt mask are registers the host owns. In shadow mode, see
+ * setShadowMode(), the class keeps a copy of them: reading them back costs no PCIe round trip.
+ *
+ * Individual output bits are changed with setBits(), clearBits() and modifyBits(). When the PIO
+ * is generated with the "individual bit setting/clearing" option, declare it with CAP_BIT_SET_CLEAR:
+ * the functions then use the outset/outclear registers, one posted write and no lock. Otherwise
+ * they do a read-modify-write of the data register under a lock, reading the shadow copy in
+ * shadow mode.
 */
 class AlteraPio
 {
@@ -46,11 +57,54 @@ public:
     static const uint16_t CAP_INPUT = 0x01;
     static const uint16_t CAP_OUTPUT = 0x02;
     static const uint16_t CAP_INPUT_OUTPUT = 0x03;
+    static const uint16_t CAP_BIT_SET_CLEAR = 0x04;     ///< The outset and outclear registers are implemented
 
     inline AlteraPio(volatile void* addr, uint16_t capabilities)
     {
         base = (volatile uint32_t*)addr;
         options = capabilities;
+        shadowEnabled = false;
+        dataShadow = 0;
+        irqMaskShadow = 0;
+        pthread_mutex_init(&bitLock, NULL);
+    }
+
+    inline ~AlteraPio()
+    {
+        pthread_mutex_destroy(&bitLock);
+    }
+
+    /** @brief Enable or disable the shadow copy of the registers owned by the host
+     *
+     * In shadow mode, writes to the output data and interrupt mask registers also update a
+     * host-side copy, and getOutputData() and getIrqMask() return that copy. Only use it when
+     * nothing else (firmware, another process) modifies these registers. Enabling the mode
+     * reads the hardware once, see resync().
+     * @param enable True to use the shadow copy.
+     */
+    inline void setShadowMode(bool enable)
+    {
+        if (enable)
+            resync();
+        shadowEnabled = enable;
+    }
+
+    /** @brief Return true if the shadow copy is in use */
+    inline bool getShadowMode()
+    {
+        return shadowEnabled;
+    }
+
+    /** @brief Reload the shadow copy from the hardware
+     *
+     * Use it after something else than this object has written the registers.
+     */
+    inline void resync()
+    {
+        if (options & CAP_OUTPUT)
+            dataShadow = DataReg::read(base);
+        if (options & CAP_INPUT)
+            irqMaskShadow = IrqMaskReg::read(base);
     }
 
     /** @brief Reset the PIO
@@ -61,22 +115,45 @@ public:
      */
     inline PCIeMini_status reset()
     {
-        base[data_index] = 0;
+        DataReg::write(base, 0);
+        dataShadow = 0;
         setIrqMask(0);                  // ignore possible error if not supported by instance
         clearEdgeCapture(0xffffffff);   // ignore possible error if not supported by instance
 
         return ERRCODE_NO_ERROR;
     }
 
+    /** @brief Read the data register
+     *
+     * On output-only devices in shadow mode, the value comes from the shadow copy.
+     * @retval Input bits, or output bits on output-only devices.
+     */
     inline uint32_t getData()
     {
-        return base[data_index];
+        if (shadowEnabled && (options & CAP_INPUT) == 0)
+            return __atomic_load_n(&dataShadow, __ATOMIC_RELAXED);
+        return DataReg::read(base);
+    }
+
+    /** @brief Return the last value output
+     *
+     * In shadow mode the value comes from the shadow copy, otherwise the data register is read.
+     * Use this function for read-modify-write sequences.
+     * @retval The output data.
+     */
+    inline uint32_t getOutputData()
+    {
+        if (shadowEnabled)
+            return __atomic_load_n(&dataShadow, __ATOMIC_RELAXED);
+        return DataReg::read(base);
     }
 
     /** @brief set the output data
      *
      * This operation is valid only for output or bidirectional parallel ports. On input-only devices,
      * it will return ERRCODE_INVALID_INPUT_MODE 
+     * Safe to call from several threads. It writes all the bits: with CAP_BIT_SET_CLEAR, a setBits() or
+     * clearBits() running at the same time may be overwritten in the register.
      * @param data Data to be output. The values corresponding to input bits are ignored.
      * @retval ERRCODE_NO_ERROR, or if it is an illegal operation ERRCODE_INVALID_INPUT_MODE.
      */
@@ -85,7 +162,70 @@ public:
         if ((options & CAP_OUTPUT) == 0) {
             return ERRCODE_INVALID_INPUT_MODE;
         }
-        base[data_index] = data;
+        if (options & CAP_BIT_SET_CLEAR) {
+            __atomic_store_n(&dataShadow, data, __ATOMIC_RELAXED);
+            DataReg::write(base, data);
+            return ERRCODE_NO_ERROR;
+        }
+        pthread_mutex_lock(&bitLock);
+        DataReg::write(base, data);
+        dataShadow = data;
+        pthread_mutex_unlock(&bitLock);
+        return ERRCODE_NO_ERROR;
+    }
+
+    /** @brief Set output bits, leaving the others unchanged
+     *
+     * Safe to call from several threads.
+     * @param mask Bits to set to 1.
+     * @retval ERRCODE_NO_ERROR, or ERRCODE_INVALID_INPUT_MODE on input-only devices.
+     */
+    inline PCIeMini_status setBits(uint32_t mask)
+    {
+        return modifyBits(0, mask);
+    }
+
+    /** @brief Clear output bits, leaving the others unchanged
+     *
+     * Safe to call from several threads.
+     * @param mask Bits to set to 0.
+     * @retval ERRCODE_NO_ERROR, or ERRCODE_INVALID_INPUT_MODE on input-only devices.
+     */
+    inline PCIeMini_status clearBits(uint32_t mask)
+    {
+        return modifyBits(mask, 0);
+    }
+
+    /** @brief Clear then set output bits, leaving the others unchanged
+     *
+     * Without CAP_BIT_SET_CLEAR the data register is written once with the new value. With it,
+     * the clear and the set are two writes: the output briefly shows the cleared state.
+     * Safe to call from several threads.
+     * @param clearMask Bits to set to 0.
+     * @param setMask Bits to set to 1, applied after clearMask.
+     * @retval ERRCODE_NO_ERROR, or ERRCODE_INVALID_INPUT_MODE on input-only devices.
+     */
+    inline PCIeMini_status modifyBits(uint32_t clearMask, uint32_t setMask)
+    {
+        if ((options & CAP_OUTPUT) == 0) {
+            return ERRCODE_INVALID_INPUT_MODE;
+        }
+        if (options & CAP_BIT_SET_CLEAR) {
+            if (clearMask) {
+                __atomic_and_fetch(&dataShadow, ~clearMask, __ATOMIC_RELAXED);
+                OutClearReg::write(base, clearMask);
+            }
+            if (setMask) {
+                __atomic_or_fetch(&dataShadow, setMask, __ATOMIC_RELAXED);
+                OutSetReg::write(base, setMask);
+            }
+            return ERRCODE_NO_ERROR;
+        }
+        pthread_mutex_lock(&bitLock);
+        uint32_t data = (getOutputData() & ~clearMask) | setMask;
+        DataReg::write(base, data);
+        dataShadow = data;
+        pthread_mutex_unlock(&bitLock);
         return ERRCODE_NO_ERROR;
     }
 
@@ -100,7 +240,9 @@ public:
         if ((options & CAP_INPUT) == 0) {
             return 0;
         }
-        return base[irqMask_Index];
+        if (shadowEnabled)
+            return irqMaskShadow;
+        return IrqMaskReg::read(base);
     }
 
     /** @brief Set the interrupt mask
@@ -115,13 +257,14 @@ public:
         if ((options & CAP_INPUT) == 0) {
             return ERRCODE_INVALID_INPUT_MODE;
         }
-        base[irqMask_Index] = mask;
+        IrqMaskReg::write(base, mask);
+        irqMaskShadow = mask;
         return ERRCODE_NO_ERROR;
     }
 
     inline uint32_t getEdgeCapture()
     {
-        return base[edgeCap_index];
+        return EdgeCaptureReg::read(base);
     }
 
     inline PCIeMini_status clearEdgeCapture(uint32_t mask)
@@ -129,19 +272,22 @@ public:
         if ((options & CAP_INPUT) == 0) {
             return ERRCODE_INVALID_INPUT_MODE;
         }
-        base[edgeCap_index] = mask;
+        EdgeCaptureReg::write(base, mask);
         return ERRCODE_NO_ERROR;
     }
 
 private:
     volatile uint32_t* base;
     uint16_t options;
+    bool shadowEnabled;                 ///< When true, the host-owned registers are read from the shadow copy
+    uint32_t dataShadow;                ///< Last value written to the data register
+    uint32_t irqMaskShadow;             ///< Last value written to the interrupt mask register
+    pthread_mutex_t bitLock;            ///< Serializes setData() and the read-modify-write of modifyBits() without CAP_BIT_SET_CLEAR
 
-
-    int data_index = 0;
-    int direction_index = 1;
-    int irqMask_Index = 2;
-    int edgeCap_index = 3;
-    int setOuput_index = 4;
-    int clearOuput_index = 5;
+    typedef AvalonReg<0, REG_RW> DataReg;           ///< Input bits when read, output bits when written
+    typedef AvalonReg<1, REG_RW> DirectionReg;
+    typedef AvalonReg<2, REG_RW> IrqMaskReg;
+    typedef AvalonReg<3, REG_RW> EdgeCaptureReg;    ///< Writing 1s clears the captured edges
+    typedef AvalonReg<4, REG_WO> OutSetReg;         ///< Only with CAP_BIT_SET_CLEAR
+    typedef AvalonReg<5, REG_WO> OutClearReg;       ///< Only with CAP_BIT_SET_CLEAR
 };
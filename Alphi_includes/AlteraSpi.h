@@ -36,6 +36,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "AlphiDll.h"
+#include "AvalonRegister.h"
+#include "SpiCompletion.h"
 
 /** @brief Low level SPI interface to the SPI hardware */
 class DLL AlteraSpi
@@ -92,6 +94,13 @@ public:
      */
     static const uint32_t status_RRDY_mask = 0x0080;
 
+    /** @brief Receive FIFO level
+     *
+     * Reported in the status register by the controllers built with FIFOs, see setFifoDepth().
+     */
+    static const uint32_t status_rxLevel_mask = 0x00ff0000;
+    static const uint32_t status_rxLevel_bitNbr = 16;
+
 
 #define ALTERA_AVALON_SPI_STATUS_E_MSK                (0x100)
 #define ALTERA_AVALON_SPI_STATUS_E_OFST               (8)
@@ -116,53 +125,109 @@ public:
         uint32_t read_length, uint32_t* read_data,
         uint32_t flags);
 
+    void setFifoDepth(uint32_t depth, bool levelInStatus = false);
+    void clearPollStats();
+    void setIrqMode(bool irqMode, uint32_t minIrqWords = SpiCompletion::defaultMinIrqWords);
+
+    /** @brief Interrupt handler, to be hooked on the SPI interrupt with the controller as user data */
+    static void irqHandler(void* context)
+    {
+        ((AlteraSpi*)context)->serviceIrq();
+    }
+
+    SpiCompletion completion;       ///< Interrupt wait and CPU time per word of the polled and interrupt transfers
+
+    /** @brief Depth of the FIFOs used by sendSpiCommand(), 1 when the words are sent one at a time */
+    inline uint32_t getFifoDepth()
+    {
+        return fifoDepth;
+    }
+
+    /** @brief Number of status register reads of the last sendSpiCommand() */
+    inline uint32_t getLastStatusPolls()
+    {
+        return lastStatusPolls;
+    }
+
+    /** @brief Status register reads, words and commands since clearPollStats() */
+    inline void getPollStats(uint64_t* polls, uint64_t* words, uint64_t* commands)
+    {
+        *polls = totalStatusPolls;
+        *words = totalWords;
+        *commands = totalCommands;
+    }
+
     /** @brief Get the content of the receive data register
      *
      * @retval Content of the receive data register
      */
     inline volatile uint32_t getRxData()
     {
-        return base[rxData_index];
+        return RxDataReg::read(base);
     }
 
     inline volatile uint32_t getStatus()
     {
-        return base[status_Index];
+        return StatusReg::read(base);
     }
 
     inline void resetStatus()
     {
-        base[status_Index] = 0;
+        StatusReg::write(base, 0);
     }
 
     inline void setTxData(uint32_t data)
     {
-        base[txData_index] = data;
+        TxDataReg::write(base, data);
     }
 
     inline void setControl(uint32_t data)
     {
-        base[control_index] = data;
+        controlShadow = data;
+        ControlReg::write(base, data);
     }
 
     inline uint32_t getControl()
     {
-        return base[control_index];
+        return ControlReg::read(base);
     }
 
     inline void selectSlave(volatile uint32_t data)
     {
-        base[slaveSelect_index] = data;
+        SlaveSelectReg::write(base, data);
     }
 
 protected:
     volatile uint32_t* base;
     uint8_t wordSize;
 
-    int rxData_index = 0;
-    int txData_index = 1;
-    int status_Index = 2;
-    int control_index = 3;
-    int slaveSelect_index = 5;
+    // pipelined transfers
+    uint32_t fifoDepth;             ///< Words kept in flight by sendSpiCommand()
+    bool rxLevelInStatus;           ///< The status register holds the receive FIFO level
+    uint32_t lastStatusPolls;
+    uint64_t totalStatusPolls;
+    uint64_t totalWords;
+    uint64_t totalCommands;
+    uint32_t controlShadow;         ///< Last value written by setControl(), for the interrupt handler
+
+    /** @brief Read the status register, counted in the poll statistics */
+    inline uint32_t pollStatus()
+    {
+        lastStatusPolls++;
+        return getStatus();
+    }
+
+    void transferLockstep(uint32_t write_length, const uint32_t* write_data,
+        uint32_t read_length, uint32_t* read_data, bool irq);
+    void transferPipelined(uint32_t write_length, const uint32_t* write_data,
+        uint32_t read_length, uint32_t* read_data, bool irq);
+    uint32_t waitRxReady();
+    void serviceIrq();
+
+    typedef AvalonReg<0, REG_RO> RxDataReg;
+    typedef AvalonReg<1, REG_WO> TxDataReg;
+    typedef AvalonReg<2, REG_RW> StatusReg;         ///< Writing clears the error bits
+    typedef AvalonReg<3, REG_RW> ControlReg;
+    typedef AvalonReg<5, REG_RW> SlaveSelectReg;
 
 };
\ No newline at end of file
@@ -36,6 +36,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "AlphiDll.h"
+#include "AvalonRegister.h"
 #include "ParallelInput.h"
 #include "AlteraPio.h"
 
@@ -125,7 +126,7 @@ public:
 
 	inline void resetStatus()
 	{
-		base[status_Index] = 0;
+		StatusReg::write(base, 0);
 	}
 
 	/** @brief Get the SPI interface status
@@ -135,7 +136,7 @@ public:
 	 */
 	inline uint32_t getStatus()
 	{
-		return base[status_Index];
+		return StatusReg::read(base);
 	}
 
 	/** @brief Get the address of the SPI controller
@@ -153,7 +154,7 @@ public:
 	 */
 	inline volatile uint32_t getRxData()
 	{
-		return base[rxData_index];
+		return RxDataReg::read(base);
 	}
 
 	/** @brief Add data to the transmit FIFO
@@ -162,7 +163,7 @@ public:
 	 */
 	inline void setTxData(uint32_t data)
 	{
-		base[txData_index] = data;
+		TxDataReg::write(base, data);
 	}
 
 	/** @brief Write in the control register
@@ -180,7 +181,7 @@ public:
 		// remove the temporary bits
 		controlRegCached &= ~(control_resetFifo_mask | control_purgeRxFifo_mask);
 
-		base[control_index] = data | 1 << (slave + 16);
+		ControlReg::write(base, data | 1 << (slave + 16));
 	}
 
 
@@ -232,10 +233,10 @@ protected:
 	uint32_t controlRegCached;
 	uint32_t lastRxFifoLevel;
 
-	int rxData_index = 16;
-	int txData_index = 1;
-	int status_Index = 2;
-	int control_index = 3;
+	typedef AvalonReg<16, REG_RO> RxDataReg;
+	typedef AvalonReg<1, REG_WO> TxDataReg;
+	typedef AvalonReg<2, REG_RW> StatusReg;			///< Writing clears the error bits
+	typedef AvalonReg<3, REG_WO> ControlReg;		///< Never read back, see controlRegCached
 
 };
 
@@ -0,0 +1,151 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file AvalonRegister.h
+* @brief Compile-time description of the registers of the Avalon components
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _AVALON_REGISTER_H
+#define _AVALON_REGISTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Access policy of a register, checked at compile time */
+enum AvalonRegAccess {
+	REG_RO,			///< Read-only: write() does not compile
+	REG_WO,			///< Write-only: read() and modify() do not compile
+	REG_RW			///< Read and write
+};
+
+/** @brief 32-bit register of an Avalon component
+ *
+ * A register is a type, not an object: it only holds its position in the component and its
+ * access policy, and every access compiles to a single volatile load or store at a constant
+ * offset from the component base address.
+ *
+ *     typedef AvalonReg<2, REG_RO> StatusReg;
+ *     uint32_t status = StatusReg::read(base);
+ *
+ * @tparam Index Position of the register in the component, in 32-bit words.
+ * @tparam Access Access policy.
+ */
+template <unsigned Index, AvalonRegAccess Access = REG_RW>
+struct AvalonReg
+{
+	static constexpr unsigned index = Index;			///< Position in 32-bit words
+	static constexpr size_t offset = Index * 4;			///< Position in bytes
+	static constexpr AvalonRegAccess access = Access;
+
+	/** @brief Return the address of the register */
+	static inline volatile uint32_t* address(volatile uint32_t* base)
+	{
+		return base + Index;
+	}
+
+	/** @brief Read the register, one MMIO read */
+	static inline uint32_t read(volatile uint32_t* base)
+	{
+		static_assert(Access != REG_WO, "read of a write-only register");
+		return base[Index];
+	}
+
+	/** @brief Write the register, one MMIO write */
+	static inline void write(volatile uint32_t* base, uint32_t value)
+	{
+		static_assert(Access != REG_RO, "write to a read-only register");
+		base[Index] = value;
+	}
+
+	/** @brief Clear then set bits, one MMIO read and one MMIO write whatever the number of bits
+	 * @retval The value written.
+	 */
+	static inline uint32_t modify(volatile uint32_t* base, uint32_t clearMask, uint32_t setMask)
+	{
+		static_assert(Access == REG_RW, "read-modify-write of a register that is not read/write");
+		uint32_t value = (base[Index] & ~clearMask) | setMask;
+		base[Index] = value;
+		return value;
+	}
+};
+
+/** @brief Bit field of a register
+ *
+ * The masks and the shifts are constant expressions: several fields of the same register are
+ * combined at compile time and written with a single access.
+ *
+ *     typedef AvalonField<ControlReg, 8> IeBit;
+ *     ControlReg::write(base, IeBit::value(1) | SsoBit::value(1));
+ *
+ * @tparam Reg Register containing the field, an AvalonReg.
+ * @tparam Shift Position of the least significant bit.
+ * @tparam Width Number of bits.
+ */
+template <typename Reg, unsigned Shift, unsigned Width = 1>
+struct AvalonField
+{
+	static_assert(Shift + Width <= 32, "field outside of a 32-bit register");
+
+	typedef Reg reg;										///< Register containing the field
+	static constexpr unsigned shift = Shift;
+	static constexpr unsigned width = Width;
+	static constexpr uint32_t mask = (Width >= 32 ? 0xffffffffu : ((1u << Width) - 1u)) << Shift;
+
+	/** @brief Position a value in the field, for a register write */
+	static constexpr uint32_t value(uint32_t v)
+	{
+		return (v << Shift) & mask;
+	}
+
+	/** @brief Extract the field from a register value */
+	static constexpr uint32_t get(uint32_t regValue)
+	{
+		return (regValue & mask) >> Shift;
+	}
+
+	/** @brief Replace the field in a register value */
+	static constexpr uint32_t insert(uint32_t regValue, uint32_t v)
+	{
+		return (regValue & ~mask) | value(v);
+	}
+
+	/** @brief Read the register and extract the field */
+	static inline uint32_t read(volatile uint32_t* base)
+	{
+		return get(Reg::read(base));
+	}
+
+	/** @brief Update the field, leaving the rest of the register unchanged */
+	static inline void modify(volatile uint32_t* base, uint32_t v)
+	{
+		Reg::modify(base, mask, value(v));
+	}
+};
+
+#endif // _AVALON_REGISTER_H
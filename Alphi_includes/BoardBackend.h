@@ -0,0 +1,117 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file BoardBackend.h
+* @brief Interface between the board classes and the operating system driver
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _BOARD_BACKEND_H
+#define _BOARD_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+
+/** @brief Method used to re-enable the interrupt after each interrupt */
+enum IrqRearmMode {
+	IRQ_REARM_AUTO,			///< Select the cheapest method supported by the driver
+	IRQ_REARM_MSI,			///< MSI, nothing to re-enable
+	IRQ_REARM_UIO,			///< UIO irqcontrol, write(uiofd, 1)
+	IRQ_REARM_CONFIG,		///< Clear the INTx disable bit in the PCI command register
+	IRQ_REARM_SIMULATED		///< Simulated board, no hardware involved
+};
+
+/** @brief Board access backend
+ *
+ * A backend opens a board, maps its BARs in user space and delivers its interrupts. AlphiBoard
+ * uses the UIO backend by default; other backends, like the simulated board, are selected with
+ * AlphiBoard::setBackend() before the board is opened.
+ *
+ * Interrupts are delivered through a file descriptor that becomes readable when the board
+ * interrupts. The interrupt thread then calls readIrqCount(), serves the interrupt and calls
+ * rearmIrq().
+ */
+class DLL BoardBackend
+{
+public:
+	static const int nbrOfBars = 8;		///< Number of PCI BARs
+
+	virtual ~BoardBackend() {}
+
+	/** @brief Connect to a board and check its identification
+	 * @param brdNbr Board number, backend dependent.
+	 * @param vendorId Expected PCI vendor identification.
+	 * @param deviceId Expected PCI device identification.
+	 * @retval ERRCODE_INVALID_BOARD_NUM if the board does not exist or does not match.
+	 */
+	virtual PCIeMini_status open(int brdNbr, uint16_t vendorId, uint16_t deviceId) = 0;
+
+	/** @brief Disconnect from the board, the BARs must have been unmapped */
+	virtual PCIeMini_status close(void) = 0;
+
+	/** @brief Return the size of a BAR in bytes, 0 if the BAR is not implemented */
+	virtual size_t getBarSize(int barNbr) = 0;
+
+	/** @brief Map a whole BAR in user space
+	 * @param barNbr BAR number.
+	 * @param writeCombined Request a write-combined mapping. Backends that cannot provide it
+	 *   fall back to an uncached mapping and return false in *isWriteCombined.
+	 * @param isWriteCombined If not NULL, receives the kind of mapping obtained.
+	 * @retval Address of the mapping, NULL if it failed.
+	 */
+	virtual void* mapBar(int barNbr, bool writeCombined = false, bool* isWriteCombined = NULL) = 0;
+
+	/** @brief Unmap a BAR mapped with mapBar() */
+	virtual void unmapBar(int barNbr, void* address, size_t length) = 0;
+
+	/** @brief File descriptor that becomes readable when the board interrupts */
+	virtual int getIrqFd(void) = 0;
+
+	/** @brief Acknowledge the wake up of the interrupt file descriptor
+	 * @param count Total number of interrupts, when the backend knows it.
+	 */
+	virtual PCIeMini_status readIrqCount(uint32_t* count) = 0;
+
+	/** @brief Select the interrupt re-arm method and enable the interrupts
+	 * @param request Requested method, IRQ_REARM_AUTO to let the backend choose.
+	 */
+	virtual PCIeMini_status startIrq(IrqRearmMode request) = 0;
+
+	/** @brief Re-enable the interrupt once it has been served */
+	virtual PCIeMini_status rearmIrq(void) = 0;
+
+	/** @brief Return the re-arm method in use, IRQ_REARM_AUTO if the interrupts are not started */
+	virtual IrqRearmMode getIrqRearmMode(void) = 0;
+
+	/** @brief Return the name of the backend */
+	virtual const char* getName(void) = 0;
+};
+
+#endif // _BOARD_BACKEND_H
@@ -5,6 +5,7 @@
 #include <signal.h>
 
 #include "CanFdNiosComm.h"
+#include "AlphiBoard.h"
 
 
 void CanFdNiosComm::fifo_status()
@@ -327,6 +328,35 @@ void CanFdNiosComm::int_function()
 	return;
 }
 
+/** @brief Copy a message in the PC to NIOS ring and advance the write pointer
+ *
+ * The message is copied with block accesses, in two parts when it crosses the end of the ring;
+ * the write pointer is only updated once the message is in the ring.
+ */
+void CanFdNiosComm::writeTxRing(uint16_t idx, const uint8_t* msg, uint16_t lengthInBytes)
+{
+	uint32_t first = txBuffSize - idx;
+
+	if (first > lengthInBytes)
+		first = lengthInBytes;
+	AlphiBoard::mmioWrite(txBuffBase + idx, msg, first);
+	if (first < lengthInBytes)
+		AlphiBoard::mmioWrite(txBuffBase, msg + first, lengthInBytes - first);
+	*txWriteBuffAddr = (uint16_t)(idx + lengthInBytes);
+}
+
+/** @brief Send a message to the NIOS */
+void CanFdNiosComm::sendNiosMessage(uint8_t* msg, uint16_t lengthInBytes)
+{
+	uint16_t idx = *txWriteBuffAddr;
+
+	printf("Sending to NIOS (%x): ", idx);
+	for (uint16_t i = 0; i < lengthInBytes; i++)
+		printf("<%x>", msg[i]);
+	printf("\n");
+	writeTxRing(idx, msg, lengthInBytes);
+}
+
 void CanFdNiosComm::ask_for_board_id()
 {
 
@@ -340,10 +370,8 @@ void CanFdNiosComm::ask_for_board_id()
 	msgBuf[2] = 8;		//length of this message
 	msgBuf[3] = 8;		//length of this message
 	// we leave the address at 0
-	for (int i = 0; i < 0x10000 ; i++) {
-		rxBuffBase[i] = 0;
-		txBuffBase[i] = 0;
-	}
+	AlphiBoard::mmioFill(rxBuffBase, 0, 0x10000);
+	AlphiBoard::mmioFill(txBuffBase, 0, 0x10000);
 	printf("Before sending the command\n");
 	fifo_status();
 	sendNiosMessage(msgBuf, 8);
@@ -352,13 +380,20 @@ void CanFdNiosComm::ask_for_board_id()
 	Sleep(100);
 	printf("After sleeping\n");
 	fifo_status();
-	for (int i = 0; i < 0x10000; i++) {
-		if (rxBuffBase[i] != 0)
-			printf("rxBuffBase[0x%04x] = 0x%02x\n", i, rxBuffBase[i]);
-	}
-	for (int i = 0; i < 0x10000; i++) {
-		if (txBuffBase[i] != 0)
-			printf("txBuffBase[0x%04x] = 0x%02x\n", i, txBuffBase[i]);
+	// scan local copies of the buffers, one block read each instead of 64K byte reads
+	uint8_t* snapshot = (uint8_t*)malloc(0x10000);
+	if (snapshot != NULL) {
+		AlphiBoard::mmioRead(snapshot, rxBuffBase, 0x10000);
+		for (int i = 0; i < 0x10000; i++) {
+			if (snapshot[i] != 0)
+				printf("rxBuffBase[0x%04x] = 0x%02x\n", i, snapshot[i]);
+		}
+		AlphiBoard::mmioRead(snapshot, txBuffBase, 0x10000);
+		for (int i = 0; i < 0x10000; i++) {
+			if (snapshot[i] != 0)
+				printf("txBuffBase[0x%04x] = 0x%02x\n", i, snapshot[i]);
+		}
+		free(snapshot);
 	}
 	rcvNiosMessage(rcvBuf);
 	printf("Received message: ");
@@ -431,14 +466,14 @@ void CanFdNiosComm::ask_for_CAN_ID(uint8_t chan)
 
 void CanFdNiosComm::send_CAN_message(uint8_t chan, struct canfd_frame* cf)
 {
-	int i, data_words;
-	uint8_t* buff_ptr;
+	int data_words;
 	uint16_t buff_idx;
+	uint16_t msgLen;
+	uint8_t msg[12 + CANFD_MAX_DLEN];
 
 	//	fifo_status(bar2, bar3);
 
 	buff_idx = *txWriteBuffAddr;
-	buff_ptr = (uint8_t *)txBuffBase;
 
 	printf("CAN RX message %d\n", chan);
 	printf("Writing %x, to %x\n", CAN_SEND_FRAME, buff_idx);
@@ -447,47 +482,31 @@ void CanFdNiosComm::send_CAN_message(uint8_t chan, struct canfd_frame* cf)
 		data_words = (cf->len >> 2) + 1; // round up to the next 32 bit word
 	else
 		data_words = (cf->len >> 2);
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = CAN_SEND_FRAME; // read from avalon mm address
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = chan; // channel
-	buff_idx = buff_idx + 1;
-	*((volatile uint16_t*)(buff_ptr + buff_idx)) = data_words * 4 + 12; //length of this message
-	buff_idx = buff_idx + 2;
-	*((volatile uint32_t*)(buff_ptr + buff_idx)) = cf->can_id; //
-	buff_idx = buff_idx + 4; // 8
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->len; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->flags; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->__res0; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->__res1; //
-	buff_idx = buff_idx + 1; // 12
-
-
-	for (i = 0; i < data_words; i++) { // could be optimized to one transfer
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 1];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 2];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 3];
-		buff_idx = buff_idx + 1;
-	}
-	*txWriteBuffAddr = buff_idx; // notify
+	// build the message locally, then copy it in one block
+	msg[0] = CAN_SEND_FRAME;
+	msg[1] = chan; // channel
+	msgLen = data_words * 4 + 12; //length of this message
+	memcpy(msg + 2, &msgLen, 2);
+	memcpy(msg + 4, &cf->can_id, 4); // 8
+	msg[8] = cf->len;
+	msg[9] = cf->flags;
+	msg[10] = cf->__res0;
+	msg[11] = cf->__res1; // 12
+	memcpy(msg + 12, cf->data, data_words * 4);
+
+	writeTxRing(buff_idx, msg, msgLen); // copy and notify
 }
 
 void CanFdNiosComm::send_CANFD_message(uint8_t chan, struct canfd_frame* cf)
 {
-	int i, data_words;
-	uint8_t* buff_ptr;
+	int data_words;
 	uint16_t buff_idx;
+	uint16_t msgLen;
+	uint8_t msg[12 + CANFD_MAX_DLEN];
 
 	//	fifo_status(bar2, bar3);
 
 	buff_idx = *txWriteBuffAddr;
-	buff_ptr = (uint8_t*)txBuffBase;
 
 	printf("CAN RX message %d\n", chan);
 	printf("Writing %x, to %x\n", CANFD_SEND_FRAME, buff_idx);
@@ -496,35 +515,19 @@ void CanFdNiosComm::send_CANFD_message(uint8_t chan, struct canfd_frame* cf)
 		data_words = (cf->len >> 2) + 1; // round up to the next 32 bit word
 	else
 		data_words = (cf->len >> 2);
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = CANFD_SEND_FRAME; // read from avalon mm address
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = chan; // channel
-	buff_idx = buff_idx + 1;
-	*((volatile uint16_t*)(buff_ptr + buff_idx)) = data_words * 4 + 12; //length of this message
-	buff_idx = buff_idx + 2;
-	*((volatile uint32_t*)(buff_ptr + buff_idx)) = cf->can_id; //
-	buff_idx = buff_idx + 4; // 8
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->len; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->flags; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->__res0; //
-	buff_idx = buff_idx + 1;
-	*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->__res1; //
-	buff_idx = buff_idx + 1; // 12
-
-
-	for (i = 0; i < data_words; i++) { // could be optimized to one transfer
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 1];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 2];
-		buff_idx = buff_idx + 1;
-		*((volatile uint8_t*)(buff_ptr + buff_idx)) = cf->data[i + 3];
-		buff_idx = buff_idx + 1;
-	}
-	*txWriteBuffAddr = buff_idx; // notify
+	// build the message locally, then copy it in one block
+	msg[0] = CANFD_SEND_FRAME;
+	msg[1] = chan; // channel
+	msgLen = data_words * 4 + 12; //length of this message
+	memcpy(msg + 2, &msgLen, 2);
+	memcpy(msg + 4, &cf->can_id, 4); // 8
+	msg[8] = cf->len;
+	msg[9] = cf->flags;
+	msg[10] = cf->__res0;
+	msg[11] = cf->__res1; // 12
+	memcpy(msg + 12, cf->data, data_words * 4);
+
+	writeTxRing(buff_idx, msg, msgLen); // copy and notify
 }
 
 uint16_t CanFdNiosComm::rcvNiosMessage(uint8_t* msg)
@@ -98,16 +98,7 @@ public:
 	void ask_for_timestamp();
 	void fifo_status();
 
-	void sendNiosMessage(uint8_t *msg, uint16_t lengthInBytes) {
-		printf("Sending to NIOS (%x): ", *txWriteBuffAddr);
-		uint16_t i;
-		for (i = 0; i < lengthInBytes; i++) {
-			txBuffBase[*txWriteBuffAddr + i] = msg[i];
-			printf("<%x>", msg[i]);
-		}
-		printf("\n");
-		*txWriteBuffAddr += i;
-	}
+	void sendNiosMessage(uint8_t *msg, uint16_t lengthInBytes);
 
 	bool isCommandCodeValid(uint8_t cc)
 	{
@@ -134,6 +125,8 @@ private:
 	static const uint32_t rxBuffBase_offset = 0x3fe0000ul;
 	static const uint32_t rxReadBuffAddr_offset = 0x100;
 	static const uint32_t rxWriteBuffAddr_offset = 0x10a;
+	static const uint32_t txBuffSize = 0x10000;				///< The ring wraps with the 16-bit pointers
 
+	void writeTxRing(uint16_t idx, const uint8_t* msg, uint16_t lengthInBytes);
 
 };
@@ -0,0 +1,199 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file DmaBufferProvider.h
+* @brief Host memory buffers the board DMA controllers can reach
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _DMA_BUFFER_PROVIDER_H
+#define _DMA_BUFFER_PROVIDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+
+class DmaBufferProvider;
+
+/** @brief Host buffer locked in memory, with the bus address of its pages
+ *
+ * The buffer is made of chunks of chunkSize bytes, each one physically contiguous. Consecutive
+ * chunks may or may not be contiguous on the bus: getContiguousLength() tells how far a DMA
+ * can go from an offset.
+ */
+class DLL DmaBuffer
+{
+public:
+	void* address;					///< User space address
+	size_t length;					///< Usable length in bytes
+	size_t chunkSize;				///< Size of the physically contiguous chunks
+	uint32_t nbrOfChunks;
+	uint64_t* busAddress;			///< Bus address of each chunk
+	DmaBufferProvider* provider;	///< Provider that allocated the buffer, used to release it
+	size_t mappedLength;			///< Length of the mapping, provider specific
+	int fd;							///< File descriptor of the mapping, -1 if none
+
+	/** @brief Bus address of a byte of the buffer */
+	inline uint64_t getBusAddress(size_t offset)
+	{
+		return busAddress[offset / chunkSize] + offset % chunkSize;
+	}
+
+	/** @brief Number of bytes contiguous on the bus from an offset, up to the end of the buffer */
+	inline size_t getContiguousLength(size_t offset)
+	{
+		if (offset >= length)
+			return 0;
+		uint32_t chunk = (uint32_t)(offset / chunkSize);
+		size_t len = chunkSize - offset % chunkSize;
+		while (chunk + 1 < nbrOfChunks && busAddress[chunk + 1] == busAddress[chunk] + chunkSize) {
+			chunk++;
+			len += chunkSize;
+		}
+		return (offset + len > length) ? length - offset : len;
+	}
+};
+
+/** @brief Allocator of DMA buffers
+ *
+ * The board classes get their DMA buffers from a provider, selected with
+ * AlphiBoard::setDmaProvider(). The default one uses huge pages; SimDmaProvider allocates plain
+ * memory with made-up bus addresses, for the simulated board and the tests.
+ */
+class DLL DmaBufferProvider
+{
+public:
+	virtual ~DmaBufferProvider() {}
+
+	/** @brief Allocate a buffer locked in memory
+	 * @param length Length in bytes.
+	 * @param buffer Receives the buffer descriptor.
+	 * @retval ERRCODE_INVALID_VALUE if the length is 0 or too large for the provider.
+	 * @retval ERRCODE_PERMISSION_DENIED if the bus addresses cannot be resolved.
+	 */
+	virtual PCIeMini_status allocate(size_t length, DmaBuffer** buffer) = 0;
+
+	/** @brief Release a buffer allocated by allocate() */
+	virtual void release(DmaBuffer* buffer) = 0;
+
+	/** @brief Return the name of the provider */
+	virtual const char* getName(void) = 0;
+};
+
+/** @brief Buffers in locked huge pages, bus addresses read in /proc/self/pagemap
+ *
+ * Each huge page is physically contiguous, so a 2 MB huge page gives a 2 MB DMA window. The
+ * huge pages must be reserved (vm.nr_hugepages). The fallback to locked regular pages is for
+ * test benches only: mlock() keeps a regular page resident but does not stop the kernel from
+ * migrating it, so the device could write to a frame given to someone else. Reading the physical addresses requires CAP_SYS_ADMIN, and they are
+ * bus addresses only when the IOMMU is off or in pass-through mode, as with uio_pci_generic.
+ */
+class DLL HugePageDmaProvider : public DmaBufferProvider
+{
+public:
+	HugePageDmaProvider(bool fallbackToSmallPages = false);
+
+	PCIeMini_status allocate(size_t length, DmaBuffer** buffer);
+	void release(DmaBuffer* buffer);
+
+	inline const char* getName(void)
+	{
+		return "hugepage";
+	}
+
+	/** @brief Size of the huge pages, read in /proc/meminfo */
+	inline size_t getHugePageSize(void)
+	{
+		return hugePageSize;
+	}
+
+private:
+	size_t hugePageSize;
+	bool fallback;
+
+	PCIeMini_status resolve(DmaBuffer* buffer);
+};
+
+/** @brief Buffer of the u-dma-buf kernel module
+ *
+ * The module allocates a physically contiguous buffer at load time and exports it as
+ * /dev/udmabufN, with its physical address in /sys/class/u-dma-buf/udmabufN/phys_addr. The
+ * whole device is a single buffer: only one allocation at a time.
+ */
+class DLL UdmabufDmaProvider : public DmaBufferProvider
+{
+public:
+	UdmabufDmaProvider(const char* deviceName = "udmabuf0");
+
+	PCIeMini_status allocate(size_t length, DmaBuffer** buffer);
+	void release(DmaBuffer* buffer);
+
+	inline const char* getName(void)
+	{
+		return "u-dma-buf";
+	}
+
+private:
+	char name[32];
+	bool inUse;
+};
+
+/** @brief Plain memory with made-up bus addresses, for the simulated board and the tests
+ *
+ * The chunks of a buffer get consecutive bus addresses from busBase, unless scatter is set:
+ * then each chunk is separated from the next one by a hole, to exercise the code splitting the
+ * transfers.
+ */
+class DLL SimDmaProvider : public DmaBufferProvider
+{
+public:
+	SimDmaProvider(uint64_t busBase = 0x100000000ull, size_t chunkSize = 0x1000, bool scatter = false);
+
+	PCIeMini_status allocate(size_t length, DmaBuffer** buffer);
+	void release(DmaBuffer* buffer);
+
+	inline const char* getName(void)
+	{
+		return "simulated";
+	}
+
+	/** @brief Number of buffers currently allocated */
+	inline int getAllocatedCount(void)
+	{
+		return allocatedCount;
+	}
+
+private:
+	uint64_t nextBusAddress;
+	size_t simChunkSize;
+	bool simScatter;
+	int allocatedCount;
+};
+
+#endif // _DMA_BUFFER_PROVIDER_H
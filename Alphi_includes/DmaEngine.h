@@ -0,0 +1,180 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file DmaEngine.h
+* @brief Asynchronous submission of DMA transfers
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _DMA_ENGINE_H
+#define _DMA_ENGINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+#include "AlteraDma.h"
+#include "PcieCra.h"
+#include "DmaBufferProvider.h"
+#include "LatencyHistogram.h"
+
+class DmaEngine;
+class DmaRequest;
+
+/** @brief Completion callback of a request, called by the executor thread of the engine */
+typedef void (DmaRequestCallback)(void* handle, DmaRequest* req);
+
+/** @brief Transfer submitted to a DmaEngine, and the future of its result
+ *
+ * The request belongs to the engine from submit() until isDone() is true: it must not be
+ * modified, submitted again or destroyed in the meantime. The completion callback is called
+ * before the request is marked done, so the callback has returned when wait() returns.
+ */
+class DLL DmaRequest
+{
+public:
+	static const uint32_t waitForever = 0xffffffff;
+
+	DmaRequest();
+	~DmaRequest();
+
+	PCIeMini_status wait(uint32_t timeoutUs = waitForever);
+
+	/** @brief True when the transfer is over and getResult() is valid */
+	inline bool isDone()
+	{
+		return __atomic_load_n(&state, __ATOMIC_ACQUIRE) == stateDone;
+	}
+
+	/** @brief Result of the transfer, ERRCODE_TIMEOUT if it was dropped by DmaEngine::stop() */
+	inline PCIeMini_status getResult()
+	{
+		return result;
+	}
+
+	TransferDesc desc;				///< Transfer, set by the caller before submit(), or by submitHost()
+	DmaRequestCallback* done;		///< Called at the end of the transfer, NULL for none
+	void* handle;					///< User data given to done
+
+private:
+	friend class DmaEngine;
+
+	enum { stateIdle, statePending, stateDone };
+
+	int state;
+	PCIeMini_status result;
+	int trEntry;					///< Translation entry pinned by submitHost(), -1 if none
+	DmaEngine* engine;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;			///< Signaled when the request is done
+
+	void finish(PCIeMini_status status);
+};
+
+/** @brief Asynchronous front end of an AlteraDma controller
+ *
+ * submit() queues a transfer and returns at once; the transfers are chained by an
+ * AlteraDmaQueue and their callbacks run on the executor thread of the engine, so the
+ * interrupt thread and the submitting threads are never blocked by the users' processing.
+ * The number of requests in flight is bounded: submit() blocks, or fails with ERRCODE_BUSY
+ * when called with no timeout, until a request completes.
+ *
+ * The engine owns the controller from start() to stop(). The other clients of the controller
+ * (TcanInterface burst reads) fall back to the processor meanwhile.
+ *
+ * In interrupt mode, irqHandler() must be hooked on the DMA interrupt with the engine as user
+ * data, and unhooked before stop(). In polling mode, the executor thread polls the controller
+ * while requests are in flight.
+ */
+class DLL DmaEngine
+{
+public:
+	static const uint32_t maxInFlight = AlteraDmaQueue::nbrOfSlots;
+
+	DmaEngine(AlteraDma* dmaCtrl, PcieCra* pcieCra = NULL);
+	~DmaEngine();
+
+	PCIeMini_status start(uint32_t inFlightLimit = 8, bool irqMode = false);
+	void stop(uint32_t timeoutMs = 1000);
+	PCIeMini_status submit(DmaRequest* req, uint32_t timeoutUs = DmaRequest::waitForever);
+	PCIeMini_status submitHost(DmaRequest* req, DmaBuffer* buffer, size_t offset, uint32_t length, bool fToDev,
+		uint32_t localAddress, uint32_t timeoutUs = DmaRequest::waitForever);
+	void clearStats();
+	void printStats(const char* title = 0);
+
+	/** @brief Interrupt handler, to be hooked on the DMA interrupt with the engine as user data */
+	static void irqHandler(void* context)
+	{
+		AlteraDmaQueue* q = ((DmaEngine*)context)->queue;
+		if (q != NULL)
+			q->service();
+	}
+
+	/** @brief Number of requests submitted and not done */
+	inline uint32_t getInFlight()
+	{
+		return __atomic_load_n(&inFlight, __ATOMIC_ACQUIRE);
+	}
+
+	inline bool isRunning()
+	{
+		return running;
+	}
+
+	LatencyHistogram submitWait;		///< Time spent by submit() waiting for room in the in-flight queue
+	LatencyHistogram completionTime;	///< From the submission to the call of the completion callback
+
+private:
+	AlteraDma* dma;
+	PcieCra* cra;
+	AlteraDmaQueue* queue;				///< Created by start()
+	uint32_t limit;						///< Maximum number of requests in flight
+	uint32_t inFlight;
+	uint64_t completions;				///< Number of requests done since start()
+	DmaRequest* doneRing[maxInFlight];	///< Requests completed by the controller, waiting for the executor
+	uint32_t doneHead;
+	uint32_t doneTail;
+	bool running;
+	bool accepting;						///< False while stopping
+	bool stopRequest;
+	bool useIrq;
+	pthread_t executor;
+	pthread_mutex_t lock;
+	pthread_cond_t executorCond;		///< Signaled on completions, on submissions in polling mode and on stop
+	pthread_cond_t slotCond;			///< Signaled when a request leaves the in-flight queue
+
+	static void queueDone(void* handle, TransferDesc* t);
+	static void* executorEntry(void* context);
+	void executorLoop();
+	void complete(DmaRequest* req);
+	PCIeMini_status submitUntil(DmaRequest* req, uint64_t deadline);
+	int waitUntil(pthread_cond_t* cond, uint64_t deadline);
+	static uint64_t deadlineOf(uint32_t timeoutUs);
+};
+
+#endif // _DMA_ENGINE_H
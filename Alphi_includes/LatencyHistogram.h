@@ -0,0 +1,215 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file LatencyHistogram.h
+* @brief Lock-free latency histogram with HDR-style log-linear buckets
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "AlphiDll.h"
+
+/** @brief Latency histogram with a bounded relative error
+ *
+ * Values are nanoseconds. The bucket width doubles with each power of two, and each power
+ * of two is split in subBucketCount linear sub-buckets, so the error on a recorded value
+ * is less than 1/subBucketCount (6%) whatever the magnitude. Values above 2^maxBits ns are
+ * counted in the last bucket.
+ *
+ * The histogram has a single writer, usually the interrupt thread. Recording does not take any
+ * lock, and any other thread can take a consistent-enough copy with snapshot() while the
+ * writer is running.
+ */
+class DLL LatencyHistogram
+{
+public:
+	static const int subBucketBits = 4;								///< log2 of the number of linear sub-buckets
+	static const int subBucketCount = 1 << subBucketBits;			///< linear sub-buckets per power of 2
+	static const int maxBits = 40;									///< largest tracked value is 2^40 ns, about 18 minutes
+	static const int nbrOfBuckets = (maxBits - subBucketBits + 1) * subBucketCount;
+
+	inline LatencyHistogram()
+	{
+		reset();
+	}
+
+	/** @brief Return the current time of the monotonic clock in nanoseconds */
+	static inline uint64_t getTimeNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	}
+
+	/** @brief Bucket number of a value */
+	static inline int bucketIndex(uint64_t value)
+	{
+		if (value < (uint64_t)subBucketCount)
+			return (int)value;
+		int exp = 63 - __builtin_clzll(value);
+		if (exp >= maxBits)
+			return nbrOfBuckets - 1;
+		return (exp - subBucketBits + 1) * subBucketCount
+			+ (int)((value >> (exp - subBucketBits)) & (subBucketCount - 1));
+	}
+
+	/** @brief Smallest value counted in a bucket */
+	static inline uint64_t bucketLowValue(int index)
+	{
+		if (index < subBucketCount)
+			return index;
+		int exp = index / subBucketCount + subBucketBits - 1;
+		return (uint64_t)(subBucketCount + index % subBucketCount) << (exp - subBucketBits);
+	}
+
+	/** @brief Clear the histogram
+	 *
+	 * If the writer is recording at the same time, its sample may be partially lost.
+	 */
+	inline void reset()
+	{
+		for (int i = 0; i < nbrOfBuckets; i++)
+			__atomic_store_n(&counts[i], 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&totalCount, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&sum, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&minValue, UINT64_MAX, __ATOMIC_RELAXED);
+		__atomic_store_n(&maxValue, 0, __ATOMIC_RELAXED);
+	}
+
+	/** @brief Record a value, from the writer thread only
+	 * @param value Latency in nanoseconds
+	 */
+	inline void record(uint64_t value)
+	{
+		int i = bucketIndex(value);
+		__atomic_store_n(&counts[i], __atomic_load_n(&counts[i], __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&sum, __atomic_load_n(&sum, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+		if (value < __atomic_load_n(&minValue, __ATOMIC_RELAXED))
+			__atomic_store_n(&minValue, value, __ATOMIC_RELAXED);
+		if (value > __atomic_load_n(&maxValue, __ATOMIC_RELAXED))
+			__atomic_store_n(&maxValue, value, __ATOMIC_RELAXED);
+		__atomic_store_n(&totalCount, __atomic_load_n(&totalCount, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+	}
+
+	/** @brief Copy the histogram while the writer may be recording
+	 * @param dest Destination histogram, owned by the caller
+	 */
+	inline void snapshot(LatencyHistogram* dest) const
+	{
+		dest->totalCount = __atomic_load_n(&totalCount, __ATOMIC_ACQUIRE);
+		uint64_t n = 0;
+		for (int i = 0; i < nbrOfBuckets; i++) {
+			dest->counts[i] = __atomic_load_n(&counts[i], __ATOMIC_RELAXED);
+			n += dest->counts[i];
+		}
+		// the buckets are the reference, the total may lag behind by one sample
+		dest->totalCount = n;
+		dest->sum = __atomic_load_n(&sum, __ATOMIC_RELAXED);
+		dest->minValue = __atomic_load_n(&minValue, __ATOMIC_RELAXED);
+		dest->maxValue = __atomic_load_n(&maxValue, __ATOMIC_RELAXED);
+	}
+
+	/** @brief Number of recorded values */
+	inline uint64_t getCount() const
+	{
+		return totalCount;
+	}
+
+	/** @brief Smallest recorded value in ns, 0 if empty */
+	inline uint64_t getMin() const
+	{
+		return totalCount == 0 ? 0 : minValue;
+	}
+
+	/** @brief Largest recorded value in ns */
+	inline uint64_t getMax() const
+	{
+		return maxValue;
+	}
+
+	/** @brief Average of the recorded values in ns */
+	inline double getMean() const
+	{
+		return totalCount == 0 ? 0.0 : (double)sum / totalCount;
+	}
+
+	/** @brief Value at a given percentile
+	 * @param percentile Percentile, from 0.0 to 100.0
+	 * @retval Low boundary of the bucket holding the percentile, in ns, bounded by the recorded min and max.
+	 */
+	inline uint64_t getPercentile(double percentile) const
+	{
+		if (totalCount == 0)
+			return 0;
+		uint64_t target = (uint64_t)(percentile / 100.0 * totalCount + 0.5);
+		if (target < 1) target = 1;
+		uint64_t n = 0;
+		for (int i = 0; i < nbrOfBuckets; i++) {
+			n += counts[i];
+			if (n >= target) {
+				uint64_t v = bucketLowValue(i);
+				if (v < minValue) v = minValue;
+				if (v > maxValue) v = maxValue;
+				return v;
+			}
+		}
+		return maxValue;
+	}
+
+	/** @brief Count in a bucket */
+	inline uint64_t getBucketCount(int index) const
+	{
+		return (index >= 0 && index < nbrOfBuckets) ? counts[index] : 0;
+	}
+
+	/** @brief Print a summary of the histogram
+	 * @param name Name printed in front of the line
+	 */
+	inline void print(const char* name) const
+	{
+		printf("%-20s n=%llu min=%.3fus mean=%.3fus p50=%.3fus p99=%.3fus p99.9=%.3fus max=%.3fus\n", name,
+			(unsigned long long)getCount(), getMin() / 1000.0, getMean() / 1000.0,
+			getPercentile(50.0) / 1000.0, getPercentile(99.0) / 1000.0, getPercentile(99.9) / 1000.0,
+			getMax() / 1000.0);
+	}
+
+private:
+	uint64_t counts[nbrOfBuckets];
+	uint64_t totalCount;
+	uint64_t sum;
+	uint64_t minValue;
+	uint64_t maxValue;
+};
+
+#endif // _LATENCY_HISTOGRAM_H
@@ -113,11 +113,9 @@ public:
 			buff_in[i] = 0;
 		}
 
-		uint32_t prevValue = controlReg->getData() & ~(controlReg->CTRL_DA_CLEAR_mask);
-
-		controlReg->setData(prevValue | controlReg->CTRL_DA_CLEAR_mask);
+		controlReg->setBits(controlReg->CTRL_DA_CLEAR_mask);
 		Sleep(20);
-		controlReg->setData(prevValue);
+		controlReg->clearBits(controlReg->CTRL_DA_CLEAR_mask);
 	}
 
 	PCIeMini_status setCode(int16_t code, ChannelNbr channel, ChannelNbr update = CHANNEL_NONE, bool echo = false);
@@ -132,10 +132,10 @@ public:
     inline PCIeMini_status enableSpiDa(bool enabled)
     {
         if (enabled) {
-            setData(getData() | CTRL_DaMode_mask | CTRL_LDAC_mask);
+            setBits(CTRL_DaMode_mask | CTRL_LDAC_mask);
         }
         else {
-            setData(getData() & ~(CTRL_DaMode_mask | CTRL_LDAC_mask));
+            clearBits(CTRL_DaMode_mask | CTRL_LDAC_mask);
         }
         return ERRCODE_NO_ERROR;
     }
@@ -47,6 +47,7 @@
 #include "ParallelInput.h"
 #include "AlteraDma.h"
 #include "PcieCra.h"
+#include "TcanSpiArbiter.h"
 
 // parallel input 0 definitions
 #define PI_nINT_0		0x0001
@@ -81,6 +82,10 @@ public:
 	PCIeMini_status close();
 	PCIeMini_status reset();
 
+	PCIeMini_status startSpiArbiter(TcanSpiArbiter::Policy policy = TcanSpiArbiter::policyFair,
+		uint32_t quantum = TcanSpiArbiter::defaultQuantum);
+	void stopSpiArbiter();
+
 	TCAN4550 *can[nbrOfCanInterfaces];
 	AlteraPio* controlRegister;		///< Interface to the board control register
 	AlteraPio* ledPio;		///< Interface to the board control register
@@ -88,13 +93,39 @@ public:
 	ParallelInput* input1;
 	IrigDecoder* irig;
 	AlteraDma* dma;
+	TcanSpiArbiter* spiArbiter;		///< Owner of the SPI controller shared by the TCAN chips
 
 	volatile uint32_t* dpr;
 	volatile uint16_t* mddr;
 	static const uint32_t	dpr_offset = 0x4000;  
 	static const uint32_t	dpr_length = 0x400;   
+	static const uint32_t	dmaStaging_offset = 0x200;	///< Staging area of the TCAN burst reads by DMA, in the DPR
+	static const uint32_t	dmaStaging_length = 0x200;
 
-#ifndef LINUX
+#ifdef LINUX
+	void hwDMAStart(TransferDesc* tfrDesc);
+	bool hwDMAWaitForCompletion(TransferDesc* tfrDesc, bool fPolling);
+	void hwDMARelease(TransferDesc* tfrDesc);
+	PCIeMini_status hwDMAInterruptEnable(int irqNbr = -1, MINIPCIE_INT_HANDLER handler = NULL, void* userData = NULL);
+	void hwDMAInterruptDisable();
+	int findDMAIrqLine();
+	PCIeMini_status hwDMAProgram(
+		DmaBuffer* buffer,
+		size_t offset,
+		uint32_t length,
+		bool fToDev,
+		uint32_t u32LocalAddr,
+		TransferDesc* tfrDesc);
+	PCIeMini_status hwDMAProgramChain(
+		DmaBuffer* buffer,
+		size_t offset,
+		uint32_t length,
+		bool fToDev,
+		uint32_t u32LocalAddr,
+		TransferDesc* tfrDesc,
+		int maxDesc,
+		int* nbrOfDesc);
+#else
 	void hwDMAStart(TransferDesc* tfrDesc);
 	bool hwDMAWaitForCompletion(TransferDesc* tfrDesc, bool fPolling);
 	bool hwDMAInterruptEnable(MINIPCIE_INT_HANDLER MyDmaIntHandler, void* pDMA);
@@ -126,6 +157,8 @@ private:
 	static const uint32_t	mddr_offset = 0x0000;		// 0x0000_0fff
 	static const uint32_t	txs_offset = 0x02000000;	///< Address of the txs in the Avalon bus, BAR2. Typically not reachable from the PC
 
+	int dmaIrqNbr;						///< Avalon interrupt line of the DMA controller, -1 when the DMA interrupt is not used
+
 
 
 };
@@ -36,9 +36,13 @@
 
 #include "AlphiDll.h"
 #include <stdint.h>
+#include "AvalonRegister.h"
 #include "AlphiErrorCodes.h"
 
 /** @brief Alphi Avalon digital input controller class
+ *
+ * The interrupt enable register is owned by the host. In shadow mode, see setShadowMode(),
+ * the class keeps a copy of it and updates it without reading the hardware.
 */
 class ParallelInput
 {
@@ -50,6 +54,35 @@ public:
     inline ParallelInput(volatile void* addr)
     {
         base = (volatile uint32_t*)addr;
+        shadowEnabled = false;
+        irqEnableShadow = 0;
+    }
+
+    /** @brief Enable or disable the shadow copy of the interrupt enable register
+     *
+     * In shadow mode, setIrqEnable() and setIrqDisable() modify a host-side copy and write it,
+     * instead of doing a read-modify-write over PCIe, and getIrqEnable() returns the copy.
+     * Only use it when nothing else modifies the register. Enabling the mode reads the
+     * hardware once, see resync().
+     * @param enable True to use the shadow copy.
+     */
+    inline void setShadowMode(bool enable)
+    {
+        if (enable)
+            resync();
+        shadowEnabled = enable;
+    }
+
+    /** @brief Return true if the shadow copy is in use */
+    inline bool getShadowMode()
+    {
+        return shadowEnabled;
+    }
+
+    /** @brief Reload the shadow copy from the hardware */
+    inline void resync()
+    {
+        irqEnableShadow = IrqEnableReg::read(base);
     }
 
     /** @brief Reset the PIO
@@ -60,7 +93,8 @@ public:
      */
     inline PCIeMini_status reset()
     {
-        base[irqEnable_index] = 0;
+        IrqEnableReg::write(base, 0);
+        irqEnableShadow = 0;
         clearIrqStatus(0xffffffff);     
 
         return ERRCODE_NO_ERROR;
@@ -68,7 +102,7 @@ public:
 
     inline uint32_t getData()
     {
-        return base[data_index];
+        return DataReg::read(base);
     }
 
     /** @brief Retrieve the interrupt mask
@@ -79,7 +113,9 @@ public:
      */
     inline uint32_t getIrqEnable()
     {
-        return base[irqEnable_index];
+        if (shadowEnabled)
+            return irqEnableShadow;
+        return IrqEnableReg::read(base);
     }
 
     /** @brief Enable bits in the interrupt mask
@@ -91,8 +127,12 @@ public:
      */
     inline uint32_t setIrqEnable(uint32_t mask)
     {
-        base[irqEnable_index] |= mask;
-        return base[irqEnable_index];
+        if (shadowEnabled) {
+            irqEnableShadow |= mask;
+            IrqEnableReg::write(base, irqEnableShadow);
+            return irqEnableShadow;
+        }
+        return IrqEnableReg::modify(base, 0, mask);
     }
 
     /** @brief Disable bits in the interrupt mask
@@ -104,8 +144,12 @@ public:
      */
     inline uint32_t setIrqDisable(uint32_t mask)
     {
-        base[irqEnable_index] &= ~mask;
-        return base[irqEnable_index];
+        if (shadowEnabled) {
+            irqEnableShadow &= ~mask;
+            IrqEnableReg::write(base, irqEnableShadow);
+            return irqEnableShadow;
+        }
+        return IrqEnableReg::modify(base, mask, 0);
     }
 
     /** @brief Return the interrupt status
@@ -114,7 +158,7 @@ public:
     */
     inline uint32_t getIrqStatus()
     {
-        return base[irqStatus_index];
+        return IrqStatusReg::read(base);
     }
 
     /** @brief Clear the interrupt requests
@@ -123,14 +167,14 @@ public:
     */
     inline uint32_t resetIrq()
     {
-        base[irqStatus_index] = 0;
-        return base[irqStatus_index];
+        IrqStatusReg::write(base, 0);
+        return IrqStatusReg::read(base);
     }
 
 
     inline PCIeMini_status clearIrqStatus(uint32_t mask)
     {
-        base[irqStatus_index] = mask;
+        IrqStatusReg::write(base, mask);
         return ERRCODE_NO_ERROR;
     }
 
@@ -138,21 +182,32 @@ public:
 
     inline void setDataOut(uint32_t data)
     {
-        base[dataOut_index] = data;
+        DataOutReg::write(base, data);
     }
 
     inline void setEdgeCapture(uint32_t data)
     {
-        base[edgeReg_Index] = data;
+        EdgeReg::write(base, data);
     }
 
-    int data_index = 0;         ///< Input bit status
-    int polarity_index = 1;     ///< polarity: when set to 1, the interrupt is requested if the corresponding bit is low.
-    int edgeReg_Index = 2;      ///< edge register: when a bit is set to 1, the interrupt is generated on an edge
-    int irqStatus_index = 3;    ///< Which bit is requesting an interrupt
-    int irqEnable_index = 4;    ///< Which bit can request an interrupt
-    int direction_index = 5;    ///< Each bit set to 1 indicates that the corresponding bit in the data register is coming from the data_out register
-    int dataOut_index = 6;      ///< used to simulate an input
-    int irqDelay_index = 7;     ///< Debouncing constant
+    typedef AvalonReg<0, REG_RO> DataReg;           ///< Input bit status
+    typedef AvalonReg<1, REG_RW> PolarityReg;       ///< polarity: when set to 1, the interrupt is requested if the corresponding bit is low.
+    typedef AvalonReg<2, REG_RW> EdgeReg;           ///< edge register: when a bit is set to 1, the interrupt is generated on an edge
+    typedef AvalonReg<3, REG_RW> IrqStatusReg;      ///< Which bit is requesting an interrupt
+    typedef AvalonReg<4, REG_RW> IrqEnableReg;      ///< Which bit can request an interrupt
+    typedef AvalonReg<5, REG_RW> DirectionReg;      ///< Each bit set to 1 indicates that the corresponding bit in the data register is coming from the data_out register
+    typedef AvalonReg<6, REG_RW> DataOutReg;        ///< used to simulate an input
+    typedef AvalonReg<7, REG_RW> IrqDelayReg;       ///< Debouncing constant
+
+    static const int data_index = DataReg::index;
+    static const int polarity_index = PolarityReg::index;
+    static const int edgeReg_Index = EdgeReg::index;
+    static const int irqStatus_index = IrqStatusReg::index;
+    static const int irqEnable_index = IrqEnableReg::index;
+    static const int direction_index = DirectionReg::index;
+    static const int dataOut_index = DataOutReg::index;
+    static const int irqDelay_index = IrqDelayReg::index;
 private:
+    bool shadowEnabled;         ///< When true, the interrupt enable register is updated from the shadow copy
+    uint32_t irqEnableShadow;   ///< Last value written to the interrupt enable register
 };
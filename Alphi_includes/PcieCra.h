@@ -35,9 +35,18 @@
 #pragma once
 #include <stdint.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "AlphiDll.h"
 #include "AlphiErrorCodes.h"
 
+/** @brief Interrupt moderation counters of one interrupt source */
+typedef struct IrqModerationCounters {
+	uint64_t interrupts;		///< Interrupts taken from the source
+	uint64_t coalesced;			///< Source activity served at the end of a window, without an interrupt
+	uint64_t windows;			///< Number of times the source has been masked
+	uint64_t unclaimed;			///< Number of times the source has been masked because no handler served it
+} IrqModerationCounters;
+
 /** @brief PCIe CRA module controller class
  *
  * This is a limited software interface to the CRA module of the PCIe adapter that: 
@@ -79,16 +88,130 @@
 class DLL PcieCra
 {
 public:
+	static const uint32_t avlIrqMask = 0x0000ffff;			///< AVL_IRQ bits in the status and enable registers
+	static const uint32_t a2pMailboxIrqMask = 0x00ff0000;	///< A2P_MB_IRQ bits in the status and enable registers
+	static const int a2pMailboxIrqShift = 16;				///< Bit position of A2P_MAILBOX_INT0
+	static const int nbrOfIrqSources = 24;					///< 16 Avalon IRQ lines and 8 mailboxes
+
 	PcieCra(volatile void* cra_addr);
 
 	void reset();
 
 	uint32_t getIrqStatus();
+	void clearMailboxIrq(uint32_t mask);
 	void setIrqEnableMask(uint32_t mask);
 	uint32_t getIrqEnableMask();
 
+	PCIeMini_status setIrqModeration(int bitNbr, uint32_t windowUs, uint32_t threshold);
+	PCIeMini_status getIrqModerationCounters(int bitNbr, IrqModerationCounters* counters);
+	void resetIrqModerationCounters();
+
+	/** @brief Return the moderation window of a source in microseconds, 0 if not moderated */
+	inline uint32_t getIrqModerationWindow(int bitNbr)
+	{
+		return __atomic_load_n(&moderationWindowUs[bitNbr], __ATOMIC_RELAXED);
+	}
+
+	/** @brief Return the number of interrupts within a window before a source is masked */
+	inline uint32_t getIrqModerationThreshold(int bitNbr)
+	{
+		return __atomic_load_n(&moderationThreshold[bitNbr], __ATOMIC_RELAXED);
+	}
+
+	/** @brief Return the bit map of the sources with moderation enabled */
+	inline uint32_t getModerationEnabledMask()
+	{
+		return __atomic_load_n(&moderationEnabled, __ATOMIC_ACQUIRE);
+	}
+
+	/** @brief Return the bit map of the sources currently masked by the moderation */
+	inline uint32_t getModeratedMask()
+	{
+		return moderatedMask;
+	}
+
+	/** @brief Return the bit map of the sources currently served by polling */
+	inline uint32_t getPolledMask()
+	{
+		return polledMask;
+	}
+
+	/** @brief Return the bit map of the sources masked because no handler serves them */
+	inline uint32_t getUnclaimedMask()
+	{
+		return unclaimedMask;
+	}
+
+	/** @brief Return the sources that can currently interrupt, without reading the hardware */
+	inline uint32_t getActiveIrqMask()
+	{
+		return irqEnableShadow & ~(moderatedMask | polledMask | unclaimedMask);
+	}
+
+	/** @brief Return the interrupt enable mask requested by the user, without reading the hardware */
+	inline uint32_t getRequestedIrqMask()
+	{
+		return irqEnableShadow;
+	}
+
+	void maskModeratedSources(uint32_t mask);
+	void unmaskModeratedSources(uint32_t mask);
+	void addPolledSources(uint32_t mask);
+	void removePolledSources(uint32_t mask);
+	uint32_t maskUnclaimedSources(uint32_t mask);
+	void unmaskUnclaimedSources(uint32_t mask);
+
+	/** @brief Count an interrupt, called by the interrupt thread */
+	inline void countInterrupt(int bitNbr)
+	{
+		pthread_mutex_lock(&irqEnableLock);
+		moderationCounters[bitNbr].interrupts++;
+		pthread_mutex_unlock(&irqEnableLock);
+	}
+
+	/** @brief Count source activity served without interrupt, called by the interrupt thread */
+	inline void countCoalesced(int bitNbr)
+	{
+		pthread_mutex_lock(&irqEnableLock);
+		moderationCounters[bitNbr].coalesced++;
+		pthread_mutex_unlock(&irqEnableLock);
+	}
+
+	/** @brief Count a moderation window, called by the interrupt thread */
+	inline void countWindow(int bitNbr)
+	{
+		pthread_mutex_lock(&irqEnableLock);
+		moderationCounters[bitNbr].windows++;
+		pthread_mutex_unlock(&irqEnableLock);
+	}
+
+	/** @brief Count a source masked because it had no handler, called by the interrupt thread */
+	inline void countUnclaimed(int bitNbr)
+	{
+		pthread_mutex_lock(&irqEnableLock);
+		moderationCounters[bitNbr].unclaimed++;
+		pthread_mutex_unlock(&irqEnableLock);
+	}
+
 	PCIeMini_status setTxsAvlAddress(uint32_t txs_addr, uint64_t pageSize, uint16_t nbrOfEntries);
 	PCIeMini_status getMappedAddress(uint64_t pcieAddress, int tableEntry, uint32_t* localAddress);
+	PCIeMini_status mapPcieAddress(uint64_t pcieAddress, uint32_t length, uint32_t* localAddress, uint32_t* mappedLength,
+		int* pinnedEntry = NULL);
+	void unpinTrEntry(int entryNbr);
+	void invalidateTrEntries();
+	void getTrStats(uint64_t* hits, uint64_t* writes);
+
+	/** @brief Return the number of address translation entries managed */
+	inline int getNbrOfTrEntries()
+	{
+		return (ttNbrOfEntries > 0 && ttNbrOfEntries <= maxTrEntries) ? ttNbrOfEntries : trNbrOfTrEntries;
+	}
+
+	/** @brief Return the size of the address translation pages set by setTxsAvlAddress() */
+	inline uint64_t getPageSize()
+	{
+		return (uint64_t)ttPageAddressMask + 1;
+	}
 
 	int setTrEntry(int entryNbr, bool is64bitAddress, uint64_t pcieAddress);
 
@@ -121,9 +244,39 @@ private:
 	static const int pcieAddrTrans_offset = 0x1000;
 	static const int trNbrOfTrEntries = 2;		///< Number of address translation entries specified in QSYS
 	static const uint32_t trPageSize = 0x01000000;	///< page size specified in QSYS : 16 MB
+	static const int maxTrEntries = 512;		///< Largest translation table of the PCIe core
+
+	/** @brief Software copy of a translation table entry */
+	typedef struct TrEntryState {
+		uint64_t pageAddress;		///< PCIe address of the page mapped by the entry
+		uint64_t lastUse;			///< Value of trUseCounter at the last use, for the LRU eviction
+		uint32_t pinCount;			///< Number of transfers in flight through the entry, never evicted while not 0
+		bool valid;					///< False until the entry is written
+	} TrEntryState;
 
 	volatile uint32_t* pcieIrqStatus;		///< PCIe interface interrupt status
 	volatile uint32_t* pcieIrqEnable;		///< PCIe interface interrupt enable
 	TransEntry* trEntry;
+
+	// Address translation table manager
+	pthread_mutex_t trLock;					///< Serializes the table updates
+	TrEntryState trState[maxTrEntries];
+	uint64_t trUseCounter;
+	uint64_t trHits;						///< Mappings served by an entry already programmed
+	uint64_t trWrites;						///< Entries written to the CRA
+	void writeTrEntry(int entryNbr, uint64_t pageAddress);
+
+	// Interrupt moderation
+	pthread_mutex_t irqEnableLock;			///< Serializes the enable register and moderation counter updates between the user and the interrupt thread
+	volatile uint32_t irqEnableShadow;		///< Interrupt enable mask requested by the user
+	volatile uint32_t moderatedMask;		///< Sources masked by the moderation
+	volatile uint32_t polledMask;			///< Sources masked because they are served by polling
+	volatile uint32_t unclaimedMask;		///< Sources masked because no handler serves them
+	uint32_t moderationEnabled;				///< Sources with a moderation window, atomic like the window and threshold
+	uint32_t moderationWindowUs[nbrOfIrqSources];
+	uint32_t moderationThreshold[nbrOfIrqSources];
+	IrqModerationCounters moderationCounters[nbrOfIrqSources];
+
+	void writeIrqEnable();
 };
 
@@ -36,6 +36,7 @@
 
 #include "AlphiDll.h"
 #include "MiniSynchStatusRegister.h"
+#include "AvalonRegister.h"
 #include <stdint.h>
 
 /** @brief DDC RD19231 controller class.
@@ -64,7 +65,7 @@ public:
 	 */
 	inline uint32_t getRawPos()
 	{
-		return sync[synchroPos_index];
+		return SynchroPosReg::read(sync);
 	}
 
 	/** @brief Get angular position
@@ -79,13 +80,13 @@ public:
 	/** @brief Maintenance only */
 	inline uint32_t getCycleTime()
 	{
-		return sync[cycleTime_index];
+		return CycleTimeReg::read(sync);
 	}
 
 	/** @brief Maintenance only */
 	inline uint32_t getBusyTime()
 	{
-		return sync[busyTime_index];
+		return BusyTimeReg::read(sync);
 	}
 
 	/** @brief Check if output is valid or if BIT error
@@ -107,7 +108,7 @@ public:
 	 */
 	inline uint32_t getEncoderCounter()
 	{
-		return sync[EncoderCntr_index];
+		return EncoderCntrReg::read(sync);
 	}
 
 	/** @brief for compatibility only */
@@ -116,10 +117,10 @@ public:
 	}
 
 private:
-	static const uint32_t	synchroPos_index = 0;	///< R   32-bit	Synchro Position Data
-	static const uint32_t	busyTime_index = 1;		///< R   32-bit	Converter Busy Time
-	static const uint32_t	cycleTime_index = 2;	///< R   32-bit	Converter Cycle Time
-	static const uint32_t	EncoderCntr_index = 3;	///< R	 32-bit	Encoder Counter Data
+	typedef AvalonReg<0, REG_RO> SynchroPosReg;		///< Synchro Position Data
+	typedef AvalonReg<1, REG_RO> BusyTimeReg;		///< Converter Busy Time
+	typedef AvalonReg<2, REG_RO> CycleTimeReg;		///< Converter Cycle Time
+	typedef AvalonReg<3, REG_RO> EncoderCntrReg;	///< Encoder Counter Data
 
 	volatile uint32_t* sync;
 	StatusRegister* statusReg;
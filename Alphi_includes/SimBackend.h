@@ -0,0 +1,173 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file SimBackend.h
+* @brief Simulated board backend, for running the libraries without hardware
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _SIM_BACKEND_H
+#define _SIM_BACKEND_H
+
+#include <pthread.h>
+#include "BoardBackend.h"
+
+class SimBackend;
+
+/** @brief Behaviour model of some registers of a simulated board
+ *
+ * The BARs of the simulated board are plain memory: writes are not trapped. A model reacts
+ * to what the software wrote when update() is called, for example by clearing a "go" bit,
+ * setting a status bit or calling SimBackend::injectIrq().
+ */
+class DLL SimRegisterModel
+{
+public:
+	virtual ~SimRegisterModel() {}
+
+	/** @brief Update the registers, called with the simulator locked
+	 * @param sim Simulated board, use getBarRegister() to access the registers.
+	 */
+	virtual void update(SimBackend* sim) = 0;
+};
+
+/** @brief Simulated board
+ *
+ * The BARs are anonymous memory. The PCIe CRA interrupt registers of BAR 0 are modelled:
+ * injected interrupt lines and mailboxes appear in the status register, and the interrupt
+ * thread is woken up when one of them is enabled, with the level behaviour of INTx. The
+ * reserved bit 31 of the status register is used as a tag to detect the mailbox acknowledges.
+ *
+ * Models are run by runModels(), called by the interrupt re-arm, by the optional model
+ * thread (setModelPeriod()) or by the test program.
+ *
+ * Usage:
+ * @code
+ * SimBackend* sim = new SimBackend();
+ * board->setBackend(sim);
+ * board->open(0);
+ * sim->injectIrq(0x0001);
+ * @endcode
+ */
+class DLL SimBackend : public BoardBackend
+{
+public:
+	static const size_t defaultBar0Size = 0x4000;		///< CRA and address translation table
+	static const size_t defaultBar2Size = 0x100000;		///< Board components
+	static const int maxModels = 16;					///< Maximum number of register models
+
+	SimBackend(uint16_t vendorId = 0x13c5, uint16_t deviceId = 0x0508);
+	~SimBackend();
+
+	// Configuration, before the board is opened
+	PCIeMini_status setBarSize(int barNbr, size_t size);
+	void setSysId(uint32_t version, uint32_t timeStamp);
+	PCIeMini_status addRegisterModel(SimRegisterModel* model);
+	void setModelPeriod(uint32_t periodUs);
+
+	// Simulation
+	volatile uint32_t* getBarRegister(int barNbr, size_t offset);
+	void runModels(void);
+	void injectIrq(uint32_t mask);
+	void clearIrq(uint32_t mask);
+
+	/** @brief Number of times the interrupt thread has been signaled */
+	inline uint64_t getSignaledIrqCount(void)
+	{
+		return signaledIrqCount;
+	}
+
+	// BoardBackend interface
+	PCIeMini_status open(int brdNbr, uint16_t vendorId, uint16_t deviceId);
+	PCIeMini_status close(void);
+	size_t getBarSize(int barNbr);
+	void* mapBar(int barNbr, bool writeCombined = false, bool* isWriteCombined = NULL);
+	void unmapBar(int barNbr, void* address, size_t length);
+
+	/** @brief eventfd signaled by the simulated interrupts */
+	inline int getIrqFd(void)
+	{
+		return irqFd;
+	}
+
+	PCIeMini_status readIrqCount(uint32_t* count);
+	PCIeMini_status startIrq(IrqRearmMode request);
+	PCIeMini_status rearmIrq(void);
+
+	/** @brief Return the re-arm method in use */
+	inline IrqRearmMode getIrqRearmMode(void)
+	{
+		return irqStarted ? IRQ_REARM_SIMULATED : IRQ_REARM_AUTO;
+	}
+
+	/** @brief Return the name of the backend */
+	inline const char* getName(void)
+	{
+		return "simulated";
+	}
+
+private:
+	static const uint32_t craIrqStatus_offset = 0x40;	///< PCIe CRA interrupt status, in BAR 0
+	static const uint32_t craIrqEnable_offset = 0x50;	///< PCIe CRA interrupt enable, in BAR 0
+	static const uint32_t avlIrqMask = 0x0000ffff;
+	static const uint32_t a2pMailboxIrqMask = 0x00ff0000;
+	static const uint32_t statusTag = 0x80000000;		///< Never written by the driver
+
+	uint16_t simVendorId;
+	uint16_t simDeviceId;
+	size_t barSizes[nbrOfBars];
+	void* barMemory[nbrOfBars];
+	bool isOpen;
+
+	bool sysIdSet;
+	uint32_t sysIdVersion;
+	uint32_t sysIdTimeStamp;
+
+	SimRegisterModel* models[maxModels];
+	int nbrOfModels;
+
+	pthread_mutex_t lock;				///< Recursive, models may inject interrupts
+	int irqFd;
+	bool irqStarted;
+	bool irqSignaled;					///< irqFd signaled and not read yet
+	uint32_t irqLines;					///< Asserted Avalon interrupt lines
+	uint32_t mailboxLatched;			///< Mailbox interrupts not acknowledged yet
+	uint32_t publishedStatus;			///< Value last written in the CRA status register
+	volatile uint64_t signaledIrqCount;
+
+	pthread_t modelThread;
+	bool modelThreadRunning;
+	volatile bool modelThreadStop;
+	uint32_t modelPeriodUs;
+
+	void syncCraStatus(void);
+	void signalIfPending(void);
+	static void* modelThreadEntry(void* arg);
+};
+
+#endif // _SIM_BACKEND_H
@@ -0,0 +1,131 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file SpiCompletion.h
+* @brief Interrupt wait and CPU accounting shared by the SPI controllers
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _SPI_COMPLETION_H
+#define _SPI_COMPLETION_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "AlphiDll.h"
+
+/** @brief Parks a thread until the SPI controller interrupt, and measures the CPU cost of the transfers
+ *
+ * The controller class enables its interrupt source and waits:
+ *   uint32_t seq = completion.arm();
+ *   // enable the interrupt source, then check the status once more
+ *   if (!ready) completion.wait(seq, timeoutUs);
+ * Its interrupt handler, called by the board interrupt thread, silences the source and calls
+ * signal(). The sequence number taken by arm() makes the wait return at once when the interrupt
+ * came between the enable and the wait.
+ *
+ * The transfers shorter than minIrqWords are polled: the interrupt latency would exceed the
+ * transfer time.
+ *
+ * The CPU time is only measured in interrupt mode or after setStatsEnabled(true), the polled
+ * transfers of the default mode do not pay for the clock reads.
+ */
+class DLL SpiCompletion
+{
+public:
+	static const uint32_t defaultMinIrqWords = 16;		///< Shortest transfer waited for by interrupt
+	static const uint32_t defaultTimeoutUs = 10000;		///< Longest sleep before polling again
+
+	SpiCompletion();
+	~SpiCompletion();
+
+	void setIrqMode(bool irqMode, uint32_t minWords = defaultMinIrqWords);
+	uint32_t arm();
+	bool wait(uint32_t seq, uint32_t timeoutUs = defaultTimeoutUs);
+	void signal();
+
+	/** @brief True when a transfer of this length sleeps on the interrupt */
+	inline bool useIrqFor(uint32_t words)
+	{
+		return useIrq && words >= minIrqWords;
+	}
+
+	inline bool getIrqMode()
+	{
+		return useIrq;
+	}
+
+	/** @brief Measure the CPU time of the transfers in polled mode too */
+	inline void setStatsEnabled(bool enable)
+	{
+		statsEnabled = enable;
+	}
+
+	/** @brief Start the CPU time measurement of a transfer, when enabled */
+	inline void beginTransfer()
+	{
+		measuring = statsEnabled || useIrq;
+		if (measuring)
+			transferStartNs = getThreadCpuNs();
+	}
+
+	/** @brief Account the transfer started by beginTransfer(), when measured
+	 * @param words Number of words transferred.
+	 * @param irq True when the transfer was waited for by interrupt.
+	 */
+	inline void endTransfer(uint32_t words, bool irq)
+	{
+		if (measuring)
+			accountTransfer(words, irq);
+	}
+
+	void clearStats();
+	void printStats(const char* title = 0);
+
+	// statistics
+	uint64_t polledWords;			///< Words transferred by polling
+	uint64_t polledCpuNs;			///< CPU time of the calling thread in the polled transfers
+	uint64_t irqWords;				///< Words transferred with interrupt waits
+	uint64_t irqCpuNs;				///< CPU time of the calling thread in the interrupt transfers
+	uint64_t irqWaits;				///< Sleeps on the interrupt
+	uint64_t irqTimeouts;			///< Sleeps ended by the timeout
+
+private:
+	bool useIrq;
+	bool statsEnabled;				///< Measure the polled transfers outside of interrupt mode
+	bool measuring;					///< The current transfer is measured
+	uint32_t minIrqWords;
+	uint32_t irqSeq;				///< Incremented by signal()
+	uint64_t transferStartNs;		///< Thread CPU time at beginTransfer()
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	void accountTransfer(uint32_t words, bool irq);
+	static uint64_t getThreadCpuNs();
+};
+
+#endif // _SPI_COMPLETION_H
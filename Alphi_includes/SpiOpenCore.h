@@ -37,6 +37,8 @@
 
 
 #include "AlphiDll.h"
+#include "AvalonRegister.h"
+#include "SpiCompletion.h"
 
 
 /** @brief Class describing an Open Core SPI interface.
@@ -71,7 +73,7 @@ public:
 	 */
     inline volatile uint32_t getSpiRxData(void)
     {
-        return base[rxData_index];
+        return RxDataReg::read(base);
     }
 
 	/** @brief Read control/status register
@@ -80,7 +82,7 @@ public:
 	 */
     inline volatile uint32_t getSpiStatus(void)
     {
-        return base[control_index];
+        return ControlReg::read(base);
     }
 
 	/** @brief Write the data to transmit
@@ -89,7 +91,7 @@ public:
 	 */
     inline void setSpiTxData(uint32_t data)
     {
-        base[txData_index] = data;
+        TxDataReg::write(base, data);
     }
 
 	/** @brief Write data to the control register
@@ -98,7 +100,7 @@ public:
 	 */
     inline void setSpiControl(uint32_t data)
     {
-        base[control_index] = data;
+        ControlReg::write(base, data);
     }
 
 	/** @brief Read control/status register
@@ -108,7 +110,7 @@ public:
 	 */
     inline uint32_t getSpiControl(void)
     {
-        return base[control_index];
+        return ControlReg::read(base);
     }
 
 	/** @brief Select the SPI slave
@@ -117,7 +119,7 @@ public:
 	 */
     inline void selectSpiSlave(volatile uint32_t slave)
     {
-        base[slaveSelect_index] = slave;
+        SlaveSelectReg::write(base, slave);
     }
 
 	/** @brief Set the clock divider
@@ -127,7 +129,7 @@ public:
 	 */
     inline void setSpiDivider(uint32_t divider)
     {
-        base[divider_index] = divider;
+        DividerReg::write(base, divider);
     }
 
 	/** @brief Get the clock divider
@@ -137,7 +139,7 @@ public:
 	 */
     inline uint32_t getSpiDivider(void)
     {
-        return base[divider_index];
+        return DividerReg::read(base);
     }
 
 	void setTransferWidth(uint8_t width);
@@ -145,15 +147,34 @@ public:
 	void startTransfer(void);
 
 	uint32_t rw(uint32_t data);
+	uint32_t transfer(const uint32_t* txData, uint32_t* rxData, uint32_t nbrOfWords);
+	void setIrqMode(bool irqMode, uint32_t minIrqWords = SpiCompletion::defaultMinIrqWords);
+
+	/** @brief Interrupt handler, to be hooked on the SPI interrupt with the controller as user data */
+	static void irqHandler(void* context)
+	{
+		((SpiOpenCore*)context)->serviceIrq();
+	}
+
+	SpiCompletion completion;		///< Interrupt wait and CPU time per word of the polled and interrupt transfers
 
 
 private:
 	volatile uint32_t *base;
 
-    int rxData_index = 0;
-    int txData_index = 0;
-    int control_index = 4;
-    int divider_index = 5;
-    int slaveSelect_index = 6;
+	void waitTransferIrq(void);
+
+	/** @brief The interrupt flag is cleared by any register access */
+	inline void serviceIrq(void)
+	{
+		getSpiControl();
+		completion.signal();
+	}
+
+    typedef AvalonReg<0, REG_RO> RxDataReg;         ///< Same address as TxDataReg, read side
+    typedef AvalonReg<0, REG_WO> TxDataReg;         ///< Same address as RxDataReg, write side
+    typedef AvalonReg<4, REG_RW> ControlReg;
+    typedef AvalonReg<5, REG_RW> DividerReg;
+    typedef AvalonReg<6, REG_RW> SlaveSelectReg;
 
 };
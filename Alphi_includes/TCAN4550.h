@@ -90,10 +90,9 @@ public:
 	 */
 	inline void reset()
 	{
-			uint32_t rst = ctrl_reset_mask;
-			controlReg->setData(rst);
+			controlReg->setBits(ctrl_reset_mask);
 			usleep(2000);
-			controlReg->setData(0);
+			controlReg->clearBits(ctrl_reset_mask);
 			usleep(2000);
 			can->reset();
 			Device_ClearInterruptsAll();
@@ -109,7 +108,7 @@ public:
 	 */
 	inline bool isCanTerminationEnabled()
 	{
-		uint32_t val = controlReg->getData() & ctrl_TERM_EN_mask;
+		uint32_t val = controlReg->getOutputData() & ctrl_TERM_EN_mask;
 		return val == 0;
 	}
 
@@ -123,12 +122,11 @@ public:
 	 */
 	inline void setCanTermination(bool isOn)
 	{
-		uint32_t val = controlReg->getData();
 		if (isOn) {
-			controlReg->setData(val & (~ctrl_TERM_EN_mask));
+			controlReg->clearBits(ctrl_TERM_EN_mask);
 		}
 		else {
-			controlReg->setData(val | ctrl_TERM_EN_mask);
+			controlReg->setBits(ctrl_TERM_EN_mask);
 		}
 	}
 
@@ -213,6 +211,7 @@ public:
 	void Device_ReadInterrupts(TCAN4x5x_Device_Interrupts* ir);
 	void Device_ClearInterrupts(TCAN4x5x_Device_Interrupts* ir);
 	void Device_ClearInterruptsAll(void);
+	void Device_ServiceInterrupts(TCAN4x5x_Device_Interrupts* dev_ir, TCAN4x5x_MCAN_Interrupts* mcan_ir);
 	void Device_ReadInterruptEnable(TCAN4x5x_Device_Interrupt_Enable* ie);
 	bool Device_ConfigureInterruptEnable(TCAN4x5x_Device_Interrupt_Enable* ie);
 	bool Device_SetMode(TCAN4x5x_Device_Mode_Enum modeDefine);
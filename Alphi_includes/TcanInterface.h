@@ -31,21 +31,109 @@
  // Maintenance Log
  //---------------------------------------------------------------------
  // v1.0		7/23/2020	phf	Written
+ // v1.1		Burst reads through the DMA controller
+ // v1.2		Transactions serialized by a TcanSpiArbiter
+ // v1.3		Batched register accesses
+ // v1.4		Bursts of any length, paced by the FIFO depth
  //---------------------------------------------------------------------
 
 #include <stddef.h>
 #include <stdint.h>
 #include "AlphiDll.h"
+#include "AvalonRegister.h"
 #include "ParallelInput.h"
 #include "AlteraPio.h"
+#include "AlteraDma.h"
+#include "TcanSpiArbiter.h"
 
 // control register
 
+/** @brief Register reads and writes executed together by TcanInterface::execute()
+ *
+ * The accesses are executed in the order they are queued. Consecutive accesses of the same direction
+ * to consecutive addresses are merged into one AHB burst, so one chip select frame; the writes do not
+ * read back the receive FIFO. Through an arbiter, the whole batch is one request.
+ *
+ * The read results are stored when the batch executes. writeFrom() takes its value at that time too,
+ * so a register can be cleared with the value read earlier in the same batch.
+ */
+class DLL TcanBatch
+{
+public:
+	static const int maxOps = 32;
+
+	int frames;						///< Chip select frames of the last execution
+
+	inline TcanBatch()
+	{
+		clear();
+	}
+
+	inline void clear()
+	{
+		nbrOfOps = 0;
+		frames = 0;
+	}
+
+	inline int size()
+	{
+		return nbrOfOps;
+	}
+
+	/** @brief Queue a register read, the result is stored in *dest */
+	inline PCIeMini_status read(uint16_t address, uint32_t* dest)
+	{
+		return add(false, address, 0, NULL, dest);
+	}
+
+	/** @brief Queue a register write */
+	inline PCIeMini_status write(uint16_t address, uint32_t value)
+	{
+		return add(true, address, value, NULL, NULL);
+	}
+
+	/** @brief Queue a register write of the value found in *src when the batch executes */
+	inline PCIeMini_status writeFrom(uint16_t address, const uint32_t* src)
+	{
+		return add(true, address, 0, src, NULL);
+	}
+
+private:
+	friend class TcanInterface;
+
+	struct Op {
+		bool write;
+		uint16_t address;
+		uint32_t value;
+		const uint32_t* src;		///< Write source, NULL to write value
+		uint32_t* dest;				///< Read destination
+	};
+
+	Op ops[maxOps];
+	int nbrOfOps;
+
+	inline PCIeMini_status add(bool write, uint16_t address, uint32_t value, const uint32_t* src, uint32_t* dest)
+	{
+		if (nbrOfOps >= maxOps)
+			return ERRCODE_TX_OVERFLOW;
+		Op* op = &ops[nbrOfOps++];
+		op->write = write;
+		op->address = address;
+		op->value = value;
+		op->src = src;
+		op->dest = dest;
+		return ERRCODE_NO_ERROR;
+	}
+};
+
 /** @brief This class implements the TCAN4550 SPI interface.
 * 
 * The interface is responsible for the low level communications with the TCAN4550 chip through the SPI interface.
 * Because it can be used to talk to several independent SPI slaves using the slave select lines, it doesn't include
 * direct PIO to the state.
+*
+* The AHB_xxx_32 and AHB_xxx_BURST transactions go through the arbiter once setArbiter() is called, and can
+* then be used from any thread. The START / READ / WRITE / END burst steps always access the controller directly.
 */
 class DLL TcanInterface
 {
@@ -79,6 +167,11 @@ public:
 	static const uint32_t status_txFifoUsed_mask = 0xff000000;	///< Part of the word containing the tx FIFO level
 	static const uint32_t status_txFifoUsed_bitNbr = 24;		///< bit offset of the tx FIFO level
 
+	static const uint32_t defaultDmaThreshold = 8;				///< Shortest burst read through the DMA, in words, until calibrated
+	static const uint32_t dmaTimeoutUs = 10000;					///< Longest DMA burst read
+	static const uint16_t maxAhbWords = 256;					///< Longest AHB transaction of the TCAN4550
+	static const uint32_t defaultFifoDepth = 32;				///< Depth of the controller FIFOs, in words
+
 	uint32_t maxRxFifoLevel;			///< diagnostic value of FIFO usage during an access
 	uint32_t maxTxFifoLevel;			///< diagnostic value of FIFO usage during an access
 
@@ -96,6 +189,64 @@ public:
 		maxRxFifoLevel = 0;
 		lastRxFifoLevel = 0;
 		maxTxFifoLevel = 0;
+		dma = NULL;
+		rxDataAvlAddress = 0;
+		staging = NULL;
+		stagingAvlAddress = 0;
+		stagingWords = 0;
+		dmaThreshold = defaultDmaThreshold;
+		arbiter = NULL;
+		fifoDepth = defaultFifoDepth;
+		burstTxPending = 0;
+		txCredits = 0;
+	}
+
+	/** @brief Set the depth of the SPI controller FIFOs
+	 *
+	 * The bursts keep at most this number of words in flight, header included, so neither FIFO
+	 * overflows whatever the burst length.
+	 * @param depth Depth in words, the smaller of the two FIFOs.
+	 */
+	inline void setFifoDepth(uint32_t depth)
+	{
+		fifoDepth = (depth < 2) ? 2 : depth;
+	}
+
+	inline uint32_t getFifoDepth()
+	{
+		return fifoDepth;
+	}
+
+	/** @brief Serialize the transactions through an arbiter
+	 * @param arb Arbiter owning the SPI controller, NULL to access the controller directly.
+	 */
+	inline void setArbiter(TcanSpiArbiter* arb)
+	{
+		arbiter = arb;
+	}
+
+	inline TcanSpiArbiter* getArbiter()
+	{
+		return arbiter;
+	}
+
+	/** @brief Set the minimum burst length read through the DMA
+	 * @param words Number of words, bursts shorter than this are read by the processor.
+	 */
+	inline void setDmaThreshold(uint32_t words)
+	{
+		dmaThreshold = words;
+	}
+
+	inline uint32_t getDmaThreshold()
+	{
+		return dmaThreshold;
+	}
+
+	/** @brief True when a burst of this length is read through the DMA */
+	inline bool isDmaRead(uint16_t words)
+	{
+		return dma != NULL && words >= dmaThreshold && words < stagingWords;
 	}
 
 	/** @brief reset the TCAN4550 chip
@@ -108,7 +259,7 @@ public:
 
 	inline void resetStatus()
 	{
-		base[status_Index] = 0;
+		StatusReg::write(base, 0);
 	}
 
 	/** @brief Get the SPI interface status
@@ -118,7 +269,7 @@ public:
 	 */
 	inline uint32_t getStatus()
 	{
-		return base[status_Index];
+		return StatusReg::read(base);
 	}
 
 	/** @brief Get the address of the SPI controller
@@ -136,7 +287,7 @@ public:
 	 */
 	inline volatile uint32_t getRxData()
 	{
-		return base[rxData_index];
+		return RxDataReg::read(base);
 	}
 
 	/** @brief Add data to the transmit FIFO
@@ -145,7 +296,7 @@ public:
 	 */
 	inline void setTxData(uint32_t data)
 	{
-		base[txData_index] = data;
+		TxDataReg::write(base, data);
 	}
 
 	/** @brief Write in the control register
@@ -163,7 +314,7 @@ public:
 		// remove the temporary bits
 		controlRegCached &= ~(control_resetFifo_mask | control_purgeRxFifo_mask);
 
-		base[control_index] = data | 1 << (slave + 16);
+		ControlReg::write(base, data | 1 << (slave + 16));
 	}
 
 
@@ -217,6 +368,7 @@ public:
 	void AHB_WRITE_BURST_START(uint16_t address, uint8_t words);
 	void AHB_WRITE_BURST_WRITE(uint32_t data);
 	void AHB_WRITE_BURST_END(void);
+	PCIeMini_status AHB_WRITE_BURST(uint16_t address, uint16_t words, const uint32_t* data);
 
 
 	//--------------------------------------------------------------------------
@@ -226,17 +378,62 @@ public:
 	void AHB_READ_BURST_START(uint16_t address, uint8_t words);
 	uint32_t AHB_READ_BURST_READ(void);
 	void AHB_READ_BURST_END(void);
+	PCIeMini_status AHB_READ_BURST(uint16_t address, uint16_t words, uint32_t* data);
+
+	PCIeMini_status execute(TcanBatch* batch);
+
+	void setDmaReader(AlteraDma* dmaCtrl, uint32_t spiAvlAddress, volatile uint32_t* stagingArea,
+		uint32_t stagingAddress, uint32_t stagingLength);
+	PCIeMini_status calibrateDmaThreshold(uint16_t address, uint32_t* threshold, int nbrOfLoops = 20);
 
 protected:
+	friend class TcanSpiArbiter;
+
 	volatile uint32_t* base;
 	const uint8_t wordSize = 4;
 	uint32_t controlRegCached;
 	uint32_t lastRxFifoLevel;
 
-	int rxData_index = 16;
-	int txData_index = 1;
-	int status_Index = 2;
-	int control_index = 3;
+	// burst reads through the DMA
+	AlteraDma* dma;						///< DMA controller, NULL to read by the processor only
+	uint32_t rxDataAvlAddress;			///< Avalon address of the receive data register
+	volatile uint32_t* staging;			///< Staging area of the DMA in user space
+	uint32_t stagingAvlAddress;			///< Avalon address of the staging area
+	uint32_t stagingWords;				///< Size of the staging area in words
+	uint32_t dmaThreshold;				///< Shortest burst read through the DMA
+	TcanSpiArbiter* arbiter;			///< Owner of the controller, NULL to access it directly
+	uint32_t fifoDepth;					///< Words kept in flight by the bursts
+	uint32_t burstTxPending;			///< Dummy words of the current read burst not sent yet
+	uint32_t txCredits;					///< Words that can be sent before checking the transmit FIFO level
+
+	/** @brief Send a word without overflowing the transmit FIFO
+	 *
+	 * The FIFO level is read only when the words sent since the last reading could have filled it.
+	 */
+	inline void setTxDataPaced(uint32_t data)
+	{
+		while (txCredits == 0) {
+			uint32_t level = getTxFifoLevel();
+			txCredits = (level < fifoDepth) ? fifoDepth - level : 0;
+		}
+		setTxData(data);
+		txCredits--;
+	}
+
+	void ahbWrite32(uint16_t address, uint32_t data);
+	uint32_t ahbRead32(uint16_t address);
+	PCIeMini_status ahbReadBurst(uint16_t address, uint16_t words, uint32_t* data);
+	PCIeMini_status ahbWriteBurst(uint16_t address, uint16_t words, const uint32_t* data);
+	PCIeMini_status submit(TcanSpiRequest::Type type, uint16_t address, uint16_t words, uint32_t* data);
+	PCIeMini_status runRequest(TcanSpiRequest* req);
+	PCIeMini_status runBatch(TcanBatch* batch);
+	PCIeMini_status readBurstPio(uint16_t address, uint16_t words, uint32_t* data);
+	PCIeMini_status readBurstDma(uint16_t address, uint16_t words, uint32_t* data);
+
+	typedef AvalonReg<16, REG_RO> RxDataReg;
+	typedef AvalonReg<1, REG_WO> TxDataReg;
+	typedef AvalonReg<2, REG_RW> StatusReg;			///< Writing clears the error bits
+	typedef AvalonReg<3, REG_WO> ControlReg;		///< Never read back, see controlRegCached
 
 };
 
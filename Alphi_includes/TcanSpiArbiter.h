@@ -0,0 +1,143 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file TcanSpiArbiter.h
+* @brief Serialization of the TCAN4550 transactions on the shared SPI controller
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _TCAN_SPI_ARBITER_H
+#define _TCAN_SPI_ARBITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+
+class TcanInterface;
+class TcanBatch;
+
+/** @brief One AHB transaction queued to a TcanSpiArbiter
+ *
+ * The request is filled and waited for by TcanInterface, it lives on the stack of the caller.
+ */
+class DLL TcanSpiRequest
+{
+public:
+	enum Type { read32, write32, readBurst, writeBurst, batch };
+
+	Type type;
+	uint16_t address;			///< AHB address
+	uint16_t words;				///< Number of words, 1 to 256 for the bursts
+	uint32_t* data;				///< Source or destination of the words
+	TcanBatch* ops;				///< Transactions of a batch request
+	PCIeMini_status result;		///< Set by the dispatcher before done
+
+private:
+	friend class TcanSpiArbiter;
+	TcanSpiRequest* next;
+	bool done;
+};
+
+/** @brief Owner of the SPI controller shared by the TCAN4550 chips
+ *
+ * The four TcanInterface objects of a board use the same SPI controller and pick the chip with
+ * the slave select field of the control register, so two threads must never use it at the same
+ * time. Once the arbiter is attached, the AHB transactions of the interfaces are queued per
+ * channel and executed by a single dispatcher thread: each channel can be served by its own
+ * thread without any lock around the register accesses.
+ *
+ * The dispatcher serves up to a quantum of queued transactions on one chip before switching to
+ * the next one, which limits the chip select changes. In fair mode the channels are served in
+ * round robin; in priority mode the highest priority channel with queued work goes first, the
+ * channels of the same priority in round robin.
+ *
+ * The queues have one lock each, the dispatcher is only woken up through the shared lock when
+ * it is idle.
+ */
+class DLL TcanSpiArbiter
+{
+public:
+	static const int maxChannels = 4;
+	static const uint32_t defaultQuantum = 8;		///< Transactions served on a chip before switching
+
+	enum Policy { policyFair, policyPriority };
+
+	TcanSpiArbiter();
+	~TcanSpiArbiter();
+
+	PCIeMini_status addChannel(TcanInterface* tcan, int priority = 0);
+	PCIeMini_status setPriority(int channel, int priority);
+	PCIeMini_status start(Policy policy = policyFair, uint32_t quantum = defaultQuantum);
+	void stop();
+	PCIeMini_status execute(int channel, TcanSpiRequest* req);
+
+	inline bool isRunning()
+	{
+		return running;
+	}
+
+	void clearStats();
+	void printStats();
+
+	uint64_t transactions;			///< Transactions executed since clearStats()
+	uint64_t csSwitches;			///< Chip select changes since clearStats()
+
+private:
+	struct Channel {
+		TcanInterface* tcan;
+		int priority;
+		pthread_mutex_t lock;
+		pthread_cond_t doneCond;	///< Broadcast when a request of the channel is done
+		TcanSpiRequest* head;
+		TcanSpiRequest* tail;
+		uint64_t served;
+		uint32_t maxQueued;			///< Deepest queue seen since clearStats()
+		uint32_t queued;
+	};
+
+	Channel channels[maxChannels];
+	Policy policy;
+	uint32_t quantum;
+	int lastChannel;				///< Channel served last, -1 before the first transaction
+
+	uint32_t pending;				///< Requests queued on all the channels
+	bool sleeping;					///< The dispatcher waits for wakeCond
+	bool stopRequest;
+	bool running;
+	pthread_mutex_t wakeLock;
+	pthread_cond_t wakeCond;
+	pthread_t dispatcher;
+
+	static void* dispatcherEntry(void* context);
+	void dispatch();
+	int selectChannel();
+	void serve(int channel);
+};
+
+#endif
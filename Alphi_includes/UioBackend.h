@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file UioBackend.h
+* @brief Board access through the Linux UIO driver
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _UIO_BACKEND_H
+#define _UIO_BACKEND_H
+
+#include "BoardBackend.h"
+
+/** @brief Board access through the Linux UIO driver (uio_pci_generic)
+ *
+ * The board number is the UIO device number: board n is /dev/uio<n>. The BARs are mapped through
+ * the sysfs resource files of the PCI device.
+ */
+class DLL UioBackend : public BoardBackend
+{
+public:
+	UioBackend();
+	~UioBackend();
+
+	PCIeMini_status open(int brdNbr, uint16_t vendorId, uint16_t deviceId);
+	PCIeMini_status close(void);
+
+	size_t getBarSize(int barNbr);
+	void* mapBar(int barNbr, bool writeCombined = false, bool* isWriteCombined = NULL);
+	void unmapBar(int barNbr, void* address, size_t length);
+
+	/** @brief The UIO device becomes readable on interrupt */
+	inline int getIrqFd(void)
+	{
+		return uiofd;
+	}
+
+	PCIeMini_status readIrqCount(uint32_t* count);
+	PCIeMini_status startIrq(IrqRearmMode request);
+	PCIeMini_status rearmIrq(void);
+
+	/** @brief Return the re-arm method in use */
+	inline IrqRearmMode getIrqRearmMode(void)
+	{
+		return irqRearmMode;
+	}
+
+	/** @brief Return the name of the backend */
+	inline const char* getName(void)
+	{
+		return "uio";
+	}
+
+private:
+	int brdNumber;						///< UIO device number
+
+	// UIO specific
+	char uioDev[20];					///< UIO device name
+	char uioName[20];					///< UIO driver name
+	char uioVersion[20];				///< UIO driver version
+
+	size_t uioBarSizes[nbrOfBars];
+
+	int readConfigString(char *data, int *len, const char *name);
+	int readConfigHex(const char *name);
+	int readUioResource();
+	bool isMsiActive(void);
+
+	int     uiofd;						///< UIO Descriptor for board
+	int     configfd;					///< UIO Descriptor for board config
+
+	volatile IrqRearmMode irqRearmMode;	///< Re-arm method in use by the interrupt thread
+	unsigned char commandHigh;			///< Cached upper byte of the PCI command register, for IRQ_REARM_CONFIG
+};
+
+#endif // _UIO_BACKEND_H
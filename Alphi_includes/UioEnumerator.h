@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file UioEnumerator.h
+* @brief Discovery of the Alphi boards handled by the UIO driver
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#ifndef _UIO_ENUMERATOR_H
+#define _UIO_ENUMERATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "AlphiDll.h"
+#include "AlphiErrorCodes.h"
+
+/** @brief Description of a board found in /sys/class/uio */
+typedef struct UioBoardInfo {
+	int uioNbr;							///< UIO device number, the board number to give to open()
+	char slot[16];						///< PCI address of the board, as "0000:03:00.0"
+	uint16_t vendorId;					///< PCI vendor identification
+	uint16_t deviceId;					///< PCI device identification
+	size_t barSizes[8];					///< Size of each BAR, 0 if not implemented
+	uint32_t sysidVersion;				///< Board type and version, from the sysid component of BAR 2
+	uint32_t sysidTimeStamp;			///< Firmware time stamp, from the sysid component of BAR 2
+	uint64_t serialNumber;				///< PCIe Device Serial Number, 0 if not available
+} UioBoardInfo;
+
+/** @brief Table of the Alphi boards present in the system
+ *
+ * /sys/class/uio is scanned once, the first time the table is used, and the result is kept
+ * until rescan() is called. The lookup functions return the board number to give to the open()
+ * function of the board classes, or -1 when no board matches. The functions can be called from
+ * several threads.
+ *
+ * Reading the sysid component requires the permission to map BAR 2; the serial number requires
+ * the permission to read the extended PCI configuration space (usually root.)
+ */
+class DLL UioEnumerator
+{
+public:
+	static const int maxBoards = 32;					///< Maximum number of boards in the table
+	static const uint16_t alphiVendorId = 0x13c5;		///< Alphi Technology Corporation
+
+	static UioEnumerator* getInstance();
+
+	int rescan(void);
+	int getNbrOfBoards(void);
+	const UioBoardInfo* getBoard(int index);
+	const UioBoardInfo* findByUio(int uioNbr);
+
+	int findBySlot(const char* slot);
+	int findBySerial(uint64_t serialNumber);
+	int findByType(uint32_t sysidVersion, int instance = 0);
+
+	void print(void);
+
+private:
+	UioEnumerator();
+
+	bool scanned;
+	int nbrOfBoards;
+	UioBoardInfo boards[maxBoards];
+	pthread_mutex_t lock;								///< Protects the table against rescan()
+
+	int scan(void);
+	void lockTable(void);
+	bool readBoard(int uioNbr, UioBoardInfo* info);
+	static int readSysfsHex(const char* path, uint32_t* value);
+	static void readSysid(int uioNbr, UioBoardInfo* info);
+	static uint64_t readSerialNumber(int uioNbr);
+};
+
+#endif // _UIO_ENUMERATOR_H
@@ -67,11 +67,7 @@ PCIeMini_AVIO::~PCIeMini_AVIO()
  */
 void AvioCtrlReg::setSelect(uint8_t sel)
 {
-	uint32_t pio_data;
-	pio_data = getData();
-	pio_data &=  ~selectMask;
-	pio_data = pio_data | ((sel & 0x03) << 1);
-	setData(pio_data);
+	modifyBits(selectMask, (sel & 0x03) << 1);
 }
 
 /** @brief Check which HI-8429 register is selected
@@ -80,7 +76,7 @@ void AvioCtrlReg::setSelect(uint8_t sel)
 uint8_t AvioCtrlReg::getSelect(void)
 {
 	uint32_t pio_data;
-	pio_data = getData();
+	pio_data = getOutputData();
 	return (pio_data >> 1) & 0x03;
 }
 
@@ -90,13 +86,9 @@ uint8_t AvioCtrlReg::getSelect(void)
  */
 void AvioCtrlReg::resetHolt(void)
 {
-	uint32_t pio_data;
-	pio_data = getData();
-	pio_data = pio_data & ~resetMask;
-	setData(pio_data);
+	clearBits(resetMask);
 	Sleep(1);
-	pio_data = pio_data | resetMask;
-	setData(pio_data);
+	setBits(resetMask);
 }
 
 /** @brief Set the SenseSelect line to the HI-8426s and the HI-8431s
@@ -106,15 +98,12 @@ void AvioCtrlReg::resetHolt(void)
  */
 void AvioCtrlReg::setSenseSelect(bool high)
 {
-	uint32_t pio_data;
-	pio_data = getData();
 	if (high) {
-		pio_data = pio_data | SelHiMask;
+		setBits(SelHiMask);
 	}
 	else {
-		pio_data = pio_data & ~SelHiMask;
+		clearBits(SelHiMask);
 	}
-	setData(pio_data);
 }
 
 /** @brief Set the Debounce Enable line of the HI-8429
@@ -123,13 +112,10 @@ void AvioCtrlReg::setSenseSelect(bool high)
  */
 void AvioCtrlReg::setDebounceEnable(bool enable)
 {
-	uint32_t pio_data;
-	pio_data = getData();
-	pio_data = pio_data & ~debounceMask;
 	if(enable)
-		pio_data = pio_data | debounceMask;
-
-	setData(pio_data);
+		setBits(debounceMask);
+	else
+		clearBits(debounceMask);
 }
 
 
@@ -231,6 +217,7 @@ PCIeMini_status PCIeMini_AVIO::open(int brdNbr)
 	digoutReadback = new ParallelInput(getBar2Address(digoutReadback_offset));
 	digout = new AlteraPio(getBar2Address(digout_offset), AlteraPio::CAP_OUTPUT);
 	ctrlReg = new AvioCtrlReg(getBar2Address(ctrlReg_offset));
+	ctrlReg->setShadowMode(true);		// only written by the host, saves a read for every HI-8429 access
 	statusReg = new AlteraPio(getBar2Address(statusReg_offset), AlteraPio::CAP_INPUT);
 	avComp = new AlteraPio(getBar2Address(avComp_offset), AlteraPio::CAP_INPUT);
 	rstCtrl = new AlteraPio(getBar2Address(ledPio_offset), AlteraPio::CAP_OUTPUT);
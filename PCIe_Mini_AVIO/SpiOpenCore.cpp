@@ -54,10 +54,64 @@ void SpiOpenCore::startTransfer(void)
 
 uint32_t SpiOpenCore::rw(uint32_t data)
 {
-	setSpiTxData(data); // 0
-	startTransfer();
-	while(getSpiStatus() & SPI_CTRL_GO); // wait for no busy
-	return getSpiRxData();
+	uint32_t rxData;
+
+	transfer(&data, &rxData, 1);
+	return rxData;
+}
+
+/** @brief Transfer several words
+ *
+ * The transfers of at least the interrupt threshold sleep on the end of transfer interrupt,
+ * one interrupt per word; the shorter ones poll the GO bit.
+ * @param txData Words to send.
+ * @param rxData Receives the words read.
+ * @param nbrOfWords Number of words.
+ * @retval Number of words transferred.
+ */
+uint32_t SpiOpenCore::transfer(const uint32_t* txData, uint32_t* rxData, uint32_t nbrOfWords)
+{
+	bool irq = completion.useIrqFor(nbrOfWords);
+
+	completion.beginTransfer();
+	for (uint32_t i = 0; i < nbrOfWords; i++) {
+		setSpiTxData(txData[i]);
+		if (irq)
+			waitTransferIrq();
+		else {
+			startTransfer();
+			while(getSpiStatus() & SPI_CTRL_GO); // wait for no busy
+		}
+		rxData[i] = getSpiRxData();
+	}
+	completion.endTransfer(nbrOfWords, irq);
+	return nbrOfWords;
+}
+
+/** @brief Select how the end of the transfers is waited for
+ *
+ * irqHandler() must be hooked on the interrupt line of the controller, with the controller as
+ * user data.
+ * @param irqMode True to sleep on the end of transfer interrupt.
+ * @param minIrqWords Shortest transfer waited for by interrupt, the shorter ones are polled.
+ */
+void SpiOpenCore::setIrqMode(bool irqMode, uint32_t minIrqWords)
+{
+	completion.setIrqMode(irqMode, minIrqWords);
+}
+
+/** @brief Start the transfer with the interrupt enabled and sleep until its end */
+void SpiOpenCore::waitTransferIrq(void)
+{
+	while(getSpiControl() & SPI_CTRL_GO); // wait for no busy
+
+	uint32_t seq = completion.arm();
+	setSpiControl(getSpiControl() | SPI_CTRL_GO | SPI_CTRL_IE);
+	while (getSpiStatus() & SPI_CTRL_GO) {
+		completion.wait(seq);
+		seq = completion.arm();
+	}
+	setSpiControl(getSpiControl() & ~SPI_CTRL_IE);
 }
 
 
@@ -36,6 +36,9 @@
 //#include <msp430.h>
 
 #include "TCAN4550.h"
+#ifdef DMA_ENABLED
+#include "DmaEngine.h"
+#endif
 #include "immintrin.h"
 
 void printIrqStatus(TCAN4x5x_Device_Interrupts* dev_ir);
@@ -282,6 +285,81 @@ int CanFdTest::checkSpiErrorBit(TCAN4550* can, int verbose)
 	return 0;
 }
 
+/** @brief Arguments and results of the worker thread of one channel in testSpiArbiter() */
+struct ArbiterWorker
+{
+	pthread_t thread;
+	TcanInterface* can;
+	int channel;
+	int nbrOfLoops;
+	int errNbr;
+};
+
+static void* arbiterWorker(void* context)
+{
+	ArbiterWorker* w = (ArbiterWorker*)context;
+
+	for (int i = 0; i < w->nbrOfLoops; i++) {
+		uint32_t testVal = ((uint32_t)w->channel << 28) + i;
+		w->can->AHB_WRITE_32(REG_DEV_TEST_REGISTERS, testVal);
+		uint32_t val = w->can->AHB_READ_32(REG_DEV_TEST_REGISTERS);
+		if (val != testVal) {
+			if (w->errNbr < 5) printf("Failed channel#%d: write 0x%08x read 0x%08x\n", w->channel, testVal, val);
+			w->errNbr++;
+		}
+	}
+	return NULL;
+}
+
+/** @brief One thread per channel writes and reads back its test register through the SPI arbiter
+ *
+ * The test runs in fair mode, then in priority mode with channel #0 first.
+ */
+int CanFdTest::testSpiArbiter(int nbrOfLoops)
+{
+	ArbiterWorker workers[PCIeMini_CAN_FD::nbrOfCanInterfaces];
+	int errNbr = 0;
+
+	printf("SPI arbiter, one thread per channel\n");
+	for (int pass = 0; pass < 2; pass++) {
+		TcanSpiArbiter::Policy policy = pass == 0 ? TcanSpiArbiter::policyFair : TcanSpiArbiter::policyPriority;
+		dut->spiArbiter->setPriority(0, pass);
+		dut->spiArbiter->clearStats();
+		if (dut->startSpiArbiter(policy) != ERRCODE_NO_ERROR) {
+			printf("Failed: can't start the arbiter\n");
+			return 1;
+		}
+
+		QueryPerformanceFrequency(&Frequency);
+		QueryPerformanceCounter(&StartingTime);
+		for (int i = 0; i < dut->nbrOfCanInterfaces; i++) {
+			workers[i].can = dut->can[i]->can;
+			workers[i].channel = i;
+			workers[i].nbrOfLoops = nbrOfLoops;
+			workers[i].errNbr = 0;
+			pthread_create(&workers[i].thread, NULL, &arbiterWorker, &workers[i]);
+		}
+		for (int i = 0; i < dut->nbrOfCanInterfaces; i++) {
+			pthread_join(workers[i].thread, NULL);
+			errNbr += workers[i].errNbr;
+		}
+		QueryPerformanceCounter(&EndingTime);
+		ElapsedMicroseconds = (EndingTime - StartingTime) * 1000000 / Frequency;
+		dut->stopSpiArbiter();
+
+		printf("%d transactions in %5.2f milliseconds (%4.2f us/transaction)\n", 2 * nbrOfLoops * dut->nbrOfCanInterfaces,
+			ElapsedMicroseconds / 1000, ElapsedMicroseconds / (2 * nbrOfLoops * dut->nbrOfCanInterfaces));
+		dut->spiArbiter->printStats();
+	}
+	dut->spiArbiter->setPriority(0, 0);
+
+	if (errNbr == 0)
+		printf("SUCCESS! \n");
+	else
+		printf("%d errors out of %d loops.\n", errNbr, 2 * nbrOfLoops * dut->nbrOfCanInterfaces);
+	return errNbr;
+}
+
 int CanFdTest::testSpiRead32(uint8_t spiController)
 {
 	double StartingTime, EndingTime, ElapsedMicroseconds;
@@ -331,63 +409,354 @@ int CanFdTest::testSpiReadMultDMA(uint8_t spiController, int len)
 {
 	TCAN4550* canSpi = dut->can[spiController];
 	TcanInterface* can = canSpi->can;
-
-	// fixed parameters
 	uint16_t address = 0x8000;
-	len = 8;
-
+	uint32_t pio[256];
+	uint32_t viaDma[256];
 	int errNbr = 0;
 
+	if (len < 1 || len > 64)
+		len = 64;
+
 	// initialize the memory
 	can->AHB_WRITE_BURST_START(address, len);
 	for (int i = 0; i < len; i++) {
-		can->AHB_WRITE_BURST_WRITE(i+10);
+		can->AHB_WRITE_BURST_WRITE(0x5a000000 + i);
 	}
 	can->AHB_WRITE_BURST_END();
 
-
-	// Do the DMA
-//	Sleep(1);
-#define DMA_SPI_READ
-#ifdef DMA_SPI_READ
+	// same burst by the processor and by the DMA
+	uint32_t threshold = can->getDmaThreshold();
+	can->setDmaThreshold(0xffffffff);
+	can->AHB_READ_BURST(address, len, pio);
+	can->setDmaThreshold(1);
+	if (!can->isDmaRead(len)) {
+		printf("DMA burst reads are not configured\n");
+		can->setDmaThreshold(threshold);
+		return 1;
+	}
+	PCIeMini_status status = can->AHB_READ_BURST(address, len, viaDma);
+	can->setDmaThreshold(threshold);
+	if (status != ERRCODE_NO_ERROR) {
+		printf("DMA burst read: %s\n", getAlphiErrorMsg(status));
+		dut->dma->print();
+		return 1;
+	}
 	for (int i = 0; i < len; i++) {
-		dut->dpr[i] = 0xcccccccc;
+		if (pio[i] != 0x5a000000u + i || viaDma[i] != pio[i]) {
+			if (errNbr < 5) printf("word %d: expected 0x%08x, PIO 0x%08x, DMA 0x%08x\n", i, 0x5a000000 + i, pio[i], viaDma[i]);
+			errNbr++;
+		}
 	}
-	TransferDesc* tfrDesc = new TransferDesc();
-	tfrDesc->src_offset = 0x0240;
-	tfrDesc->dest_offset = dut->dpr_offset;
-	tfrDesc->tfr_length = (len + 1)* sizeof(uint32_t);
-	dut->dma->setControlBit(ALTERA_AVALON_DMA_CONTROL_RCON_MSK);
-	dut->dma->launch_bidir(tfrDesc);
-//	can->AHB_READ_BURST_START(0x8000, len);
-	uint32_t msg = AHB_READ_OPCODE << 24;
-	msg |= address << 8;        // Send the 16-bit address
-	msg |= len;               // Send the number of words to read
 
-	can->setTxData(msg);
+	status = can->calibrateDmaThreshold(address, &threshold);
+	if (status != ERRCODE_NO_ERROR)
+		printf("DMA threshold calibration: %s\n", getAlphiErrorMsg(status));
+	printf("%d errors, DMA used from %u words\n", errNbr, threshold);
+	return errNbr;
+}
+
+static void dmaQueueDone(void* handle, TransferDesc* t)
+{
+	if (t->status & ALTERA_AVALON_DMA_STATUS_DONE_MSK)
+		(*(int*)handle)++;
+}
 
-	for (int i = 0; i < len; i++) {
-		can->setTxData(0);
+/** @brief Chain DPR to DPR copies through the DMA descriptor queue
+ *
+ * The lower half of the DPR is copied to the upper half in chunks, queued back to back.
+ */
+int CanFdTest::testDmaQueue(int nbrOfLoops)
+{
+	const int nbrOfChunks = 8;
+	const uint32_t half = PCIeMini_CAN_FD::dpr_length / 2;
+	const uint32_t chunk = half / nbrOfChunks;
+	TransferDesc desc[nbrOfChunks];
+	AlteraDmaQueue queue(dut->dma);
+	int doneNbr = 0;
+	int errNbr = 0;
+
+	for (uint32_t i = 0; i < half / 4; i++) {
+		dut->dpr[i] = i * 0x01010101;
 	}
-	//	Sleep(1);
+	dut->dma->reset();
 
-	printf("Read local RAM back:");
-	for (int i = 1; i < len + 1; i++) {
-		printf("<0x%x>", dut->dpr[i]);
+	uint64_t t0 = LatencyHistogram::getTimeNs();
+	for (int l = 0; l < nbrOfLoops; l++) {
+		for (int c = 0; c < nbrOfChunks; c++) {
+			desc[c].src_offset = dut->dpr_offset + c * chunk;
+			desc[c].dest_offset = dut->dpr_offset + half + c * chunk;
+			desc[c].tfr_length = chunk;
+			queue.enqueue(&desc[c], dmaQueueDone, &doneNbr);
+		}
+		if (queue.waitIdle() != ERRCODE_NO_ERROR) {
+			printf("DMA queue timeout, %u transfers pending\n", queue.getPending());
+			queue.abort();
+			errNbr++;
+			break;
+		}
 	}
-	dut->dma->print();
-#else
-	can->AHB_READ_BURST_START(0x8000, len);
-	for (int i = 0; i < len; i++) {
-		id[i] = can->AHB_READ_BURST_READ();
+	uint64_t elapsed = LatencyHistogram::getTimeNs() - t0;
+
+	for (uint32_t i = 0; i < half / 4; i++) {
+		if (dut->dpr[half / 4 + i] != i * 0x01010101) {
+			if (errNbr < 5) printf("error @ 0x%x: 0x%08x\n", half + i * 4, dut->dpr[half / 4 + i]);
+			errNbr++;
+		}
 	}
-	printf("Read back:");
-	for (int i = 0; i < len; i++) {
-		printf("<0x%x>", id[i]);
+	queue.printStats("DMA descriptor queue");
+	printf("%d transfers done in %.3f ms\n", doneNbr, elapsed / 1000000.0);
+	if (errNbr == 0) printf("DMA queue test passed\n");
+	return errNbr;
+}
+
+static void dmaCompletionDone(void* handle, TransferDesc* t)
+{
+	__atomic_add_fetch((int*)handle, 1, __ATOMIC_RELEASE);
+}
+
+/** @brief Compare the DMA completion latency by polling and by interrupt
+ *
+ * Short DPR to DPR transfers are waited for by polling, then by interrupt with a blocking
+ * wait, then by interrupt with a callback.
+ */
+int CanFdTest::testDmaCompletion(int nbrOfLoops)
+{
+	TransferDesc t;
+	int callbackNbr = 0;
+	int errNbr = 0;
+
+	t.src_offset = dut->dpr_offset;
+	t.dest_offset = dut->dpr_offset + PCIeMini_CAN_FD::dpr_length / 2;
+	t.tfr_length = 64;
+	dut->dma->reset();
+	dut->dma->clearStats();
+
+	for (int l = 0; l < nbrOfLoops; l++) {
+		dut->hwDMAStart(&t);
+		if (!dut->hwDMAWaitForCompletion(&t, true))
+			errNbr++;
 	}
-#endif
-	can->AHB_READ_BURST_END();
-	printf("\n");
+
+	PCIeMini_status status = dut->hwDMAInterruptEnable();
+	if (status != ERRCODE_NO_ERROR) {
+		printf("DMA interrupt not available: %s\n", getAlphiErrorMsg(status));
+	}
+	else {
+		for (int l = 0; l < nbrOfLoops; l++) {
+			dut->hwDMAStart(&t);
+			if (!dut->hwDMAWaitForCompletion(&t, false))
+				errNbr++;
+		}
+
+		dut->dma->setDoneCallback(dmaCompletionDone, &callbackNbr);
+		for (int l = 0; l < nbrOfLoops; l++) {
+			int expected = l + 1;
+			dut->hwDMAStart(&t);
+			uint64_t start = LatencyHistogram::getTimeNs();
+			while (__atomic_load_n(&callbackNbr, __ATOMIC_ACQUIRE) < expected) {
+				if (LatencyHistogram::getTimeNs() - start > 10000000) {
+					errNbr++;
+					break;
+				}
+				sched_yield();
+			}
+		}
+		dut->dma->setDoneCallback(NULL, NULL);
+		dut->hwDMAInterruptDisable();
+	}
+
+	dut->dma->printStats("DMA completion");
+	printf("%d callbacks, %d timeouts\n", callbackNbr, errNbr);
+	return errNbr;
+}
+
+/** @brief DMA between the DPR and a host buffer, in both directions */
+int CanFdTest::testHostDma()
+{
+	const uint32_t nbrOfWords = PCIeMini_CAN_FD::dpr_length / 4;
+	DmaBufferProvider* provider = dut->getDmaProvider();
+	DmaBuffer* buffer;
+	TransferDesc tfrDesc;
+	int errNbr = 0;
+
+	PCIeMini_status status = provider->allocate(PCIeMini_CAN_FD::dpr_length, &buffer);
+	if (status != ERRCODE_NO_ERROR) {
+		printf("Cannot allocate a %s DMA buffer: %s\n", provider->getName(), getAlphiErrorMsg(status));
+		return 1;
+	}
+	volatile uint32_t* host = (volatile uint32_t*)buffer->address;
+	printf("%s DMA buffer at bus address 0x%llx\n", provider->getName(), (unsigned long long)buffer->getBusAddress(0));
+	dut->dma->reset();
+
+	// board to host
+	for (uint32_t i = 0; i < nbrOfWords; i++) {
+		dut->dpr[i] = 0xa5000000 + i;
+		host[i] = 0;
+	}
+	status = dut->hwDMAProgram(buffer, 0, PCIeMini_CAN_FD::dpr_length, false, dut->dpr_offset, &tfrDesc);
+	if (status == ERRCODE_NO_ERROR) {
+		dut->hwDMAStart(&tfrDesc);
+		if (!dut->hwDMAWaitForCompletion(&tfrDesc, true)) {
+			printf("Board to host DMA timeout\n");
+			errNbr++;
+		}
+		for (uint32_t i = 0; i < nbrOfWords; i++) {
+			if (host[i] != 0xa5000000 + i) {
+				if (errNbr < 5) printf("board to host error @ word %u: 0x%08x\n", i, host[i]);
+				errNbr++;
+			}
+		}
+
+		// host to board
+		for (uint32_t i = 0; i < nbrOfWords; i++) {
+			host[i] = 0x5a000000 + i;
+			dut->dpr[i] = 0;
+		}
+		status = dut->hwDMAProgram(buffer, 0, PCIeMini_CAN_FD::dpr_length, true, dut->dpr_offset, &tfrDesc);
+	}
+	if (status == ERRCODE_NO_ERROR) {
+		dut->hwDMAStart(&tfrDesc);
+		if (!dut->hwDMAWaitForCompletion(&tfrDesc, true)) {
+			printf("Host to board DMA timeout\n");
+			errNbr++;
+		}
+		for (uint32_t i = 0; i < nbrOfWords; i++) {
+			if (dut->dpr[i] != 0x5a000000 + i) {
+				if (errNbr < 5) printf("host to board error @ word %u: 0x%08x\n", i, dut->dpr[i]);
+				errNbr++;
+			}
+		}
+	}
+	else {
+		printf("hwDMAProgram: %s\n", getAlphiErrorMsg(status));
+		errNbr++;
+	}
+	provider->release(buffer);
+
+	uint64_t hits, writes;
+	dut->cra->getTrStats(&hits, &writes);
+	printf("Translation table: %llu mappings reused, %llu entries written\n", (unsigned long long)hits, (unsigned long long)writes);
+	if (errNbr == 0) printf("Host DMA test passed\n");
+	return errNbr;
+}
+
+static void dmaEngineDone(void* handle, DmaRequest* req)
+{
+	if (req->getResult() == ERRCODE_NO_ERROR)
+		__atomic_add_fetch((int*)handle, 1, __ATOMIC_RELEASE);
+}
+
+/** @brief Run one pass of the DMA engine test, copying the lower half of the DPR to the upper half */
+static int runDmaEngine(PCIeMini_CAN_FD* dut, DmaEngine* engine, DmaRequest* req, int nbrOfRequests, int nbrOfLoops)
+{
+	const uint32_t half = PCIeMini_CAN_FD::dpr_length / 2;
+	const uint32_t chunk = half / nbrOfRequests;
+	int doneNbr = 0;
+	int errNbr = 0;
+	uint64_t busy = 0;
+
+	uint64_t t0 = LatencyHistogram::getTimeNs();
+	for (int l = 0; l < nbrOfLoops; l++) {
+		for (int r = 0; r < nbrOfRequests; r++) {
+			// the request is reused once its previous transfer is done
+			if (req[r].wait() != ERRCODE_NO_ERROR && l > 0)
+				errNbr++;
+			req[r].desc.src_offset = dut->dpr_offset + r * chunk;
+			req[r].desc.dest_offset = dut->dpr_offset + half + r * chunk;
+			req[r].desc.tfr_length = chunk;
+			req[r].done = dmaEngineDone;
+			req[r].handle = &doneNbr;
+			PCIeMini_status status = engine->submit(&req[r], 10000);
+			if (status != ERRCODE_NO_ERROR) {
+				if (errNbr < 5) printf("submit: %s\n", getAlphiErrorMsg(status));
+				errNbr++;
+			}
+
+			// work done by the submitting thread while the transfers run
+			uint64_t w0 = LatencyHistogram::getTimeNs();
+			for (uint32_t i = 0; i < chunk / 4; i++)
+				_mm_pause();
+			busy += LatencyHistogram::getTimeNs() - w0;
+		}
+	}
+	for (int r = 0; r < nbrOfRequests; r++)
+		if (req[r].wait(10000) != ERRCODE_NO_ERROR)
+			errNbr++;
+	uint64_t elapsed = LatencyHistogram::getTimeNs() - t0;
+
+	printf("%d transfers done in %.3f ms, %.1f%% of the time processing\n", doneNbr, elapsed / 1000000.0,
+		100.0 * busy / elapsed);
+	return errNbr;
+}
+
+/** @brief Asynchronous DMA: submission with backpressure and completion callbacks
+ *
+ * The transfers are submitted by the test thread, which processes between the submissions
+ * instead of waiting, in polling mode then in interrupt mode. A host buffer is then read
+ * with submitHost().
+ */
+int CanFdTest::testDmaEngine(int nbrOfLoops)
+{
+	const int nbrOfRequests = 8;
+	const uint32_t half = PCIeMini_CAN_FD::dpr_length / 2;
+	DmaRequest req[nbrOfRequests];
+	DmaEngine engine(dut->dma, dut->cra);
+	int errNbr = 0;
+
+	for (uint32_t i = 0; i < half / 4; i++) {
+		dut->dpr[i] = i * 0x01010101;
+	}
+	dut->dma->reset();
+
+	engine.start(4, false);
+	errNbr += runDmaEngine(dut, &engine, req, nbrOfRequests, nbrOfLoops);
+	engine.printStats("DMA engine, polling");
+	engine.stop();
+
+	PCIeMini_status status = dut->hwDMAInterruptEnable(-1, DmaEngine::irqHandler, &engine);
+	if (status != ERRCODE_NO_ERROR) {
+		printf("DMA interrupt not available: %s\n", getAlphiErrorMsg(status));
+	}
+	else {
+		engine.start(4, true);
+		errNbr += runDmaEngine(dut, &engine, req, nbrOfRequests, nbrOfLoops);
+		engine.printStats("DMA engine, interrupt");
+		dut->hwDMAInterruptDisable();
+		engine.stop();
+	}
+
+	for (uint32_t i = 0; i < half / 4; i++) {
+		if (dut->dpr[half / 4 + i] != i * 0x01010101) {
+			if (errNbr < 5) printf("error @ 0x%x: 0x%08x\n", half + i * 4, dut->dpr[half / 4 + i]);
+			errNbr++;
+		}
+	}
+
+	// board to host
+	DmaBufferProvider* provider = dut->getDmaProvider();
+	DmaBuffer* buffer;
+	if (provider->allocate(half, &buffer) == ERRCODE_NO_ERROR) {
+		volatile uint32_t* host = (volatile uint32_t*)buffer->address;
+		memset(buffer->address, 0, half);
+		engine.start(4, false);
+		status = engine.submitHost(&req[0], buffer, 0, half, false, dut->dpr_offset);
+		if (status == ERRCODE_NO_ERROR)
+			status = req[0].wait(10000);
+		engine.stop();
+		if (status != ERRCODE_NO_ERROR) {
+			printf("submitHost: %s\n", getAlphiErrorMsg(status));
+			errNbr++;
+		}
+		for (uint32_t i = 0; status == ERRCODE_NO_ERROR && i < half / 4; i++) {
+			if (host[i] != i * 0x01010101) {
+				if (errNbr < 5) printf("host error @ word %u: 0x%08x\n", i, host[i]);
+				errNbr++;
+			}
+		}
+		provider->release(buffer);
+	}
+
+	if (errNbr == 0) printf("DMA engine test passed\n");
 	return errNbr;
 }
 #endif
@@ -405,22 +774,19 @@ int CanFdTest::testSpiReadMult(uint8_t spiController, int len)
 		printf("Failed: invalid channel number!\n");
 		return 1;
 	}
-	if (len > 20) {
-		printf("Failed: Length is maximum 20!\n");
+	// the MRAM is 2 KB
+	if (len < 2 || len > 512) {
+		printf("Failed: Length is 2 to 512!\n");
 		return 1;
 	}
 
-	uint32_t id[20] = { 0 };
+	uint32_t id[512] = { 0 };
 	int nbrOfLoops = 1000;
 	QueryPerformanceFrequency(&Frequency);
 	QueryPerformanceCounter(&StartingTime);
 	for (int j = 0; j < nbrOfLoops; j++) {
-		canSpi->can->AHB_READ_BURST_START(0x8000, len);  
-		for (int i = 0; i < len; i++) {
-			id[i] = canSpi->can->AHB_READ_BURST_READ();
-		}
-		canSpi->can->AHB_READ_BURST_END();
-		if (strcmp((char*)id, "TCAN4550") != 0) {
+		canSpi->can->AHB_READ_BURST(0x8000, len, id);
+		if (strncmp((char*)id, "TCAN4550", 8) != 0) {
 			if (errNbr < 5) printf("Failed: DeviceIdent read 0x%08x%08x\n", id[0], id[1]);
 			errNbr++;
 			if (errNbr >= 9) {
@@ -669,6 +1035,89 @@ int CanFdTest::testPCIeSpeed(void)
 	return 0;
 }
 
+static void printBandwidth(const char* name, size_t bytes, uint64_t ns)
+{
+	printf("  %-12s %8.1f MB/s\n", name, ns == 0 ? 0.0 : (double)bytes * 1000.0 / (double)ns);
+}
+
+/** @brief Compare the byte loops with the block MMIO functions on the DPR and the MDDR
+ * @param nbrOfLoops Number of times each region is transferred per measurement.
+ * @retval Number of bytes read back wrong after a block write.
+ */
+int CanFdTest::testMmioBlock(int nbrOfLoops)
+{
+	struct {
+		const char* name;
+		volatile uint8_t* mem;
+		size_t len;
+		bool writeCombined;
+	} regions[2] = {
+		{ "DPR", (volatile uint8_t*)dut->dpr, PCIeMini_CAN_FD::dpr_length, false },
+		{ "MDDR", (volatile uint8_t*)dut->mddr, 0x1000, dut->bar3.WriteCombined },
+	};
+	uint8_t buffer[0x1000];
+	uint8_t check[0x1000];
+	int errNbr = 0;
+	uint64_t t0;
+
+	for (size_t i = 0; i < sizeof(buffer); i++)
+		buffer[i] = (uint8_t)(i * 7 + 3);
+
+	for (int r = 0; r < 2; r++) {
+		volatile uint8_t* mem = regions[r].mem;
+		size_t len = regions[r].len;
+		size_t total = len * nbrOfLoops;
+		if (mem == NULL)
+			continue;
+		printf("%s, %lu bytes, %s:\n", regions[r].name, len, regions[r].writeCombined ? "write-combined" : "uncached");
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			for (size_t i = 0; i < len; i++)
+				mem[i] = buffer[i];
+		AlphiBoard::flushWriteCombined();
+		printBandwidth("byte write", total, LatencyHistogram::getTimeNs() - t0);
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			AlphiBoard::mmioWrite(mem, buffer, len);
+		printBandwidth("block write", total, LatencyHistogram::getTimeNs() - t0);
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			for (size_t i = 0; i < len; i++)
+				check[i] = mem[i];
+		printBandwidth("byte read", total, LatencyHistogram::getTimeNs() - t0);
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			AlphiBoard::mmioRead(check, mem, len);
+		printBandwidth("block read", total, LatencyHistogram::getTimeNs() - t0);
+
+		for (size_t i = 0; i < len; i++) {
+			if (check[i] != buffer[i]) {
+				if (errNbr < 5) printf("error @ offset %lu: wrote 0x%02x, read 0x%02x\n", i, buffer[i], check[i]);
+				errNbr++;
+			}
+		}
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			for (size_t i = 0; i < len; i++)
+				mem[i] = 0;
+		AlphiBoard::flushWriteCombined();
+		printBandwidth("byte fill", total, LatencyHistogram::getTimeNs() - t0);
+
+		t0 = LatencyHistogram::getTimeNs();
+		for (int l = 0; l < nbrOfLoops; l++)
+			AlphiBoard::mmioFill(mem, 0, len);
+		printBandwidth("block fill", total, LatencyHistogram::getTimeNs() - t0);
+	}
+	if (errNbr == 0) printf("Block MMIO test passed\n");
+	else printf("Block MMIO test: %d bytes wrong\n", errNbr);
+	return errNbr;
+}
+
 int CanFdTest::checkIrq(int chNumber, int verbose)
 {
 	TCAN4550* can = dut->can[chNumber];	
@@ -1072,6 +1521,7 @@ int CanFdTest::testTiLibIrq(int nbrOfTestLoops)
 	checkIrq(0);
 
 	dut->hookInterruptServiceRoutine(0xffff, (MINIPCIE_INT_HANDLER)PORT1_ISR, (void*)this);
+	dut->resetIrqLatency();
 	dut->enableInterrupts();
 	for (int i = 0; i < dut->nbrOfCanInterfaces; i++) {
 		TCAN4550* can = dut->can[i];
@@ -1144,8 +1594,10 @@ int CanFdTest::testTiLibIrq(int nbrOfTestLoops)
 				TCAN4x5x_MCAN_RX_Header MsgHeader = { 0 };		// Initialize to 0 or you'll get garbage
 				uint8_t numBytes = 0;
 				uint8_t dataPayload[64] = { 0 };
+				TCAN4x5x_Device_Interrupts dev_ir = { 0 };
+				TCAN4x5x_MCAN_Interrupts mcan_ir = { 0 };
 
-				can->MCAN_ClearInterruptsAll();	// Clear any of the interrupt bits that are set.
+				can->Device_ServiceInterrupts(&dev_ir, &mcan_ir);	// Read and clear the interrupt bits that are set, in one batch
 				while (!isRxFifo0Empty(can->can) && nbrErrors <= 5) {
 					numBytes = can->MCAN_ReadNextFIFO(RXFIFO0, &MsgHeader, dataPayload);	// This will read the next element in the RX FIFO 0
 					msgRxNbr[chnNbr]++;
@@ -1179,6 +1631,8 @@ int CanFdTest::testTiLibIrq(int nbrOfTestLoops)
 		}
 	}
 	printf("%d packets in %7.3f seconds (%7.1f msg/sec, %7.1f microsecs/msg)\n", totalPackets, delay, totalPackets / delay, (delay * 1000000.0) / totalPackets);
+	dut->measureIrqThreadWakeLatency(100);
+	dut->printIrqLatency();
 	return nbrErrors;
 }
 
@@ -106,8 +106,14 @@ public:
 	int testSpiReadMultDMA(uint8_t spiController, int len);
 	int testSpiWrite(uint8_t spiController);
 	int testSpiReadWrite(int nbrOfLoops);
+	int testSpiArbiter(int nbrOfLoops = 10000);
 	int testPCIeSpeed();
+	int testMmioBlock(int nbrOfLoops = 100);
 	int testLocalBlockDma(uint32_t tfrLengthWord);
+	int testDmaQueue(int nbrOfLoops = 1000);
+	int testHostDma();
+	int testDmaCompletion(int nbrOfLoops = 1000);
+	int testDmaEngine(int nbrOfLoops = 1000);
 	int testPCIeDma();
 	int testPCIeToBrdDma(TransferDesc* tfrDesc);
 	int testBrdToPCIeDma(TransferDesc* tfrDesc);
@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include "CanFdTest.h"
+#include "UioEnumerator.h"
 
 using namespace std;
 
@@ -40,6 +41,8 @@ int main(int argc, char* argv[])
 	int verbose = 0;
 	int brdNbr = 0;
 	bool executeLoopback = false;
+	bool realTimeIrq = false;
+	bool writeCombined = false;
 	int i;
 	CanFdTest *tst = CanFdTest::getInstance();
 
@@ -64,8 +67,25 @@ int main(int argc, char* argv[])
 		case 't':
 			executeLoopback = true;
 			break;
+		case 'r':
+			realTimeIrq = true;
+			break;
+		case 'w':
+			writeCombined = true;
+			break;
+		case 'l':
+			UioEnumerator::getInstance()->print();
+			exit(0);
+		case 's':
+			brdNbr = UioEnumerator::getInstance()->findBySlot(argv[i] + 1);
+			if (brdNbr < 0) {
+				std::cout << "No board in slot " << argv[i] + 1 << endl;
+				exit(1);
+			}
+			break;
 		case '?':
-			std::cout << endl << "Possible options: <brd nbr>, v: verbose, t: starts the test" << endl;
+			std::cout << endl << "Possible options: <brd nbr>, v: verbose, t: starts the test, r: real-time interrupt thread, "
+				"w: write-combined MDDR, l: list the boards, s<PCI address>: board in this slot" << endl;
 			exit(0);
 		}
 	}
@@ -74,6 +94,18 @@ int main(int argc, char* argv[])
 	std::cout << "=============" << endl;
 	tst->verbose = verbose; 
 	tst->dut->verbose = verbose;
+	if (realTimeIrq) {
+		IrqThreadConfig cfg = { 0 };
+		cfg.schedPolicy = SCHED_FIFO;
+		cfg.priority = 80;
+		cfg.prefaultSize = 0x10000;
+		cfg.lockMemory = true;
+		if (tst->dut->setIrqThreadConfig(&cfg) != ERRCODE_NO_ERROR)
+			std::cout << "Invalid real-time interrupt thread configuration" << endl;
+	}
+
+	if (writeCombined)
+		tst->dut->setBarWriteCombined(3, true);
 
 	tst->mainTest(brdNbr, executeLoopback);
 
@@ -167,7 +199,11 @@ int CanFdTest::sendCanMesg()
 		}
 	printf("Msg sent:");
 	printTxMsg(&header, data);
-	dut->can[portNumber]->MCAN_WriteTXBuffer(0, &header, data);	
+	if (dut->can[portNumber]->MCAN_WriteTXBuffer(0, &header, data) == 0) {
+		printf("The message could not be written to the TX buffer\n");
+		cyclical[portNumber] = 0;
+		return 1;
+	}
 	dut->can[portNumber]->can->AHB_WRITE_32(REG_MCAN_TXBAR, 1);
 	lastMsgTs[portNumber] = now;
 	return 0;
@@ -273,6 +309,16 @@ int CanFdTest::mainTest(int brdNbr, bool executeLoopback)
 				printf("4: set baud rate\n");
 				//			printf("5: wipe firmware\n");
 				printf("6: quickTest\n");
+				printf("m: block MMIO benchmark\n");
+				printf("a: SPI arbiter, one thread per channel\n");
+				printf("b: TCAN burst read of the whole MRAM\n");
+#ifdef DMA_ENABLED
+				printf("q: DMA descriptor queue test\n");
+				printf("h: host DMA test\n");
+				printf("c: DMA completion latency, polling and interrupt\n");
+				printf("e: asynchronous DMA engine\n");
+				printf("d: TCAN burst read by DMA\n");
+#endif
 				printf("t: update terminations\n");
 				printf("v: toggle verbose mode\n");
 				printf("x: exit the application\n");
@@ -293,6 +339,40 @@ int CanFdTest::mainTest(int brdNbr, bool executeLoopback)
 				dut->verbose = verbose;
 				printf("verbose is now %s\n", verbose ? "on" : "off");
 				break;
+			case 'm':
+			case 'M':
+				testMmioBlock();
+				break;
+			case 'a':
+			case 'A':
+				testSpiArbiter();
+				break;
+			case 'b':
+			case 'B':
+				testSpiReadMult(0, 512);
+				break;
+#ifdef DMA_ENABLED
+			case 'q':
+			case 'Q':
+				testDmaQueue();
+				break;
+			case 'h':
+			case 'H':
+				testHostDma();
+				break;
+			case 'c':
+			case 'C':
+				testDmaCompletion();
+				break;
+			case 'e':
+			case 'E':
+				testDmaEngine();
+				break;
+			case 'd':
+			case 'D':
+				testSpiReadMultDMA(0, 64);
+				break;
+#endif
 			case 't':
 			case 'T':
 				for (int chnNbr = 0; chnNbr < dut->nbrOfCanInterfaces; chnNbr++) {
@@ -55,8 +55,10 @@ PCIeMini_CAN_FD::PCIeMini_CAN_FD() :
 	input1 = NULL;
 	dpr = NULL;
 	dma = NULL;
+	dmaIrqNbr = -1;
 	ledPio = NULL;
 	mddr = NULL;
+	spiArbiter = NULL;
 }
 
 //! Open: connect to an actual board
@@ -84,6 +86,7 @@ PCIeMini_status PCIeMini_CAN_FD::open(int brdNbr)
 	cra->setTxsAvlAddress(txs_offset, 0x1000000, 2);
 
 	controlRegister = new AlteraPio(getBar2Address(control_offset), AlteraPio::CAP_OUTPUT);
+	controlRegister->setShadowMode(true);
 	ledPio = new AlteraPio(getBar2Address(ledPio_offset), AlteraPio::CAP_OUTPUT);
 	irig = new IrigDecoder(getBar2Address(irig_offset));
 #ifdef DMA_ENABLED
@@ -96,15 +99,29 @@ PCIeMini_status PCIeMini_CAN_FD::open(int brdNbr)
 	{
 //		can[i] = new TCAN4550(getBar2Address((size_t)(spi_offset + (size_t)(i) * 0x40)), ledPio, i);
 		new ParallelInput(getBar2Address(input1_offset));
-		can[i] = new TCAN4550(getBar2Address(spi_offset), 
-			new AlteraPio(getBar2Address((size_t)tcans_offset + i * tcans_size + tcans_ctrl_offset), AlteraPio::CAP_OUTPUT),
-			new ParallelInput(getBar2Address((size_t)tcans_offset + i* tcans_size + tcans_st_offset)),
-			i);
+		AlteraPio* tcanCtrl = new AlteraPio(getBar2Address((size_t)tcans_offset + i * tcans_size + tcans_ctrl_offset), AlteraPio::CAP_OUTPUT);
+		ParallelInput* tcanStatus = new ParallelInput(getBar2Address((size_t)tcans_offset + i* tcans_size + tcans_st_offset));
+		// the host is the only writer of the control and interrupt enable registers
+		tcanCtrl->setShadowMode(true);
+		tcanStatus->setShadowMode(true);
+		can[i] = new TCAN4550(getBar2Address(spi_offset), tcanCtrl, tcanStatus, i);
+	}
+	spiArbiter = new TcanSpiArbiter();
+	for (int i = 0; i < nbrOfCanInterfaces; i++) {
+		spiArbiter->addChannel(can[i]->can);
 	}
 
 	dpr = (volatile uint32_t*)getBar2Address(dpr_offset);
 	mddr = (volatile uint16_t*)getBar3Address(mddr_offset);
 
+#ifdef DMA_ENABLED
+	// long TCAN burst reads go through the DMA, staged in the upper half of the DPR
+	for (int i = 0; i < nbrOfCanInterfaces; i++) {
+		can[i]->can->setDmaReader(dma, spi_offset, dpr + dmaStaging_offset / 4,
+			dpr_offset + dmaStaging_offset, dmaStaging_length);
+	}
+#endif
+
 	return ERRCODE_NO_ERROR;
 }
 
@@ -114,6 +131,9 @@ PCIeMini_status PCIeMini_CAN_FD::open(int brdNbr)
 */
 PCIeMini_status PCIeMini_CAN_FD::close()
 {
+	stopSpiArbiter();
+	delete spiArbiter;
+	spiArbiter = NULL;
 	AlphiBoard::Close();
 
 	delete controlRegister;
@@ -127,6 +147,9 @@ PCIeMini_status PCIeMini_CAN_FD::close()
 	delete input1;
 	input0 = NULL;
 	input1 = NULL;
+	delete dma;
+	dma = NULL;
+	dmaIrqNbr = -1;
 
 	dpr = NULL;
 
@@ -155,13 +178,278 @@ PCIeMini_status PCIeMini_CAN_FD::reset()
 	return ERRCODE_NO_ERROR;
 }
 
+//! Serialize the TCAN transactions through the SPI arbiter
+/*!
+	Once started, the TCAN4550 objects can be used from one thread per channel. The transactions of
+	the channels are executed one at a time by the dispatcher thread of the arbiter.
+	\param policy TcanSpiArbiter::policyFair for round robin, TcanSpiArbiter::policyPriority to serve the
+		channels by priority, see TcanSpiArbiter::setPriority().
+	\param quantum Largest number of transactions executed on one chip before switching to another one.
+	\return  ERRCODE_NO_ERROR if successful.
+*/
+PCIeMini_status PCIeMini_CAN_FD::startSpiArbiter(TcanSpiArbiter::Policy policy, uint32_t quantum)
+{
+	if (spiArbiter == NULL)
+		return ERRCODE_INVALID_HANDLE;
+	PCIeMini_status status = spiArbiter->start(policy, quantum);
+	if (status != ERRCODE_NO_ERROR)
+		return status;
+	for (int i = 0; i < nbrOfCanInterfaces; i++) {
+		can[i]->can->setArbiter(spiArbiter);
+	}
+	return ERRCODE_NO_ERROR;
+}
+
+//! Return to direct SPI accesses, the channels must be idle
+void PCIeMini_CAN_FD::stopSpiArbiter()
+{
+	if (spiArbiter == NULL || !spiArbiter->isRunning())
+		return;
+	for (int i = 0; i < nbrOfCanInterfaces; i++) {
+		can[i]->can->setArbiter(NULL);
+	}
+	spiArbiter->stop();
+}
+
 #ifdef DMA_ENABLED
 
 void PCIeMini_CAN_FD::hwDMAStart(TransferDesc* tfrDesc)
 {
-	dma->launch_bidir(tfrDesc);
+	dma->start(tfrDesc);
+}
+
+#ifdef LINUX
+/** @brief Wait for the end of the transfer started by hwDMAStart()
+ @param fPolling When true the DMA controller is polled, even if the DMA interrupt is enabled.
+		Otherwise the calling thread sleeps until the interrupt, if hwDMAInterruptEnable() has been called.
+ @return false after 10 ms without completion.
+ */
+bool PCIeMini_CAN_FD::hwDMAWaitForCompletion(TransferDesc* tfrDesc, bool fPolling)
+{
+	bool done = dma->waitDone(tfrDesc, 10000, fPolling) == ERRCODE_NO_ERROR;
+	hwDMARelease(tfrDesc);
+	return done;
+}
+
+/** @brief Release the address translation entry pinned by hwDMAProgram() or hwDMAProgramChain()
+ *
+ * Called by hwDMAWaitForCompletion(). A descriptor run by other means, an AlteraDmaQueue for example,
+ * must be released by the caller once its transfer is over, or the entry is never reused.
+ */
+void PCIeMini_CAN_FD::hwDMARelease(TransferDesc* tfrDesc)
+{
+	if (tfrDesc->trEntry >= 0) {
+		cra->unpinTrEntry(tfrDesc->trEntry);
+		tfrDesc->trEntry = -1;
+	}
+}
+
+/** @brief Find the Avalon interrupt line of the DMA controller
+ *
+ * A short DPR to DPR transfer is run with the DMA interrupt enabled, the line is the one that
+ * drops when DONE is cleared. The CRA does not need to enable the line for this.
+ * The controller is acquired for the probe, the caller must not own it. The word written is
+ * below the TCAN staging area, it is restored afterwards.
+ @return The line number, or -1 if it cannot be found.
+ */
+int PCIeMini_CAN_FD::findDMAIrqLine()
+{
+	TransferDesc t;
+	t.src_offset = dpr_offset;
+	t.dest_offset = dpr_offset + dmaStaging_offset - 4;
+	t.tfr_length = 4;
+
+	dma->acquire();
+	uint32_t saved = dpr[dmaStaging_offset / 4 - 1];
+	bool irqMode = dma->getIrqMode();
+	dma->setIrqMode(false);
+	dma->clearDone();
+	uint32_t idle = cra->getIrqStatus() & PcieCra::avlIrqMask;
+	dma->setControlBit(ALTERA_AVALON_DMA_CONTROL_I_EN_MSK);
+	dma->launch_bidir(&t);
+
+	uint64_t start = LatencyHistogram::getTimeNs();
+	while (!dma->isDone() && LatencyHistogram::getTimeNs() - start < 10000000)
+		;
+	uint32_t asserted = cra->getIrqStatus() & PcieCra::avlIrqMask;
+	dma->clearDone();
+	uint32_t cleared = cra->getIrqStatus() & PcieCra::avlIrqMask;
+	dma->setIrqMode(irqMode);
+	dpr[dmaStaging_offset / 4 - 1] = saved;
+	dma->release();
+
+	uint32_t line = asserted & ~cleared & ~idle;
+	if (line == 0 || (line & (line - 1)) != 0)
+		return -1;
+	return __builtin_ctz(line);
+}
+
+/** @brief Signal the end of the DMA transfers by interrupt
+ *
+ * The DMA handler is hooked on the line and the line is added to the enabled interrupts.
+ * hwDMAWaitForCompletion() then sleeps instead of polling, and the callback set with
+ * dma->setDoneCallback() is called from the interrupt thread.
+ @param irqNbr Avalon interrupt line of the DMA controller, -1 to find it with findDMAIrqLine().
+ @param handler Handler hooked on the line, NULL for AlteraDma::irqHandler. A DmaEngine hooks
+		DmaEngine::irqHandler, before DmaEngine::start() as findDMAIrqLine() uses the controller.
+ @param userData User data of the handler.
+ @retval ERRCODE_INT_NOT_ENABLED if the line cannot be found.
+ */
+PCIeMini_status PCIeMini_CAN_FD::hwDMAInterruptEnable(int irqNbr, MINIPCIE_INT_HANDLER handler, void* userData)
+{
+	if (irqNbr < 0)
+		irqNbr = findDMAIrqLine();
+	if (irqNbr < 0)
+		return ERRCODE_INT_NOT_ENABLED;
+
+	if (handler == NULL) {
+		handler = AlteraDma::irqHandler;
+		userData = dma;
+	}
+	PCIeMini_status status = hookIrqHandler(irqNbr, handler, userData);
+	if (status != ERRCODE_NO_ERROR)
+		return status;
+	dmaIrqNbr = irqNbr;
+	dma->setIrqMode(true);
+	cra->setIrqEnableMask(cra->getRequestedIrqMask() | (1 << irqNbr));
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Return to polling for the end of the DMA transfers */
+void PCIeMini_CAN_FD::hwDMAInterruptDisable()
+{
+	if (dmaIrqNbr < 0)
+		return;
+	dma->setIrqMode(false);
+	cra->setIrqEnableMask(cra->getRequestedIrqMask() & ~(1 << dmaIrqNbr));
+	unhookIrqHandler(dmaIrqNbr);
+	dmaIrqNbr = -1;
+}
+
+/** @brief program the local devices (DMA and CRA) for a DMA to or from a host buffer
+ @param buffer Host buffer, allocated by the DMA provider of the board.
+ @param offset Offset of the transfer in the buffer.
+ @param length Length of the transfer in bytes.
+ @param fToDev When true DMA to device, when false DMA from device.
+ @param u32LocalAddr Avalon address on the board side.
+ The translation entry is reused when the page of the buffer is already mapped. It stays pinned
+ until hwDMAWaitForCompletion() or hwDMARelease(), so no other transfer can remap it meanwhile.
+ @retval ERRCODE_INVALID_VALUE if the transfer is not contiguous on the bus or crosses a translation page,
+		use hwDMAProgramChain() for those.
+ @retval ERRCODE_BUSY if all the translation entries are pinned by transfers in progress.
+ */
+PCIeMini_status PCIeMini_CAN_FD::hwDMAProgram(
+	DmaBuffer* buffer,
+	size_t offset,
+	uint32_t length,
+	bool fToDev,
+	uint32_t u32LocalAddr,
+	TransferDesc* tfrDesc)
+{
+	if (buffer == NULL || length == 0 || buffer->getContiguousLength(offset) < length)
+		return ERRCODE_INVALID_VALUE;
+
+	// a descriptor programmed again is not in flight any more
+	hwDMARelease(tfrDesc);
+
+	// map the page holding the buffer and calculate the local address in the txs
+	uint64_t pcieAddress = buffer->getBusAddress(offset);
+	uint32_t txsLocalAddress, mappedLength;
+	int entry;
+	PCIeMini_status status = cra->mapPcieAddress(pcieAddress, length, &txsLocalAddress, &mappedLength, &entry);
+	if (status != ERRCODE_NO_ERROR)
+		return status;
+	if (mappedLength < length) {
+		cra->unpinTrEntry(entry);
+		return ERRCODE_INVALID_VALUE;
+	}
+	tfrDesc->trEntry = entry;
+
+	tfrDesc->tfr_length = length;
+	tfrDesc->txs_offset = txsLocalAddress;
+	tfrDesc->bufLength = length;
+	tfrDesc->userSpaceBuffer = (uint32_t*)((uint8_t*)buffer->address + offset);
+
+	if (fToDev) {		// DMA to device
+		tfrDesc->src_offset = txsLocalAddress;
+		tfrDesc->dest_offset = u32LocalAddr;
+	}
+	else {				// DMA from device
+		tfrDesc->src_offset = u32LocalAddr;
+		tfrDesc->dest_offset = txsLocalAddress;
+	}
+	return ERRCODE_NO_ERROR;
 }
 
+/** @brief program a list of descriptors for a DMA to or from a host buffer
+ *
+ * The transfer is split where the buffer is not contiguous on the bus and at the translation
+ * page boundaries, one descriptor per piece. The descriptors can be run one after the other
+ * with hwDMAStart(), or queued in an AlteraDmaQueue. Each descriptor pins its translation entry
+ * until hwDMAWaitForCompletion() or hwDMARelease() is called for it.
+ @param buffer Host buffer, allocated by the DMA provider of the board.
+ @param offset Offset of the transfer in the buffer.
+ @param length Length of the transfer in bytes.
+ @param fToDev When true DMA to device, when false DMA from device.
+ @param u32LocalAddr Avalon address on the board side, incremented with each piece.
+ @param tfrDesc Array of descriptors to fill.
+ @param maxDesc Size of the array.
+ @param nbrOfDesc Receives the number of descriptors used.
+ @retval ERRCODE_INVALID_VALUE if the transfer is outside of the buffer, needs more than maxDesc
+		descriptors or more pages than the translation table holds.
+ @retval ERRCODE_BUSY if all the translation entries are pinned by transfers in progress.
+ */
+PCIeMini_status PCIeMini_CAN_FD::hwDMAProgramChain(
+	DmaBuffer* buffer,
+	size_t offset,
+	uint32_t length,
+	bool fToDev,
+	uint32_t u32LocalAddr,
+	TransferDesc* tfrDesc,
+	int maxDesc,
+	int* nbrOfDesc)
+{
+	int n = 0;
+
+	if (buffer == NULL || length == 0 || offset + length > buffer->length)
+		return ERRCODE_INVALID_VALUE;
+
+	PCIeMini_status status = ERRCODE_NO_ERROR;
+	while (length > 0) {
+		if (n >= maxDesc || n >= cra->getNbrOfTrEntries()) {
+			status = ERRCODE_INVALID_VALUE;
+			break;
+		}
+		size_t contiguous = buffer->getContiguousLength(offset);
+		uint32_t pieceLength = (contiguous < length) ? (uint32_t)contiguous : length;
+		uint32_t txsLocalAddress, mappedLength;
+		TransferDesc* t = &tfrDesc[n];
+		hwDMARelease(t);
+		status = cra->mapPcieAddress(buffer->getBusAddress(offset), pieceLength, &txsLocalAddress, &mappedLength, &t->trEntry);
+		if (status != ERRCODE_NO_ERROR)
+			break;
+		n++;
+
+		t->tfr_length = mappedLength;
+		t->txs_offset = txsLocalAddress;
+		t->bufLength = mappedLength;
+		t->userSpaceBuffer = (uint32_t*)((uint8_t*)buffer->address + offset);
+		t->src_offset = fToDev ? txsLocalAddress : u32LocalAddr;
+		t->dest_offset = fToDev ? u32LocalAddr : txsLocalAddress;
+
+		offset += mappedLength;
+		u32LocalAddr += mappedLength;
+		length -= mappedLength;
+	}
+	if (status != ERRCODE_NO_ERROR) {
+		for (int i = 0; i < n; i++)
+			hwDMARelease(&tfrDesc[i]);
+		n = 0;
+	}
+	*nbrOfDesc = n;
+	return status;
+}
+#else
 bool PCIeMini_CAN_FD::hwDMAWaitForCompletion(TransferDesc* tfrDesc, bool fPolling)
 {
 	LARGE_INTEGER StartingTime, EndingTime, ElapsedMicroseconds;
@@ -217,5 +505,6 @@ void PCIeMini_CAN_FD::hwDMAProgram(
 	Sleep(10);
 
 }
+#endif // LINUX
 #endif
 
@@ -760,27 +760,35 @@ TCAN4550::MRAM_Clear(void)
  * @warning @c dataPayload[] must be at least as big as the largest possible data payload, otherwise writing to out of bounds 
  * memory may occur
  *
- * @return the number of bytes that were read from the TCAN4x5x and stored into @c dataPayload[]
+ * @return the number of bytes that were read from the TCAN4x5x and stored into @c dataPayload[], 0 when the
+ * element could not be read: it is not acknowledged then
  */
 uint8_t
 TCAN4550::MCAN_ReadNextFIFO(TCAN4x5x_MCAN_FIFO_Enum FIFODefine, TCAN4x5x_MCAN_RX_Header *header, uint8_t dataPayload[])
 {
     uint32_t readData;
+    uint32_t fifoConfig, fifoStatus, rxesc;
     uint16_t startAddress;
     uint8_t i = 0;
     uint8_t getIndex, elementSize;
+    TcanBatch batch;
+
+    // Get the get buffer location and size, depending on the source type. The configuration and
+    // status registers are adjacent, they are read in one burst
+    batch.read((FIFODefine == RXFIFO1) ? REG_MCAN_RXF1C : REG_MCAN_RXF0C, &fifoConfig);
+    batch.read((FIFODefine == RXFIFO1) ? REG_MCAN_RXF1S : REG_MCAN_RXF0S, &fifoStatus);
+    batch.read(REG_MCAN_RXESC, &rxesc);
+    if (can->execute(&batch) != ERRCODE_NO_ERROR)
+        return 0;
 
-    // Get the get buffer location and size, depending on the source type
     switch (FIFODefine)
     {
         default: // RXFIFO0 is default
         {
-            readData = can->AHB_READ_32(REG_MCAN_RXF0S);
-            getIndex = (uint8_t) ((readData & 0x3F00) >> 8);
+            getIndex = (uint8_t) ((fifoStatus & 0x3F00) >> 8);
             // Get the RX 0 Start location and size...
-            readData = can->AHB_READ_32(REG_MCAN_RXF0C);
-            startAddress = (uint16_t)(readData & 0x0000FFFF) + REG_MRAM;
-            readData = (can->AHB_READ_32(REG_MCAN_RXESC) & 0x07);
+            startAddress = (uint16_t)(fifoConfig & 0x0000FFFF) + REG_MRAM;
+            readData = (rxesc & 0x07);
             elementSize = MCAN_TXRXESC_DataByteValue(readData); // Maximum theoretical data payload supported by this MCAN configuration
             // Calculate the actual start address for the latest index
             startAddress += (((uint32_t)elementSize + 8) * getIndex);
@@ -789,12 +797,10 @@ TCAN4550::MCAN_ReadNextFIFO(TCAN4x5x_MCAN_FIFO_Enum FIFODefine, TCAN4x5x_MCAN_RX
 
         case RXFIFO1:
         {
-            readData = can->AHB_READ_32(REG_MCAN_RXF1S);
-            getIndex = (uint8_t) ((readData & 0x3F00) >> 8);
+            getIndex = (uint8_t) ((fifoStatus & 0x3F00) >> 8);
             // Get the RX 1 Start location and size...
-            readData = can->AHB_READ_32(REG_MCAN_RXF1C);
-            startAddress = (uint16_t)(readData & 0x0000FFFF) + REG_MRAM;
-            readData = (can->AHB_READ_32(REG_MCAN_RXESC) & 0x70) >> 4;
+            startAddress = (uint16_t)(fifoConfig & 0x0000FFFF) + REG_MRAM;
+            readData = (rxesc & 0x70) >> 4;
             elementSize = MCAN_TXRXESC_DataByteValue(readData); // Maximum theoretical data payload supported by this MCAN configuration
             // Calculate the actual start address for the latest index
             startAddress += (((uint32_t)elementSize + 8) * getIndex);
@@ -803,9 +809,14 @@ TCAN4550::MCAN_ReadNextFIFO(TCAN4x5x_MCAN_FIFO_Enum FIFODefine, TCAN4x5x_MCAN_RX
     }
 
 
-    // Read the data, start with a burst read
-    can->AHB_READ_BURST_START(startAddress, 2);
-    readData = can->AHB_READ_BURST_READ(); // First header
+    // Read the whole element in one burst: the two header words and the largest payload the
+    // element can hold. Full CAN FD elements are long enough to go through the DMA.
+    // The element is left in the FIFO when it could not be read.
+    uint32_t element[2 + 16];
+    if (can->AHB_READ_BURST(startAddress, 2 + ((elementSize + 3) >> 2), element) != ERRCODE_NO_ERROR)
+        return 0;
+
+    readData = element[0];  // First header
     header->ESI	= (readData & 0x80000000) >> 31;
     header->XTD	= (readData & 0x40000000) >> 30;
     header->RTR	= (readData & 0x20000000) >> 29;
@@ -815,8 +826,7 @@ TCAN4550::MCAN_ReadNextFIFO(TCAN4x5x_MCAN_FIFO_Enum FIFODefine, TCAN4x5x_MCAN_RX
     else
         header->ID	= (readData & 0x1FFC0000) >> 18;
 
-    readData = can->AHB_READ_BURST_READ();	// Second header
-    can->AHB_READ_BURST_END();				// Terminate the burst read
+    readData = element[1];	// Second header
     header->RXTS	= (readData & 0x0000FFFF);
     header->DLCode		= (readData & 0x000F0000) >> 16;
     header->BRS		= (readData & 0x00100000) >> 20;
@@ -829,22 +839,9 @@ TCAN4550::MCAN_ReadNextFIFO(TCAN4x5x_MCAN_FIFO_Enum FIFODefine, TCAN4x5x_MCAN_RX
     if (MCAN_DLCtoBytes(header->DLCode) < elementSize )
         elementSize = MCAN_DLCtoBytes(header->DLCode); // Returns the number of data bytes
 
-    // Start a burst read for the number of data bytes we require at the data payload area of the MRAM
-    // The equation below ensures that we will always read the correct number of words since the divide truncates any remainders, and we need a ceil()-like function
-    if (elementSize > 0) {
-        can->AHB_READ_BURST_START(startAddress + 8, (elementSize + 3) >> 2);
-        i = 0;	// Used to count the number of bytes we have read.
-        while (i < elementSize) {
-            if ((i % 4) == 0) {
-                readData = can->AHB_READ_BURST_READ();
-            }
-
-            dataPayload[i] = (uint8_t)((readData >> ((i % 4) * 8)) & 0xFF);
-            i++;
-            if (i > elementSize)
-                i = elementSize;
-        }
-        can->AHB_READ_BURST_END(); // Terminate the burst read
+    // The MRAM words are little endian, byte 0 of the payload is the LSB of the first word
+    for (i = 0; i < elementSize; i++) {
+        dataPayload[i] = (uint8_t)((element[2 + (i >> 2)] >> ((i % 4) * 8)) & 0xFF);
     }
     // Acknowledge the FIFO read
     switch (FIFODefine)
@@ -880,6 +877,7 @@ uint8_t
 TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, uint8_t dataPayload[])
 {
     uint32_t readData;
+    uint32_t burst[16];
     uint16_t startAddress;
     uint8_t i = 0, getIndex, elementSize;
 
@@ -898,9 +896,10 @@ TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, u
 
 
 
-    // Read the data, start with a burst read
-    can->AHB_READ_BURST_START(startAddress, 2);
-    readData = can->AHB_READ_BURST_READ(); // First header
+    // Read the data, start with a burst read. The buffer is not acknowledged when it could not be read
+    if (can->AHB_READ_BURST(startAddress, 2, burst) != ERRCODE_NO_ERROR)
+        return 0;
+    readData = burst[0]; // First header
     header->ESI	= (readData & 0x80000000) >> 31;
     header->XTD	= (readData & 0x40000000) >> 30;
     header->RTR	= (readData & 0x20000000) >> 29;
@@ -910,8 +909,7 @@ TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, u
     else
         header->ID	= (readData & 0x1FFC0000) >> 18;
 
-    readData = can->AHB_READ_BURST_READ();	// Second header
-    can->AHB_READ_BURST_END();				// Terminate the burst read
+    readData = burst[1];	// Second header
     header->RXTS	= (readData & 0x0000FFFF);
     header->DLCode		= (readData & 0x000F0000) >> 16;
     header->BRS		= (readData & 0x00100000) >> 20;
@@ -927,11 +925,12 @@ TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, u
     // Start a burst read for the number of data bytes we require at the data payload area of the MRAM
     // The equation below ensures that we will always read the correct number of words since the divide truncates any remainders, and we need a ceil()-like function
     if (elementSize > 0) {
-        can->AHB_READ_BURST_START(startAddress + 8, (elementSize + 3) >> 2);
+        if (can->AHB_READ_BURST(startAddress + 8, (elementSize + 3) >> 2, burst) != ERRCODE_NO_ERROR)
+            return 0;
         i = 0;	// Used to count the number of bytes we have read.
         while (i < elementSize) {
             if ((i % 4) == 0) {
-                readData = can->AHB_READ_BURST_READ();
+                readData = burst[i >> 2];
             }
 
             dataPayload[i] = (uint8_t)((readData >> ((i % 4) * 8)) & 0xFF);
@@ -939,7 +938,6 @@ TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, u
             if (i > elementSize)
                 i = elementSize;
         }
-        can->AHB_READ_BURST_END(); // Terminate the burst read
     }
     // Acknowledge the FIFO read
     if (getIndex < 32)
@@ -965,15 +963,17 @@ TCAN4550::MCAN_ReadRXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_RX_Header *header, u
  *
  * @warning @c dataPayload[] must be at least as big as the specified DLC size inside the @c *header struct
  *
- * @return the number of bytes that were read from the TCAN4x5x and stored into @c dataPayload[]
+ * @return the bit of the buffer to write to TXBAR, 0 if the index is out of range or the element could not be written:
+ * the transmission must not be requested then
  */
 uint32_t
 TCAN4550::MCAN_WriteTXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_TX_Header *header, uint8_t dataPayload[])
 {
     // Step 1: Get the start address of the
     uint32_t SPIData;
+    uint32_t burst[18];
     uint16_t startAddress;
-    uint8_t i, elementSize, temp;
+    uint8_t i, elementSize, temp, words, w = 0;
 
 
     // Get the TX Start location and size...
@@ -1002,8 +1002,8 @@ TCAN4550::MCAN_WriteTXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_TX_Header *header,
     if (MCAN_DLCtoBytes(header->DLCode & 0x0F) % 4) {	// If we don't have a whole word worth of data... We need to round up to the nearest word (by default it truncates). Can be done by simply adding another word.
         elementSize += 1;
     }
-    // Write the data, start with a burst write
-    can->AHB_WRITE_BURST_START(startAddress, elementSize);
+    // Write the data, the burst is built in a buffer
+    words = elementSize;
     SPIData = 0;
 
     SPIData			|= ((uint32_t)header->ESI & 0x01) << 31;
@@ -1015,7 +1015,7 @@ TCAN4550::MCAN_WriteTXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_TX_Header *header,
     else
         SPIData		|= ((uint32_t)header->ID & 0x07FF) << 18;
 
-    can->AHB_WRITE_BURST_WRITE(SPIData);
+    burst[w++] = SPIData;
 
     SPIData = 0;
     SPIData			|= ((uint32_t)header->DLCode & 0x0F) << 16;
@@ -1023,7 +1023,7 @@ TCAN4550::MCAN_WriteTXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_TX_Header *header,
     SPIData			|= ((uint32_t)header->FDF & 0x01) << 21;
     SPIData			|= ((uint32_t)header->EFC & 0x01) << 23;
     SPIData			|= ((uint32_t)header->MM & 0xFF) << 24;
-    can->AHB_WRITE_BURST_WRITE(SPIData);
+    burst[w++] = SPIData;
 
     // Get the actual data
     elementSize = MCAN_DLCtoBytes(header->DLCode & 0x0F); // Returns the number of data bytes
@@ -1038,22 +1038,23 @@ TCAN4550::MCAN_WriteTXBuffer(uint8_t bufIndex, TCAN4x5x_MCAN_TX_Header *header,
                 i++;
             }
 
-            can->AHB_WRITE_BURST_WRITE(SPIData);
+            burst[w++] = SPIData;
         } else {
             SPIData |= ((uint32_t)dataPayload[i++]);
             SPIData |= ((uint32_t)dataPayload[i++]) << 8;
             SPIData |= ((uint32_t)dataPayload[i++]) << 16;
             SPIData |= ((uint32_t)dataPayload[i++]) << 24;
 
-            can->AHB_WRITE_BURST_WRITE(SPIData);
+            burst[w++] = SPIData;
         }
 
         if (i > elementSize)
             i = elementSize;
     }
-    can->AHB_WRITE_BURST_END(); 				// Terminate the burst read
+    if (can->AHB_WRITE_BURST(startAddress, words, burst) != ERRCODE_NO_ERROR)
+        return 0;
 
-    return 0x00000001 << bufIndex;	// Return the number of bytes retrieved
+    return 0x00000001 << bufIndex;	// Return the bit to write to TXBAR
 }
 
 
@@ -1353,6 +1354,29 @@ TCAN4550::Device_ClearInterruptsAll(void)
 }
 
 
+/**
+ * @brief Read and clear the device and MCAN interrupts
+ *
+ * The four accesses are executed as one batch. Only the interrupts that were read are cleared,
+ * the ones set in the meantime stay pending.
+ *
+ * @param *dev_ir is a pointer to a @c TCAN4x5x_Device_Interrupts struct updated with the device interrupts
+ * @param *mcan_ir is a pointer to a @c TCAN4x5x_MCAN_Interrupts struct updated with the MCAN interrupts
+ */
+void
+TCAN4550::Device_ServiceInterrupts(TCAN4x5x_Device_Interrupts *dev_ir, TCAN4x5x_MCAN_Interrupts *mcan_ir)
+{
+    TcanBatch batch;
+
+    batch.read(REG_DEV_IR, &dev_ir->word);
+    batch.read(REG_MCAN_IR, &mcan_ir->word);
+    // the MCAN interrupt is cleared first, it is also reported in the device register
+    batch.writeFrom(REG_MCAN_IR, &mcan_ir->word);
+    batch.writeFrom(REG_DEV_IR, &dev_ir->word);
+    can->execute(&batch);
+}
+
+
 /**
  * @brief Read the device interrupt enable register
  *
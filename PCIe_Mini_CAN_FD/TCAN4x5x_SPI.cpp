@@ -42,6 +42,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "TCAN4550.h"
+#include "AlphiBoard.h"
 
  //    if (status & ALTERA_AVALON_SPI_CONTROL_IE_MSK) resetStatus(); 
 
@@ -55,6 +56,16 @@
  */
 void
 TcanInterface::AHB_WRITE_32(uint16_t address, uint32_t data)
+{
+    if (arbiter != NULL) {
+        submit(TcanSpiRequest::write32, address, 1, &data);
+        return;
+    }
+    ahbWrite32(address, data);
+}
+
+void
+TcanInterface::ahbWrite32(uint16_t address, uint32_t data)
 {
     uint32_t msg;
     uint8_t words = 1;
@@ -85,6 +96,17 @@ TcanInterface::AHB_WRITE_32(uint16_t address, uint32_t data)
  */
 uint32_t
 TcanInterface::AHB_READ_32(uint16_t address)
+{
+    if (arbiter != NULL) {
+        uint32_t data = 0;
+        submit(TcanSpiRequest::read32, address, 1, &data);
+        return data;
+    }
+    return ahbRead32(address);
+}
+
+uint32_t
+TcanInterface::ahbRead32(uint16_t address)
 {
     uint8_t words = 1;
     uint32_t returnData;
@@ -130,6 +152,7 @@ TcanInterface::AHB_WRITE_BURST_START(uint16_t address, uint8_t words)
     msg |= words;           // Send the number of words to read
 
     setTxData(msg);
+    txCredits = fifoDepth - 1;
 
 }
 
@@ -138,14 +161,14 @@ TcanInterface::AHB_WRITE_BURST_START(uint16_t address, uint8_t words)
  * @brief Burst write
  *
  * The SPI transaction contains 3 parts: the header (start), the payload, and the end of data (end)
- * This function writes a single word at a time
+ * This function writes a single word at a time, it waits for room in the transmit FIFO when needed
  *
  * @param data A 32-bit word of data to write to the destination register
  */
 void
 TcanInterface::AHB_WRITE_BURST_WRITE(uint32_t data)
 {
-    setTxData(data);
+    setTxDataPaced(data);
 }
 
 
@@ -170,7 +193,9 @@ TcanInterface::AHB_WRITE_BURST_END(void)
  * @brief Burst read start
  *
  * The SPI transaction contains 3 parts: the header (start), the payload, and the end of data (end)
- * This function is the start, where the register address and number of words are transmitted
+ * This function is the start, where the register address and number of words are transmitted.
+ * Only the dummy words that fit in the FIFOs are sent, AHB_READ_BURST_READ() sends the rest as
+ * the data is read; the chip select stays asserted until AHB_READ_BURST_END().
  *
  * @param address A 16-bit start address to begin the burst read
  * @param words The number of 4-byte words that will be transferred. 0 = 256 words
@@ -179,6 +204,8 @@ void
 TcanInterface::AHB_READ_BURST_START(uint16_t address, uint8_t words)
 {
     uint32_t msg;
+    uint32_t count = (words == 0) ? maxAhbWords : words;
+    uint32_t first = (count < fifoDepth - 1) ? count : fifoDepth - 1;
 
     //    WAIT_FOR_IDLE();
         //set the CS low to start the transaction
@@ -198,10 +225,16 @@ TcanInterface::AHB_READ_BURST_START(uint16_t address, uint8_t words)
 
     setTxData(msg);
 
-    for (int i = 0; i < words; i++) {
+    // the header and the first dummy words fill the FIFOs
+    for (uint32_t i = 0; i < first; i++) {
         setTxData(0);
     }
+    burstTxPending = count - first;
     getRxData();
+    if (burstTxPending > 0) {
+        setTxData(0);
+        burstTxPending--;
+    }
 }
 
 /**
@@ -218,6 +251,11 @@ TcanInterface::AHB_READ_BURST_READ(void)
     uint32_t returnData;
 
     returnData = getRxData();
+    // one word left the FIFOs, the next dummy word can be sent
+    if (burstTxPending > 0) {
+        setTxData(0);
+        burstTxPending--;
+    }
     return returnData;
 }
 
@@ -234,7 +272,330 @@ TcanInterface::AHB_READ_BURST_END(void)
 {
     // Clear SSO (release chipselect) and empty the receive FIFO
     setControl(control_resetFifo_mask);
+    burstTxPending = 0;
 
     //   printf("%d\n", maxRxFifoLevel);
 }
 
+/************************************************************************************************/
+/**
+ * @brief Burst read into a buffer
+ *
+ * Short bursts are read word by word by the processor. Longer ones are read by the DMA controller,
+ * which copies the receive data register (RCON mode) into the staging area as the words arrive;
+ * the staging area is then read with one block read. See setDmaReader().
+ *
+ * The reads longer than 256 words are split in several AHB transactions, the whole MRAM can be read
+ * at once.
+ *
+ * @param address A 16-bit start address to begin the burst read
+ * @param words The number of 4-byte words to read, up to the end of the address space
+ * @param data Destination of the words
+ *
+ * @return ERRCODE_NO_ERROR, ERRCODE_TIMEOUT if the DMA did not complete
+ */
+PCIeMini_status
+TcanInterface::AHB_READ_BURST(uint16_t address, uint16_t words, uint32_t* data)
+{
+    if (words == 0 || (uint32_t)address + (uint32_t)words * wordSize > 0x10000)
+        return ERRCODE_INVALID_VALUE;
+    while (words > 0) {
+        uint16_t chunk = (words > maxAhbWords) ? maxAhbWords : words;
+        PCIeMini_status status;
+
+        if (arbiter != NULL)
+            status = submit(TcanSpiRequest::readBurst, address, chunk, data);
+        else
+            status = ahbReadBurst(address, chunk, data);
+        if (status != ERRCODE_NO_ERROR)
+            return status;
+        address += chunk * wordSize;
+        data += chunk;
+        words -= chunk;
+    }
+    return ERRCODE_NO_ERROR;
+}
+
+PCIeMini_status
+TcanInterface::ahbReadBurst(uint16_t address, uint16_t words, uint32_t* data)
+{
+    // the processor reads while the controller is used by another client
+    if (isDmaRead(words) && dma->tryAcquire()) {
+        PCIeMini_status status = readBurstDma(address, words, data);
+        dma->release();
+        return status;
+    }
+    return readBurstPio(address, words, data);
+}
+
+/**
+ * @brief Burst write from a buffer
+ *
+ * The writes longer than 256 words are split in several AHB transactions.
+ *
+ * @param address A 16-bit start address to begin the burst write
+ * @param words The number of 4-byte words to write, up to the end of the address space
+ * @param data Source of the words
+ *
+ * @return ERRCODE_NO_ERROR, ERRCODE_INVALID_VALUE if the length is out of range
+ */
+PCIeMini_status
+TcanInterface::AHB_WRITE_BURST(uint16_t address, uint16_t words, const uint32_t* data)
+{
+    if (words == 0 || (uint32_t)address + (uint32_t)words * wordSize > 0x10000)
+        return ERRCODE_INVALID_VALUE;
+    while (words > 0) {
+        uint16_t chunk = (words > maxAhbWords) ? maxAhbWords : words;
+        PCIeMini_status status;
+
+        if (arbiter != NULL)
+            status = submit(TcanSpiRequest::writeBurst, address, chunk, (uint32_t*)data);
+        else
+            status = ahbWriteBurst(address, chunk, data);
+        if (status != ERRCODE_NO_ERROR)
+            return status;
+        address += chunk * wordSize;
+        data += chunk;
+        words -= chunk;
+    }
+    return ERRCODE_NO_ERROR;
+}
+
+PCIeMini_status
+TcanInterface::ahbWriteBurst(uint16_t address, uint16_t words, const uint32_t* data)
+{
+    AHB_WRITE_BURST_START(address, (uint8_t)words);
+    for (int i = 0; i < words; i++) {
+        AHB_WRITE_BURST_WRITE(data[i]);
+    }
+    AHB_WRITE_BURST_END();
+    return ERRCODE_NO_ERROR;
+}
+
+/**
+ * @brief Queue a transaction to the arbiter and wait for its execution
+ */
+PCIeMini_status
+TcanInterface::submit(TcanSpiRequest::Type type, uint16_t address, uint16_t words, uint32_t* data)
+{
+    TcanSpiRequest req;
+
+    req.type = type;
+    req.address = address;
+    req.words = words;
+    req.data = data;
+    req.ops = NULL;
+    return arbiter->execute(slave, &req);
+}
+
+/**
+ * @brief Execute a transaction, called by the dispatcher thread of the arbiter
+ */
+PCIeMini_status
+TcanInterface::runRequest(TcanSpiRequest* req)
+{
+    switch (req->type) {
+    case TcanSpiRequest::read32:
+        req->data[0] = ahbRead32(req->address);
+        return ERRCODE_NO_ERROR;
+    case TcanSpiRequest::write32:
+        ahbWrite32(req->address, req->data[0]);
+        return ERRCODE_NO_ERROR;
+    case TcanSpiRequest::readBurst:
+        return ahbReadBurst(req->address, req->words, req->data);
+    case TcanSpiRequest::writeBurst:
+        return ahbWriteBurst(req->address, req->words, req->data);
+    case TcanSpiRequest::batch:
+        return runBatch(req->ops);
+    }
+    return ERRCODE_INVALID_VALUE;
+}
+
+/************************************************************************************************/
+/**
+ * @brief Execute the register accesses queued in a batch
+ *
+ * The batch is executed in one arbiter request when an arbiter is attached.
+ *
+ * @param batch Accesses to execute, the results are scattered to their destinations
+ *
+ * @return ERRCODE_NO_ERROR, or the error of the first burst that failed
+ */
+PCIeMini_status
+TcanInterface::execute(TcanBatch* batch)
+{
+    if (arbiter != NULL) {
+        TcanSpiRequest req;
+
+        req.type = TcanSpiRequest::batch;
+        req.address = 0;
+        req.words = 0;
+        req.data = NULL;
+        req.ops = batch;
+        return arbiter->execute(slave, &req);
+    }
+    return runBatch(batch);
+}
+
+PCIeMini_status
+TcanInterface::runBatch(TcanBatch* batch)
+{
+    uint32_t frame[TcanBatch::maxOps];
+    int first = 0;
+
+    batch->frames = 0;
+    while (first < batch->nbrOfOps) {
+        TcanBatch::Op* op = &batch->ops[first];
+        int n = 1;
+        PCIeMini_status status;
+
+        // the next accesses in the same direction to the next addresses join the burst
+        while (first + n < batch->nbrOfOps && batch->ops[first + n].write == op->write
+            && batch->ops[first + n].address == op->address + n * wordSize)
+            n++;
+
+        if (op->write) {
+            for (int i = 0; i < n; i++)
+                frame[i] = (op[i].src != NULL) ? *op[i].src : op[i].value;
+            status = ahbWriteBurst(op->address, (uint16_t)n, frame);
+        }
+        else {
+            status = ahbReadBurst(op->address, (uint16_t)n, frame);
+            for (int i = 0; i < n; i++)
+                *op[i].dest = frame[i];
+        }
+        if (status != ERRCODE_NO_ERROR)
+            return status;
+        batch->frames++;
+        first += n;
+    }
+    return ERRCODE_NO_ERROR;
+}
+
+PCIeMini_status
+TcanInterface::readBurstPio(uint16_t address, uint16_t words, uint32_t* data)
+{
+    AHB_READ_BURST_START(address, (uint8_t)words);
+    for (int i = 0; i < words; i++) {
+        data[i] = AHB_READ_BURST_READ();
+    }
+    AHB_READ_BURST_END();
+    return ERRCODE_NO_ERROR;
+}
+
+PCIeMini_status
+TcanInterface::readBurstDma(uint16_t address, uint16_t words, uint32_t* data)
+{
+    TransferDesc t;
+    uint32_t msg;
+
+    // the first word received is the answer to the header
+    t.src_offset = rxDataAvlAddress;
+    t.dest_offset = stagingAvlAddress;
+    t.tfr_length = (words + 1) * wordSize;
+
+    setControl(ALTERA_AVALON_SPI_CONTROL_SSO_MSK | control_resetFifo_mask);
+    lastRxFifoLevel = 0;
+
+    // the DMA waits for the receive data, start it before the SPI
+    dma->setControlBit(ALTERA_AVALON_DMA_CONTROL_RCON_MSK);
+    dma->start(&t);
+
+    msg = AHB_READ_OPCODE << 24;
+    msg |= address << 8;        // Send the 16-bit address
+    msg |= (uint8_t)words;      // Send the number of words to read
+    setTxData(msg);
+    // the DMA empties the receive FIFO, only the transmit FIFO limits the words in flight
+    txCredits = fifoDepth - 1;
+    for (int i = 0; i < words; i++) {
+        setTxDataPaced(0);
+    }
+
+    PCIeMini_status status = dma->waitDone(&t, dmaTimeoutUs, false);
+    if (status != ERRCODE_NO_ERROR)
+        dma->reset();
+    dma->clearControlBit(ALTERA_AVALON_DMA_CONTROL_RCON_MSK);
+    AHB_READ_BURST_END();
+
+    if (status == ERRCODE_NO_ERROR)
+        AlphiBoard::mmioRead(data, staging + 1, words * wordSize);
+    return status;
+}
+
+/**
+ * @brief Read the bursts through a DMA controller
+ *
+ * The staging area is shared by all the users of the DMA controller, acquire() serializes them.
+ * When the controller is owned by another client, the bursts are read by the processor.
+ *
+ * @param dmaCtrl DMA controller, NULL to read by the processor only
+ * @param spiAvlAddress Avalon address of the SPI controller
+ * @param stagingArea Staging area in user space
+ * @param stagingAddress Avalon address of the staging area
+ * @param stagingLength Size of the staging area in bytes
+ */
+void
+TcanInterface::setDmaReader(AlteraDma* dmaCtrl, uint32_t spiAvlAddress, volatile uint32_t* stagingArea,
+    uint32_t stagingAddress, uint32_t stagingLength)
+{
+    dma = dmaCtrl;
+    rxDataAvlAddress = spiAvlAddress + RxDataReg::offset;
+    staging = stagingArea;
+    stagingAvlAddress = stagingAddress;
+    stagingWords = stagingLength / wordSize;
+}
+
+/**
+ * @brief Measure the burst read time by processor and by DMA and set the threshold
+ *
+ * The threshold is the shortest burst from which the DMA is faster for all the longer bursts
+ * measured. The bursts read the MRAM, which is not modified. The bursts access the SPI directly,
+ * so the calibration is refused while an arbiter shares the SPI with other clients.
+ *
+ * @param address Start address of the bursts
+ * @param threshold Destination of the threshold in words, the current one if the calibration fails
+ * @param nbrOfLoops Number of bursts timed for each length
+ *
+ * @return ERRCODE_NO_ERROR, ERRCODE_BUSY if an arbiter is attached or the DMA controller is in use,
+ * ERRCODE_INVALID_MODE if the DMA reader is not configured, or the error of the DMA burst read
+ */
+PCIeMini_status
+TcanInterface::calibrateDmaThreshold(uint16_t address, uint32_t* threshold, int nbrOfLoops)
+{
+    uint32_t data[256];
+    uint32_t best = stagingWords;
+    uint32_t longest = (stagingWords / 2 > 128) ? 128 : stagingWords / 2;
+
+    *threshold = dmaThreshold;
+    if (arbiter != NULL)
+        return ERRCODE_BUSY;
+    if (dma == NULL)
+        return ERRCODE_INVALID_MODE;
+    if (!dma->tryAcquire())
+        return ERRCODE_BUSY;
+
+    for (uint32_t words = longest; words >= 1; words /= 2) {
+        uint64_t t0 = LatencyHistogram::getTimeNs();
+        for (int l = 0; l < nbrOfLoops; l++)
+            readBurstPio(address, (uint16_t)words, data);
+        uint64_t pio = LatencyHistogram::getTimeNs() - t0;
+
+        t0 = LatencyHistogram::getTimeNs();
+        for (int l = 0; l < nbrOfLoops; l++) {
+            PCIeMini_status status = readBurstDma(address, (uint16_t)words, data);
+            if (status != ERRCODE_NO_ERROR) {
+                dma->release();
+                return status;
+            }
+        }
+        uint64_t dmaTime = LatencyHistogram::getTimeNs() - t0;
+
+        if (dmaTime >= pio)
+            break;
+        best = words;
+    }
+    dma->release();
+    dmaThreshold = best;
+    *threshold = best;
+    return ERRCODE_NO_ERROR;
+}
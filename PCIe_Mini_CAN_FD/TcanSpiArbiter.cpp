@@ -0,0 +1,313 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file TcanSpiArbiter.cpp
+* @brief Serialization of the TCAN4550 transactions on the shared SPI controller
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+#include <stdio.h>
+#include "TcanSpiArbiter.h"
+#include "TcanInterface.h"
+
+TcanSpiArbiter::TcanSpiArbiter()
+{
+	for (int i = 0; i < maxChannels; i++) {
+		Channel* chn = &channels[i];
+		chn->tcan = NULL;
+		chn->priority = 0;
+		chn->head = NULL;
+		chn->tail = NULL;
+		chn->served = 0;
+		chn->maxQueued = 0;
+		chn->queued = 0;
+		pthread_mutex_init(&chn->lock, NULL);
+		pthread_cond_init(&chn->doneCond, NULL);
+	}
+	policy = policyFair;
+	quantum = defaultQuantum;
+	lastChannel = -1;
+	pending = 0;
+	sleeping = false;
+	stopRequest = false;
+	running = false;
+	transactions = 0;
+	csSwitches = 0;
+	pthread_mutex_init(&wakeLock, NULL);
+	pthread_cond_init(&wakeCond, NULL);
+}
+
+TcanSpiArbiter::~TcanSpiArbiter()
+{
+	stop();
+	for (int i = 0; i < maxChannels; i++) {
+		pthread_mutex_destroy(&channels[i].lock);
+		pthread_cond_destroy(&channels[i].doneCond);
+	}
+	pthread_mutex_destroy(&wakeLock);
+	pthread_cond_destroy(&wakeCond);
+}
+
+/** @brief Add the interface of a TCAN4550, its channel is its slave select number
+ *
+ * @param tcan Interface of the chip.
+ * @param priority Priority of the channel in priority mode, the highest goes first.
+ * @retval ERRCODE_NO_ERROR, ERRCODE_BUSY while the dispatcher runs.
+ */
+PCIeMini_status TcanSpiArbiter::addChannel(TcanInterface* tcan, int priority)
+{
+	if (running)
+		return ERRCODE_BUSY;
+	if (tcan == NULL || tcan->slave >= maxChannels)
+		return ERRCODE_INVALID_VALUE;
+	channels[tcan->slave].tcan = tcan;
+	channels[tcan->slave].priority = priority;
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Change the priority of a channel, used in priority mode only */
+PCIeMini_status TcanSpiArbiter::setPriority(int channel, int priority)
+{
+	if (channel < 0 || channel >= maxChannels || channels[channel].tcan == NULL)
+		return ERRCODE_INVALID_VALUE;
+	pthread_mutex_lock(&channels[channel].lock);
+	channels[channel].priority = priority;
+	pthread_mutex_unlock(&channels[channel].lock);
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Start the dispatcher thread
+ *
+ * @param schedPolicy policyFair or policyPriority.
+ * @param chipQuantum Largest number of transactions served on one chip before switching to another one.
+ * @retval ERRCODE_NO_ERROR, ERRCODE_BUSY if already started.
+ */
+PCIeMini_status TcanSpiArbiter::start(Policy schedPolicy, uint32_t chipQuantum)
+{
+	if (running)
+		return ERRCODE_BUSY;
+	if (chipQuantum == 0)
+		return ERRCODE_INVALID_VALUE;
+
+	policy = schedPolicy;
+	quantum = chipQuantum;
+	lastChannel = -1;
+	pending = 0;
+	stopRequest = false;
+	__atomic_store_n(&running, true, __ATOMIC_SEQ_CST);
+	if (pthread_create(&dispatcher, NULL, &dispatcherEntry, (void*)this) != 0) {
+		printf("can't create the SPI dispatcher thread\n");
+		running = false;
+		return ERRCODE_INTERNAL_ERROR;
+	}
+	return ERRCODE_NO_ERROR;
+}
+
+/** @brief Execute the queued transactions and stop the dispatcher thread
+ *
+ * The transactions submitted afterwards fail with ERRCODE_INVALID_HANDLE.
+ */
+void TcanSpiArbiter::stop()
+{
+	if (!running)
+		return;
+
+	__atomic_store_n(&running, false, __ATOMIC_SEQ_CST);
+	// a submitter that saw the arbiter running has counted its request once it releases the lock
+	for (int i = 0; i < maxChannels; i++) {
+		pthread_mutex_lock(&channels[i].lock);
+		pthread_mutex_unlock(&channels[i].lock);
+	}
+	pthread_mutex_lock(&wakeLock);
+	stopRequest = true;
+	pthread_cond_signal(&wakeCond);
+	pthread_mutex_unlock(&wakeLock);
+	pthread_join(dispatcher, NULL);
+}
+
+/** @brief Queue a transaction and wait until the dispatcher has executed it
+ *
+ * @param channel Channel of the chip.
+ * @param req Transaction, its result is also returned.
+ * @retval Result of the transaction, ERRCODE_INVALID_HANDLE when the arbiter is stopped.
+ */
+PCIeMini_status TcanSpiArbiter::execute(int channel, TcanSpiRequest* req)
+{
+	if (channel < 0 || channel >= maxChannels || channels[channel].tcan == NULL)
+		return ERRCODE_INVALID_VALUE;
+
+	Channel* chn = &channels[channel];
+	req->next = NULL;
+	req->done = false;
+
+	pthread_mutex_lock(&chn->lock);
+	if (!__atomic_load_n(&running, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_unlock(&chn->lock);
+		return ERRCODE_INVALID_HANDLE;
+	}
+	if (chn->tail == NULL)
+		chn->head = req;
+	else
+		chn->tail->next = req;
+	chn->tail = req;
+	__atomic_store_n(&chn->queued, chn->queued + 1, __ATOMIC_RELEASE);
+	if (chn->queued > chn->maxQueued)
+		chn->maxQueued = chn->queued;
+	__atomic_add_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&chn->lock);
+
+	// the dispatcher checks pending after setting sleeping, one of the two sees the other
+	if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&wakeLock);
+		pthread_cond_signal(&wakeCond);
+		pthread_mutex_unlock(&wakeLock);
+	}
+
+	pthread_mutex_lock(&chn->lock);
+	while (!req->done)
+		pthread_cond_wait(&chn->doneCond, &chn->lock);
+	pthread_mutex_unlock(&chn->lock);
+	return req->result;
+}
+
+void* TcanSpiArbiter::dispatcherEntry(void* context)
+{
+	((TcanSpiArbiter*)context)->dispatch();
+	return NULL;
+}
+
+void TcanSpiArbiter::dispatch()
+{
+	for (;;) {
+		if (__atomic_load_n(&pending, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_lock(&wakeLock);
+			__atomic_store_n(&sleeping, true, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&pending, __ATOMIC_SEQ_CST) == 0 && !stopRequest)
+				pthread_cond_wait(&wakeCond, &wakeLock);
+			__atomic_store_n(&sleeping, false, __ATOMIC_SEQ_CST);
+			bool done = stopRequest && pending == 0;
+			pthread_mutex_unlock(&wakeLock);
+			if (done)
+				return;
+		}
+		int channel = selectChannel();
+		if (channel >= 0)
+			serve(channel);
+	}
+}
+
+/** @brief Pick the next channel to serve, -1 if the queues look empty
+ *
+ * The scan starts after the channel served last, which gives the round robin between the
+ * channels of the same priority.
+ */
+int TcanSpiArbiter::selectChannel()
+{
+	int best = -1;
+
+	for (int i = 1; i <= maxChannels; i++) {
+		int c = (lastChannel + i + maxChannels) % maxChannels;
+		if (__atomic_load_n(&channels[c].queued, __ATOMIC_ACQUIRE) == 0)
+			continue;
+		if (policy == policyFair)
+			return c;
+		if (best < 0 || channels[c].priority > channels[best].priority)
+			best = c;
+	}
+	return best;
+}
+
+/** @brief Execute up to a quantum of the requests queued on a channel */
+void TcanSpiArbiter::serve(int channel)
+{
+	Channel* chn = &channels[channel];
+	TcanSpiRequest* req;
+	TcanSpiRequest* last = NULL;
+	uint32_t count = 0;
+
+	// the requests are detached, and executed without holding the lock
+	pthread_mutex_lock(&chn->lock);
+	TcanSpiRequest* batch = chn->head;
+	for (req = batch; req != NULL && count < quantum; req = req->next) {
+		last = req;
+		count++;
+	}
+	chn->head = req;
+	if (req == NULL)
+		chn->tail = NULL;
+	if (last != NULL)
+		last->next = NULL;
+	__atomic_store_n(&chn->queued, chn->queued - count, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&chn->lock);
+	if (count == 0)
+		return;
+	__atomic_sub_fetch(&pending, count, __ATOMIC_SEQ_CST);
+
+	if (channel != lastChannel) {
+		csSwitches++;
+		lastChannel = channel;
+	}
+	while (batch != NULL) {
+		// the request belongs to its caller again once it is done
+		TcanSpiRequest* next = batch->next;
+		PCIeMini_status result = chn->tcan->runRequest(batch);
+		transactions++;
+		chn->served++;
+		pthread_mutex_lock(&chn->lock);
+		batch->result = result;
+		batch->done = true;
+		pthread_cond_broadcast(&chn->doneCond);
+		pthread_mutex_unlock(&chn->lock);
+		batch = next;
+	}
+}
+
+void TcanSpiArbiter::clearStats()
+{
+	transactions = 0;
+	csSwitches = 0;
+	for (int i = 0; i < maxChannels; i++) {
+		channels[i].served = 0;
+		channels[i].maxQueued = 0;
+	}
+}
+
+void TcanSpiArbiter::printStats()
+{
+	printf("%s, quantum %d: %llu transactions, %llu chip select changes", policy == policyFair ? "fair" : "priority",
+		quantum, (unsigned long long)transactions, (unsigned long long)csSwitches);
+	if (csSwitches > 0)
+		printf(", %.1f transactions per selection", (double)transactions / csSwitches);
+	printf("\n");
+	for (int i = 0; i < maxChannels; i++) {
+		if (channels[i].tcan == NULL)
+			continue;
+		printf("  channel #%d priority %d: %llu transactions, queue depth max %d\n", i, channels[i].priority,
+			(unsigned long long)channels[i].served, channels[i].maxQueued);
+	}
+}
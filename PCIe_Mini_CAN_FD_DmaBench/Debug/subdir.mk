@@ -0,0 +1,24 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+CPP_SRCS += \
+../PCIeMini_CAN_FD_DmaBench.cpp 
+
+OBJS += \
+./PCIeMini_CAN_FD_DmaBench.o 
+
+CPP_DEPS += \
+./PCIeMini_CAN_FD_DmaBench.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+%.o: ../%.cpp
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C++ Compiler'
+	g++ -I"/home/alphi/eclipse-workspace/Alphi_PCIe" -I/home/alphi/eclipse-workspace/Alphi_includes -DDMA_ENABLED -O0 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
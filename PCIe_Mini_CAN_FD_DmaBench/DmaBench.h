@@ -0,0 +1,104 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file DmaBench.h
+* @brief DMA bandwidth and latency benchmark of the PCIeMini_CAN_FD
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#pragma once
+
+#include <stdio.h>
+#include "stdint.h"
+#include "PCIeMini_CAN_FD.h"
+#include "DmaBufferProvider.h"
+#include "LatencyHistogram.h"
+
+/** @brief Sweep of the DMA transfers and of the equivalent processor copies
+ *
+ * Each measurement is one combination of direction, transfer width, completion mode and size.
+ * The processor copies (mmioRead/mmioWrite) are measured for the same directions and sizes, so
+ * the report shows from which size the DMA is faster for each data path.
+ */
+class DmaBench
+{
+public:
+	PCIeMini_CAN_FD* dut;
+
+	enum Direction { dirLocal, dirBrdToHost, dirHostToBrd, nbrOfDirections };
+	enum Method { methodPio, methodDmaPolling, methodDmaIrq };
+
+	/** @brief Result of one measurement */
+	typedef struct Result {
+		Direction direction;
+		Method method;
+		uint32_t width;				///< Transfer width in bytes, 0 for the processor copies
+		uint32_t size;				///< Transfer size in bytes
+		uint32_t errors;			///< Transfers not completed in time, or data mismatches
+		LatencyHistogram setup;		///< From the start of the programming to the launch of the DMA
+		LatencyHistogram latency;	///< From the start of the programming to the end of the transfer
+	} Result;
+
+	static DmaBench* getInstance()
+	{
+		if (benchInstance == NULL) {
+			benchInstance = new DmaBench();
+		}
+		return benchInstance;
+	}
+
+	PCIeMini_status open(int brdNbr);
+	void close();
+	int run(FILE* out, int nbrOfLoops);
+
+	uint32_t maxSize;				///< Largest transfer measured, up to dpr_length / 2
+
+private:
+	inline DmaBench()
+	{
+		dut = new PCIeMini_CAN_FD();
+		buffer = NULL;
+		irqAvailable = false;
+		maxSize = PCIeMini_CAN_FD::dpr_length / 2;
+	}
+	static DmaBench* benchInstance;
+
+	static const uint32_t srcOffset = 0;							///< Source in the DPR, lower half, restored after the run
+	static const uint32_t destOffset = PCIeMini_CAN_FD::dpr_length / 2;	///< Destination in the DPR, upper half
+
+	DmaBuffer* buffer;				///< Host side of the board to host and host to board transfers
+	bool irqAvailable;
+
+	void initResult(Result* r, Direction direction, Method method, uint32_t width, uint32_t size);
+	void fill(Direction direction, uint32_t size, uint32_t seed);
+	uint32_t check(Direction direction, uint32_t size, uint32_t seed);
+	void measureDma(Result* r, int mode, int nbrOfLoops);
+	void measurePio(Result* r, int nbrOfLoops);
+	void printResult(FILE* out, const Result* r, bool first);
+};
@@ -0,0 +1,358 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file PCIeMini_CAN_FD_DmaBench.cpp : DMA bandwidth and latency benchmark, main function and measurements
+*
+* The results are written as JSON on the standard output, or in the file given with o<file>. The
+* progress goes to the standard error.
+*
+* The program and the library must be built with DMA_ENABLED: the hwDMA methods of the board
+* and its DMA controller only exist then.
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include "DmaBench.h"
+#include "UioEnumerator.h"
+
+DmaBench* DmaBench::benchInstance = NULL;
+
+static const char* directionNames[] = { "local", "board_to_host", "host_to_board" };
+static const char* methodNames[] = { "pio", "dma_polling", "dma_irq" };
+
+/** @brief Transfer widths swept, in the order of the Altera HAL modes */
+static const struct {
+	int mode;
+	uint32_t width;
+} dmaWidths[] = {
+	{ ALT_DMA_SET_MODE_8, 1 },
+	{ ALT_DMA_SET_MODE_16, 2 },
+	{ ALT_DMA_SET_MODE_32, 4 },
+	{ ALT_DMA_SET_MODE_64, 8 },
+	{ ALT_DMA_SET_MODE_128, 16 },
+};
+
+int main(int argc, char* argv[])
+{
+	int brdNbr = 0;
+	int nbrOfLoops = 1000;
+	const char* fileName = NULL;
+	DmaBench* bench = DmaBench::getInstance();
+
+	for (int i = 1; i < argc; i++) {
+		switch (argv[i][0]) {
+		case '0':
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9':
+			brdNbr = argv[i][0] - '0';
+			break;
+		case 'n':
+			nbrOfLoops = atoi(argv[i] + 1);
+			if (nbrOfLoops <= 0)
+				nbrOfLoops = 1000;
+			break;
+		case 'm':
+			bench->maxSize = (uint32_t)strtoul(argv[i] + 1, NULL, 0);
+			if (bench->maxSize == 0 || bench->maxSize > PCIeMini_CAN_FD::dpr_length / 2)
+				bench->maxSize = PCIeMini_CAN_FD::dpr_length / 2;
+			break;
+		case 'o':
+			fileName = argv[i] + 1;
+			break;
+		case 's':
+			brdNbr = UioEnumerator::getInstance()->findBySlot(argv[i] + 1);
+			if (brdNbr < 0) {
+				fprintf(stderr, "No board in slot %s\n", argv[i] + 1);
+				exit(1);
+			}
+			break;
+		case '?':
+			printf("Possible options: <brd nbr>, n<loops>: transfers per measurement, m<bytes>: largest transfer, "
+				"o<file>: JSON output file, s<PCI address>: board in this slot\n");
+			exit(0);
+		}
+	}
+
+	PCIeMini_status status = bench->open(brdNbr);
+	if (status != ERRCODE_NO_ERROR) {
+		fprintf(stderr, "Opening the PCIeMini_CAN-FD: %s\n", getAlphiErrorMsg(status));
+		return 1;
+	}
+
+	FILE* out = stdout;
+	if (fileName != NULL && (out = fopen(fileName, "w")) == NULL) {
+		perror(fileName);
+		bench->close();
+		return 1;
+	}
+	int errNbr = bench->run(out, nbrOfLoops);
+	if (out != stdout)
+		fclose(out);
+	bench->close();
+	return errNbr == 0 ? 0 : 2;
+}
+
+/** @brief Open the board, take the DMA controller and allocate the host buffer
+ *
+ * The controller is owned by the benchmark until close(): the TCAN burst reads use the processor.
+ */
+PCIeMini_status DmaBench::open(int brdNbr)
+{
+	PCIeMini_status status = dut->open(brdNbr);
+	if (status != ERRCODE_NO_ERROR)
+		return status;
+	irqAvailable = dut->hwDMAInterruptEnable() == ERRCODE_NO_ERROR;
+	dut->dma->acquire();
+
+	DmaBufferProvider* provider = dut->getDmaProvider();
+	status = provider->allocate(PCIeMini_CAN_FD::dpr_length, &buffer);
+	if (status != ERRCODE_NO_ERROR) {
+		fprintf(stderr, "No %s DMA buffer (%s), the host transfers are skipped\n", provider->getName(),
+			getAlphiErrorMsg(status));
+		buffer = NULL;
+	}
+	return ERRCODE_NO_ERROR;
+}
+
+void DmaBench::close()
+{
+	if (buffer != NULL) {
+		dut->getDmaProvider()->release(buffer);
+		buffer = NULL;
+	}
+	if (dut->dma != NULL) {
+		dut->hwDMAInterruptDisable();
+		dut->dma->reset();
+		dut->dma->release();
+	}
+	dut->close();
+}
+
+/** @brief Write a pattern in the source of the transfers and clear the destination */
+void DmaBench::fill(Direction direction, uint32_t size, uint32_t seed)
+{
+	volatile uint32_t* host = buffer ? (volatile uint32_t*)buffer->address : NULL;
+
+	for (uint32_t i = 0; i < size / 4; i++) {
+		uint32_t v = seed + i * 0x01010101;
+		if (direction == dirHostToBrd) {
+			host[i] = v;
+			dut->dpr[destOffset / 4 + i] = 0;
+		}
+		else {
+			dut->dpr[srcOffset / 4 + i] = v;
+			if (direction == dirLocal)
+				dut->dpr[destOffset / 4 + i] = 0;
+			else
+				host[i] = 0;
+		}
+	}
+}
+
+/** @brief Compare the destination of the transfers with the pattern
+ * @return The number of words that differ.
+ */
+uint32_t DmaBench::check(Direction direction, uint32_t size, uint32_t seed)
+{
+	volatile uint32_t* host = buffer ? (volatile uint32_t*)buffer->address : NULL;
+	uint32_t errNbr = 0;
+
+	for (uint32_t i = 0; i < size / 4; i++) {
+		uint32_t v = (direction == dirBrdToHost) ? host[i] : dut->dpr[destOffset / 4 + i];
+		if (v != seed + i * 0x01010101)
+			errNbr++;
+	}
+	return errNbr;
+}
+
+/** @brief Time nbrOfLoops DMA transfers
+ *
+ * The setup covers the descriptor programming, the translation table lookup for the host
+ * transfers and the launch. The latency adds the transfer and the detection of its end.
+ * @param mode ALT_DMA_SET_MODE_8 to ALT_DMA_SET_MODE_128.
+ */
+void DmaBench::measureDma(Result* r, int mode, int nbrOfLoops)
+{
+	TransferDesc t;
+	bool polling = r->method == methodDmaPolling;
+	uint32_t seed = r->size * 0x10001 + r->width;
+
+	fill(r->direction, r->size, seed);
+	dut->dma->reset();
+	dut->dma->setMode(mode);
+
+	for (int l = 0; l < nbrOfLoops; l++) {
+		uint64_t t0 = LatencyHistogram::getTimeNs();
+		if (r->direction == dirLocal) {
+			t.src_offset = PCIeMini_CAN_FD::dpr_offset + srcOffset;
+			t.dest_offset = PCIeMini_CAN_FD::dpr_offset + destOffset;
+			t.tfr_length = r->size;
+		}
+		else {
+			bool toDevice = r->direction == dirHostToBrd;
+			uint32_t local = PCIeMini_CAN_FD::dpr_offset + (toDevice ? destOffset : srcOffset);
+			if (dut->hwDMAProgram(buffer, 0, r->size, toDevice, local, &t) != ERRCODE_NO_ERROR) {
+				r->errors++;
+				return;
+			}
+		}
+		dut->hwDMAStart(&t);
+		uint64_t t1 = LatencyHistogram::getTimeNs();
+		if (!dut->hwDMAWaitForCompletion(&t, polling)) {
+			r->errors++;
+			dut->dma->reset();
+			dut->dma->setMode(mode);
+			continue;
+		}
+		uint64_t t2 = LatencyHistogram::getTimeNs();
+		r->setup.record(t1 - t0);
+		r->latency.record(t2 - t0);
+	}
+	r->errors += check(r->direction, r->size, seed);
+	dut->dma->reset();
+}
+
+/** @brief Time nbrOfLoops processor copies of the same data path */
+void DmaBench::measurePio(Result* r, int nbrOfLoops)
+{
+	uint32_t staging[PCIeMini_CAN_FD::dpr_length / 4];
+	void* host = buffer ? buffer->address : (void*)staging;
+	uint32_t seed = r->size * 0x10001;
+
+	fill(r->direction, r->size, seed);
+	for (int l = 0; l < nbrOfLoops; l++) {
+		uint64_t t0 = LatencyHistogram::getTimeNs();
+		switch (r->direction) {
+		case dirLocal:
+			AlphiBoard::mmioRead(staging, dut->dpr + srcOffset / 4, r->size);
+			AlphiBoard::mmioWrite(dut->dpr + destOffset / 4, staging, r->size);
+			break;
+		case dirBrdToHost:
+			AlphiBoard::mmioRead(host, dut->dpr + srcOffset / 4, r->size);
+			break;
+		default:
+			AlphiBoard::mmioWrite(dut->dpr + destOffset / 4, host, r->size);
+			break;
+		}
+		r->latency.record(LatencyHistogram::getTimeNs() - t0);
+	}
+	r->errors += check(r->direction, r->size, seed);
+}
+
+void DmaBench::initResult(Result* r, Direction direction, Method method, uint32_t width, uint32_t size)
+{
+	r->direction = direction;
+	r->method = method;
+	r->width = width;
+	r->size = size;
+	r->errors = 0;
+	r->setup.reset();
+	r->latency.reset();
+}
+
+/** @brief Write a measurement as a JSON object */
+void DmaBench::printResult(FILE* out, const Result* r, bool first)
+{
+	double mean = r->latency.getMean();
+
+	fprintf(out, "%s\n    {\"direction\": \"%s\", \"method\": \"%s\", \"width\": %u, \"size\": %u, "
+		"\"count\": %llu, \"errors\": %u, \"mbps\": %.1f,\n", first ? "" : ",",
+		directionNames[r->direction], methodNames[r->method], r->width, r->size,
+		(unsigned long long)r->latency.getCount(), r->errors, mean > 0 ? r->size * 1000.0 / mean : 0.0);
+	fprintf(out, "     \"setup_ns\": {\"mean\": %.0f, \"p50\": %llu, \"p99\": %llu},\n",
+		r->setup.getMean(), (unsigned long long)r->setup.getPercentile(50.0),
+		(unsigned long long)r->setup.getPercentile(99.0));
+	fprintf(out, "     \"latency_ns\": {\"mean\": %.0f, \"p50\": %llu, \"p99\": %llu, \"min\": %llu, \"max\": %llu}}",
+		mean, (unsigned long long)r->latency.getPercentile(50.0), (unsigned long long)r->latency.getPercentile(99.0),
+		(unsigned long long)(r->latency.getCount() ? r->latency.getMin() : 0), (unsigned long long)r->latency.getMax());
+}
+
+/** @brief Run the sweep and write the report
+ *
+ * Sizes go by powers of two from 4 bytes to maxSize. A width is measured only for the sizes
+ * that are a multiple of it; the widths the controller was not built for show as errors.
+ * The source area in the lower half of the DPR holds the NIOS communication pointers, it is
+ * saved before the sweep and restored after it: the NIOS must not be exchanging messages.
+ * @return The total number of errors.
+ */
+int DmaBench::run(FILE* out, int nbrOfLoops)
+{
+	Result* r = new Result;
+	uint32_t errNbr = 0;
+	bool first = true;
+	uint32_t saved[PCIeMini_CAN_FD::dpr_length / 2 / 4];
+
+	AlphiBoard::mmioRead(saved, dut->dpr + srcOffset / 4, sizeof(saved));
+
+	fprintf(out, "{\n  \"board\": \"PCIeMini_CAN_FD\", \"fpga_id\": \"0x%08x\", \"loops\": %d, "
+		"\"irq\": %s, \"host_buffer\": \"%s\",\n  \"results\": [",
+		dut->getFpgaID(), nbrOfLoops, irqAvailable ? "true" : "false",
+		buffer ? dut->getDmaProvider()->getName() : "none");
+
+	for (int d = 0; d < nbrOfDirections; d++) {
+		Direction direction = (Direction)d;
+		if (direction != dirLocal && buffer == NULL)
+			continue;
+
+		for (uint32_t size = 4; size <= maxSize; size *= 2) {
+			fprintf(stderr, "%s %u bytes\n", directionNames[direction], size);
+
+			initResult(r, direction, methodPio, 0, size);
+			measurePio(r, nbrOfLoops);
+			printResult(out, r, first);
+			first = false;
+			errNbr += r->errors;
+
+			for (int m = methodDmaPolling; m <= methodDmaIrq; m++) {
+				if (m == methodDmaIrq && !irqAvailable)
+					continue;
+				for (size_t w = 0; w < sizeof(dmaWidths) / sizeof(dmaWidths[0]); w++) {
+					if (size % dmaWidths[w].width != 0)
+						continue;
+					initResult(r, direction, (Method)m, dmaWidths[w].width, size);
+					measureDma(r, dmaWidths[w].mode, nbrOfLoops);
+					printResult(out, r, false);
+					errNbr += r->errors;
+				}
+			}
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+	AlphiBoard::mmioWrite(dut->dpr + srcOffset / 4, saved, sizeof(saved));
+	delete r;
+	return errNbr;
+}
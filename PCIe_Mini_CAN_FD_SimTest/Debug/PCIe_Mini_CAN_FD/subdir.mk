@@ -0,0 +1,33 @@
+################################################################################
+# Automatically-generated file. Do not edit!
+################################################################################
+
+# Add inputs and outputs from these tool invocations to the build variables 
+CPP_SRCS += \
+/home/alphi/eclipse-workspace/PCIe_Mini_CAN_FD/PCIe_Mini_CAN_FD.cpp \
+/home/alphi/eclipse-workspace/PCIe_Mini_CAN_FD/TCAN4550.cpp \
+/home/alphi/eclipse-workspace/PCIe_Mini_CAN_FD/TCAN4x5x_SPI.cpp \
+/home/alphi/eclipse-workspace/PCIe_Mini_CAN_FD/TcanSpiArbiter.cpp 
+
+OBJS += \
+./PCIe_Mini_CAN_FD/PCIe_Mini_CAN_FD.o \
+./PCIe_Mini_CAN_FD/TCAN4550.o \
+./PCIe_Mini_CAN_FD/TCAN4x5x_SPI.o \
+./PCIe_Mini_CAN_FD/TcanSpiArbiter.o 
+
+CPP_DEPS += \
+./PCIe_Mini_CAN_FD/PCIe_Mini_CAN_FD.d \
+./PCIe_Mini_CAN_FD/TCAN4550.d \
+./PCIe_Mini_CAN_FD/TCAN4x5x_SPI.d \
+./PCIe_Mini_CAN_FD/TcanSpiArbiter.d 
+
+
+# Each subdirectory must supply rules for building sources it contributes
+PCIe_Mini_CAN_FD/%.o: /home/alphi/eclipse-workspace/PCIe_Mini_CAN_FD/%.cpp
+	@echo 'Building file: $<'
+	@echo 'Invoking: GCC C++ Compiler'
+	g++ -I"/home/alphi/eclipse-workspace/Alphi_PCIe" -I/home/alphi/eclipse-workspace/Alphi_includes -O0 -g3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+
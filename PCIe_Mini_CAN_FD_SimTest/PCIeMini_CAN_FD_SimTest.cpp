@@ -0,0 +1,157 @@
+//
+// Copyright (c) 2020 Alphi Technology Corporation, Inc.  All Rights Reserved
+//
+// You are hereby granted a copyright license to use, modify and
+// distribute this SOFTWARE so long as the entire notice is retained
+// without alteration in any modified and/or redistributed versions,
+// and that such modified versions are clearly identified as such.
+// No licenses are granted by implication, estopple or otherwise under
+// any patents or trademarks of Alphi Technology Corporation (Alphi).
+//
+// The SOFTWARE is provided on an "AS IS" basis and without warranty,
+// to the maximum extent permitted by applicable law.
+//
+// ALPHI DISCLAIMS ALL WARRANTIES WHETHER EXPRESS OR IMPLIED, INCLUDING
+// WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE
+// AND ANY WARRANTY AGAINST INFRINGEMENT WITH REGARD TO THE SOFTWARE
+// (INCLUDING ANY MODIFIED VERSIONS THEREOF) AND ANY ACCOMPANYING
+// WRITTEN MATERIAL.
+//
+// To the maximum extent permitted by applicable law, IN NO EVENT SHALL
+// ALPHI BE LIABLE FOR ANY DAMAGE WHATSOEVER (INCLUDING WITHOUT LIMITATION,
+// DAMAGES FOR LOSS OF BUSINESS PROFITS, BUSINESS INTERRUPTION, LOSS OF
+// BUSINESS INFORMATION, OR OTHER PECUNIARY LOSS) ARISING FROM THE USE
+// OR INABILITY TO USE THE SOFTWARE.  GMS assumes no responsibility for
+// for the maintenance or support of the SOFTWARE
+//
+/** @file PCIeMini_CAN_FD_SimTest.cpp
+* @brief Interrupt dispatch test of the PCIe-Mini-CAN-FD library, on the simulated board
+*
+* The board is opened on a SimBackend, so the test runs without hardware. It checks the
+* per-source, mailbox and catch-all dispatch, the masking of the unclaimed sources, the
+* interrupt moderation and the latency histograms. The exit status is the number of failed checks.
+*/
+
+// Maintenance Log
+//---------------------------------------------------------------------
+//---------------------------------------------------------------------
+
+#include <stdio.h>
+#include <unistd.h>
+#include "PCIeMini_CAN_FD.h"
+#include "SimBackend.h"
+
+/** @brief Interrupt source of the simulated board, as seen by a handler */
+typedef struct SimIrqSource {
+	SimBackend* sim;
+	uint32_t line;			///< Interrupt line to clear in the handler, 0 for a latched mailbox
+	volatile int count;		///< Number of handler calls
+} SimIrqSource;
+
+static int nbrOfFailures = 0;
+static IrqLatencyStats latency;
+
+/** @brief Handler of the simulated sources: count the call and clear the line, as a device ISR would */
+static void simIrqHandler(void* userData)
+{
+	SimIrqSource* src = (SimIrqSource*)userData;
+
+	__atomic_add_fetch(&src->count, 1, __ATOMIC_RELEASE);
+	if (src->line != 0)
+		src->sim->clearIrq(src->line);
+}
+
+/** @brief Wait until a handler has been called at least a number of times
+ * @return true if the count has been reached within one second.
+ */
+static bool waitCount(SimIrqSource* src, int count)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (__atomic_load_n(&src->count, __ATOMIC_ACQUIRE) >= count)
+			return true;
+		usleep(1000);
+	}
+	return false;
+}
+
+static void check(bool passed, const char* name)
+{
+	printf("*** %s: %s\n", name, passed ? "PASSED" : "FAILED");
+	if (!passed)
+		nbrOfFailures++;
+}
+
+int main(int argc, char* argv[])
+{
+	PCIeMini_CAN_FD board;
+	SimBackend simulator;
+	PCIeMini_CAN_FD* dut = &board;
+	SimBackend* sim = &simulator;
+	SimIrqSource perSource = { sim, 1 << 3, 0 };
+	SimIrqSource mailbox = { sim, 0, 0 };
+	SimIrqSource catchAll = { sim, 1 << 5, 0 };
+	SimIrqSource lateHandler = { sim, 1 << 7, 0 };
+
+	sim->setBarSize(3, 0x1000);
+	dut->setBackend(sim);
+	if (dut->open(0) != ERRCODE_NO_ERROR) {
+		printf("Can't open the simulated board\n");
+		return 1;
+	}
+
+	dut->hookIrqHandler(3, simIrqHandler, &perSource);
+	dut->hookMailboxHandler(1, simIrqHandler, &mailbox);
+	dut->hookInterruptServiceRoutine(1 << 5, simIrqHandler, &catchAll);
+	dut->cra->setIrqEnableMask(PcieCra::avlIrqMask | PcieCra::a2pMailboxIrqMask);
+
+	// dispatch
+	sim->injectIrq(1 << 3);
+	check(waitCount(&perSource, 1) && catchAll.count == 0, "Per-source dispatch");
+	sim->injectIrq(1 << (PcieCra::a2pMailboxIrqShift + 1));
+	check(waitCount(&mailbox, 1) && catchAll.count == 0, "Mailbox dispatch");
+	sim->injectIrq(1 << 5);
+	check(waitCount(&catchAll, 1) && perSource.count == 1, "Catch-all dispatch");
+	usleep(10000);
+	check(perSource.count == 1 && mailbox.count == 1 && catchAll.count == 1, "One call per interrupt");
+
+	// a line nobody serves is masked once, and enabled again when a handler is attached
+	IrqModerationCounters counters;
+	uint64_t signaled = sim->getSignaledIrqCount();
+	sim->injectIrq(1 << 7);
+	usleep(20000);
+	dut->cra->getIrqModerationCounters(7, &counters);
+	check((dut->cra->getUnclaimedMask() & (1 << 7)) != 0 && counters.unclaimed == 1
+		&& sim->getSignaledIrqCount() - signaled < 4, "Unclaimed source masked");
+	dut->hookIrqHandler(7, simIrqHandler, &lateHandler);
+	sim->runModels();		// the simulator does not trap the enable register write
+	check(waitCount(&lateHandler, 1) && dut->cra->getUnclaimedMask() == 0, "Unclaimed source served by a new handler");
+
+	// moderation: at most one interrupt per window, the others are coalesced
+	int nbrOfPulses = 100;
+	int before = perSource.count;
+	dut->cra->setIrqModeration(3, 2000, 1);
+	for (int i = 0; i < nbrOfPulses; i++) {
+		sim->injectIrq(1 << 3);
+		usleep(50);
+	}
+	waitCount(&perSource, before + 1);
+	usleep(20000);
+	dut->cra->getIrqModerationCounters(3, &counters);
+	check(counters.coalesced > 0 && counters.windows > 0 && perSource.count - before < nbrOfPulses,
+		"Interrupt moderation");
+	dut->cra->setIrqModeration(3, 0, 0);
+
+	// histograms
+	check(dut->measureIrqThreadWakeLatency(20) == ERRCODE_NO_ERROR, "Thread wake up measurement");
+	dut->getIrqLatencySnapshot(&latency);
+	check(latency.wakeToDispatch.getCount() > 0 && latency.handlerTime.getCount() > 0
+		&& latency.threadWake.getCount() == 20, "Latency histograms");
+	if (argc > 1)
+		dut->printIrqLatency();
+
+	dut->unhookInterruptServiceRoutine();
+	dut->close();
+
+	printf("%d check(s) failed\n", nbrOfFailures);
+	return nbrOfFailures;
+}